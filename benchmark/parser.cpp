@@ -0,0 +1,82 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "parser.h"
+#include "random.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * @brief Return the text of a scene with nObjects spheres and boxes, using a few materials and float variables.
+ */
+string generateScene(int nObjects) {
+	PCG pcg;
+	ostringstream scene;
+	scene << "float radius(0.1)\n";
+	scene << "material red(diffuse(uniform(<0.8, 0.2, 0.2>)), uniform(<0, 0, 0>))\n";
+	scene << "material green(diffuse(checkered(<0.2, 0.8, 0.2>, <1, 1, 1>, 4)), uniform(<0, 0, 0>))\n";
+	scene << "material mirror(specular(uniform(<0.9, 0.9, 0.9>), 0), uniform(<0, 0, 0>))\n";
+	scene << "camera(perspective, translation([-10, 0, 0]), 1.0)\n";
+	const char *materials[] = {"red", "green", "mirror"};
+	for (int i{}; i < nObjects; i++) {
+		float x = 100.f * pcg.randFloat(), y = 100.f * pcg.randFloat(), z = 100.f * pcg.randFloat();
+		if (i % 2)
+			scene << "sphere(" << materials[i % 3] << ", translation([" << x << ", " << y << ", " << z << "]) * scaling([radius, radius, radius]))\n";
+		else
+			scene << "box(" << materials[i % 3] << ", [0, 0, 0], [1, 1, 1], translation([" << x << ", " << y << ", " << z << "]) * rotation_z(" << 360.f * pcg.randFloat() << "))\n";
+	}
+	return scene.str();
+}
+
+int main(int argc, char *argv[]) {
+	int maxObjects = argc > 1 ? stoi(argv[1]) : 100000;
+
+	// Parsing must scale linearly: the time per object should not grow with the size of the scene
+	int nShapes{};
+	for (int nObjects = maxObjects / 100; nObjects <= maxObjects; nObjects *= 10) {
+		string text{generateScene(nObjects)};
+		auto start = chrono::steady_clock::now();
+		InputStream stream{string_view{text}, "benchmark"};
+		Scene scene{stream.parseScene(unordered_map<string, float>{}, 1.f)};
+		chrono::duration<double, micro> elapsed{chrono::steady_clock::now() - start};
+		nShapes = scene.world.shapes.size();
+		cout << nObjects << " objects: " << elapsed.count() / 1e6 << " s, " << elapsed.count() / nObjects << " us per object" << endl;
+	}
+
+	// Lexing alone, compared with a plain scan of the same text
+	string text{generateScene(maxObjects)};
+	double megabytes = text.size() / 1e6;
+	auto start = chrono::steady_clock::now();
+	InputStream stream{string_view{text}, "benchmark"};
+	long nTokens{};
+	while (stream.readToken().type != TokenType::STOP)
+		nTokens++;
+	chrono::duration<double> lexing{chrono::steady_clock::now() - start};
+	start = chrono::steady_clock::now();
+	long nLines = count(text.begin(), text.end(), '\n');
+	chrono::duration<double> scan{chrono::steady_clock::now() - start};
+	cout << "Lexing " << megabytes << " MB: " << nTokens << " tokens, " << megabytes / lexing.count() << " MB/s" << endl;
+	cout << "Counting the " << nLines << " lines: " << megabytes / scan.count() << " MB/s" << endl;
+
+	return nShapes == maxObjects ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "hdr-image.h"
+#include "random.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief Return the time in seconds taken by f.
+ */
+template <typename F> double timeIt(F f) {
+	auto start = chrono::steady_clock::now();
+	f();
+	return chrono::duration<double>{chrono::steady_clock::now() - start}.count();
+}
+
+/**
+ * @brief Return true if the images have the same size and exactly the same pixels.
+ */
+bool isSame(const HdrImage &a, const HdrImage &b) {
+	return a.width == b.width and a.height == b.height and a.pixels.size() == b.pixels.size()
+		and memcmp(a.pixels.data(), b.pixels.data(), a.pixels.size() * sizeof(Color)) == 0;
+}
+
+int main(int argc, char *argv[]) {
+	// A 4K image by default
+	int width = argc > 2 ? stoi(argv[1]) : 3840;
+	int height = argc > 2 ? stoi(argv[2]) : 2160;
+	const string fileName{"pfm-benchmark.pfm"};
+
+	PCG pcg;
+	HdrImage image{width, height};
+	for (auto &pixel : image.pixels)
+		pixel = Color{pcg.randFloat(), 10.f * pcg.randFloat(), 100.f * pcg.randFloat()};
+	double megabytes = 12. * width * height / 1e6;
+	cout << width << "x" << height << " image, " << megabytes << " MB" << endl;
+
+	bool same = true;
+	for (Endianness endianness : {Endianness::littleEndian, Endianness::bigEndian}) {
+		const char *name = endianness == Endianness::littleEndian ? "little endian" : "big endian";
+		double writing = timeIt([&]() {
+			ofstream stream{fileName, ios::binary};
+			image.writePfm(stream, endianness);
+		});
+		HdrImage fromFile, fromStream;
+		double readingFile = timeIt([&]() {
+			fromFile.readPfm(fileName);
+		});
+		double readingStream = timeIt([&]() {
+			ifstream stream{fileName, ios::binary};
+			fromStream.readPfm(stream);
+		});
+		same = same and isSame(fromFile, image) and isSame(fromStream, image);
+		cout << name << ": writing " << megabytes / writing << " MB/s, reading the file "
+			<< megabytes / readingFile << " MB/s, reading a stream " << megabytes / readingStream << " MB/s" << endl;
+	}
+
+	// The same amount of data written and read with a single call, as a reference
+	vector<char> raw(12ul * width * height);
+	double rawWriting = timeIt([&]() {
+		ofstream stream{fileName, ios::binary};
+		stream.write(raw.data(), raw.size());
+	});
+	double rawReading = timeIt([&]() {
+		ifstream stream{fileName, ios::binary};
+		stream.read(raw.data(), raw.size());
+	});
+	cout << "single call: writing " << megabytes / rawWriting << " MB/s, reading " << megabytes / rawReading << " MB/s" << endl;
+
+	// Conversion to 8 bits with gamma correction; bmp files are not compressed, so the conversion dominates
+	const string ldrFileName{"pfm-benchmark.bmp"};
+	float luminosity;
+	double averaging = timeIt([&]() {
+		luminosity = image.averageLuminosity();
+	});
+	double normalizing = timeIt([&]() {
+		image.normalizeImage(.3f, luminosity);
+		image.clampImage();
+	});
+	cout << "average luminosity: " << width * height / averaging / 1e6 << " Mpixel/s, normalizing and clamping: "
+		<< width * height / normalizing / 1e6 << " Mpixel/s" << endl;
+	double ldrWriting = timeIt([&]() {
+		image.writeBmp(ldrFileName.c_str(), 2.2f);
+	});
+	cout << "writing a bmp with gamma 2.2: " << ldrWriting << " s, " << width * height / ldrWriting / 1e6 << " Mpixel/s" << endl;
+
+	remove(fileName.c_str());
+	remove(ldrFileName.c_str());
+	if (!same)
+		cerr << "Error: the image read differs from the one written" << endl;
+	return same ? 0 : 1;
+}
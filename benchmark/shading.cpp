@@ -0,0 +1,117 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "material.h"
+#include "random.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Sample {
+	Vec2D uv;
+	Normal normal;
+	Vec dir;
+	Point point;
+	int material;
+};
+
+/**
+ * @brief Time the shading function on all the samples, returning the sum of the colors to check the results.
+ */
+template <typename F> float run(string name, F shade, vector<Sample> &samples, int nRepetitions) {
+	Color sum{0.f, 0.f, 0.f};
+	auto start = chrono::steady_clock::now();
+	for (int i{}; i < nRepetitions; i++)
+		for (auto &sample : samples)
+			sum += shade(sample);
+	chrono::duration<double, nano> elapsed{chrono::steady_clock::now() - start};
+	cout << "\t" << name << ": " << elapsed.count() / ((double) samples.size() * nRepetitions) << " ns per sample" << endl;
+	return sum.r + sum.g + sum.b;
+}
+
+int main(int argc, char *argv[]) {
+	int nSamples = argc > 1 ? stoi(argv[1]) : 100000;
+	int nRepetitions = argc > 2 ? stoi(argv[2]) : 20;
+
+	// Mostly uniform pigments, as in typical scenes
+	HdrImage image{16, 16};
+	for (int row{}; row < image.height; row++)
+		for (int col{}; col < image.width; col++)
+			image.setPixel(col, row, Color{col / 16.f, row / 16.f, .5f});
+	vector<Material> materials{
+		Material{DiffusiveBRDF{UniformPigment{Color{.8f, .2f, .2f}}}},
+		Material{DiffusiveBRDF{UniformPigment{Color{.2f, .8f, .2f}}}},
+		Material{DiffusiveBRDF{CheckeredPigment{WHITE, BLACK, 4}}},
+		Material{SpecularBRDF{0.f, UniformPigment{Color{.9f, .9f, .9f}}}},
+		Material{DielectricBSDF{1.5f, UniformPigment{WHITE}}},
+		Material{DiffusiveBRDF{ImagePigment{image}}},
+		Material{DiffusiveBRDF{}, UniformPigment{WHITE}},
+	};
+
+	PCG pcg;
+	vector<Sample> samples;
+	for (int i{}; i < nSamples; i++) {
+		Vec normal{pcg.randFloat() - .5f, pcg.randFloat() - .5f, pcg.randFloat() - .5f};
+		normal.normalize();
+		Vec dir{pcg.randDir(Normal{normal.x, normal.y, normal.z})};
+		samples.push_back(Sample{
+			Vec2D{pcg.randFloat(), pcg.randFloat()},
+			Normal{normal.x, normal.y, normal.z},
+			-dir,
+			Point{pcg.randFloat(), pcg.randFloat(), pcg.randFloat()},
+			(int) (pcg.randFloat() * materials.size()) % (int) materials.size()});
+	}
+
+	bool sameResults = true;
+	for (string order : {"random", "sorted"}) {
+		// Neighbouring pixels often hit the same material, which makes both kinds of dispatch easier to predict
+		if (order == "sorted")
+			sort(samples.begin(), samples.end(), [](const Sample &a, const Sample &b) { return a.material < b.material; });
+		cout << "Materials in " << order << " order" << endl;
+
+		// The colors of the BRDF and of the emission, read at each hit by a path tracer
+		float virtualColors = run("Pigments, virtual", [&](Sample &sample) {
+			Material &material{materials[sample.material]};
+			return (*material.brdf->pigment)(sample.uv) + (*material.emittedRadiance)(sample.uv);
+		}, samples, nRepetitions);
+		float dispatchColors = run("Pigments, tag dispatch", [&](Sample &sample) {
+			Material &material{materials[sample.material]};
+			return material.brdf->pigment->at(sample.uv) + material.emittedRadiance->at(sample.uv);
+		}, samples, nRepetitions);
+
+		// The scattered ray
+		PCG virtualPcg, dispatchPcg;
+		float virtualRays = run("Scattering, virtual", [&](Sample &sample) {
+			Ray ray{materials[sample.material].brdf->scatterRay(virtualPcg, sample.dir, sample.point, sample.normal, 1, true)};
+			return Color{ray.dir.x, ray.dir.y, ray.dir.z};
+		}, samples, nRepetitions);
+		float dispatchRays = run("Scattering, tag dispatch", [&](Sample &sample) {
+			Ray ray{materials[sample.material].brdf->dispatchScatterRay(dispatchPcg, sample.dir, sample.point, sample.normal, 1, true)};
+			return Color{ray.dir.x, ray.dir.y, ray.dir.z};
+		}, samples, nRepetitions);
+
+		cout << "\tSum of colors: " << virtualColors << " (virtual), " << dispatchColors << " (tag dispatch)" << endl;
+		cout << "\tSum of directions: " << virtualRays << " (virtual), " << dispatchRays << " (tag dispatch)" << endl;
+		sameResults = sameResults and virtualColors == dispatchColors and virtualRays == dispatchRays;
+	}
+	return sameResults ? 0 : 1;
+}
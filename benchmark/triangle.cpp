@@ -0,0 +1,110 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "shape.h"
+#include "random.h"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// The Cramer's rule kernel previously used by Triangle::rayIntersection, kept as a reference
+
+float determinantOfMatrix(float mat[3][3]) {
+	float ans;
+	ans = mat[0][0] * (mat[1][1] * mat[2][2] - mat[2][1] * mat[1][2])
+		- mat[0][1] * (mat[1][0] * mat[2][2] - mat[1][2] * mat[2][0])
+		+ mat[0][2] * (mat[1][0] * mat[2][1] - mat[1][1] * mat[2][0]);
+	return ans;
+}
+
+std::vector<float> findSolution(float a[3][3], Vec b) {
+	float m1[3][3] = {{b.x, a[0][1], a[0][2]}, {b.y, a[1][1], a[1][2]}, {b.z, a[2][1], a[2][2]}};
+	float m2[3][3] = {{a[0][0], b.x, a[0][2]}, {a[1][0], b.y, a[1][2]}, {a[2][0], b.z, a[2][2]}};
+	float m3[3][3] = {{a[0][0], a[0][1], b.x}, {a[1][0], a[1][1], b.y}, {a[2][0], a[2][1], b.z}};
+	float D = determinantOfMatrix(a);
+	return std::vector<float> {determinantOfMatrix(m1)/D, determinantOfMatrix(m2)/D, determinantOfMatrix(m3)/D};
+}
+
+bool cramerIntersection(Ray ray, Point A, Point B, Point C, float &t) {
+	float s[3][3] = {{(B-A).x, (C-A).x, ray.dir.x},
+					{(B-A).y, (C-A).y, ray.dir.y},
+					{(B-A).z, (C-A).z, ray.dir.z}};
+	Vec b{ray.origin-A};
+	if (determinantOfMatrix(s) == 0.f)
+		return false;
+	std::vector<float> solution = findSolution(s, b);
+	if (!(ray.tmin < -solution[2] && -solution[2] < ray.tmax)
+		|| !(0 < solution[1] && solution[1] < 1)
+		|| !(0 < solution[0] && solution[0] < 1)
+		|| !(0 < 1-solution[0]-solution[1] && 1-solution[0]-solution[1] < 1))
+		return false;
+	t = -solution[2];
+	return true;
+}
+
+bool watertightIntersection(Ray ray, Point A, Point B, Point C, float &t) {
+	float beta, gamma;
+	return intersectTriangle(TriangleRay{ray}, A, B, C, ray.tmin, ray.tmax, t, beta, gamma);
+}
+
+/**
+ * @brief Time the kernel on all the pairs of rays and triangles, returning the number of hits.
+ */
+template <typename F> int run(string name, F kernel, vector<Ray> &rays, vector<Point> &vertices, float &sum) {
+	int hits = 0;
+	sum = 0.f;
+	auto start = chrono::steady_clock::now();
+	for (auto &ray : rays) {
+		for (size_t i{}; i < vertices.size(); i += 3) {
+			float t;
+			if (kernel(ray, vertices[i], vertices[i + 1], vertices[i + 2], t)) {
+				hits++;
+				sum += t;
+			}
+		}
+	}
+	chrono::duration<double, nano> elapsed{chrono::steady_clock::now() - start};
+	double tests = (double) rays.size() * vertices.size() / 3;
+	cout << name << ": " << elapsed.count() / tests << " ns per test, " << hits << " hits" << endl;
+	return hits;
+}
+
+int main(int argc, char *argv[]) {
+	int nRays = argc > 1 ? stoi(argv[1]) : 1000;
+	int nTriangles = argc > 2 ? stoi(argv[2]) : 1000;
+
+	// Triangles scattered in the unit cube, rays from the outside towards it
+	PCG pcg;
+	vector<Point> vertices;
+	for (int i{}; i < 3 * nTriangles; i++)
+		vertices.push_back(Point{pcg.randFloat(), pcg.randFloat(), pcg.randFloat()});
+	vector<Ray> rays;
+	for (int i{}; i < nRays; i++) {
+		Point origin{-1.f, 2.f * pcg.randFloat() - .5f, 2.f * pcg.randFloat() - .5f};
+		Point target{pcg.randFloat(), pcg.randFloat(), pcg.randFloat()};
+		rays.push_back(Ray{origin, target - origin});
+	}
+
+	float cramerSum, watertightSum;
+	int cramerHits = run("Cramer", cramerIntersection, rays, vertices, cramerSum);
+	int watertightHits = run("Watertight", watertightIntersection, rays, vertices, watertightSum);
+	cout << "Sum of t: " << cramerSum << " (Cramer), " << watertightSum << " (watertight)" << endl;
+	return cramerHits == watertightHits ? 0 : 1;
+}
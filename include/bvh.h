@@ -0,0 +1,423 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include "geometry.h"
+#include "camera.h"
+
+/**
+ * @brief An axis-aligned bounding box.
+ * @details A default-constructed box is empty, i.e. it contains no point and merging it with another box returns the other box.
+ *
+ * @param pMin	The corner with the lowest coordinates.
+ * @param pMax	The corner with the highest coordinates.
+ */
+struct AABB {
+	Point pMin{std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()};
+	Point pMax{-std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()};
+
+	AABB() {}
+	AABB(Point pMin, Point pMax): pMin{pMin}, pMax{pMax} {}
+
+	/**
+	 * @brief Return a box containing the whole space.
+	 */
+	static AABB infinite() {
+		const float inf = std::numeric_limits<float>::infinity();
+		return AABB{Point{-inf, -inf, -inf}, Point{inf, inf, inf}};
+	}
+
+	bool isEmpty() const {
+		return pMin.x > pMax.x or pMin.y > pMax.y or pMin.z > pMax.z;
+	}
+
+	/**
+	 * @brief Return true if the box is not empty and all its coordinates are finite.
+	 */
+	bool isFinite() const {
+		return !isEmpty() and
+			std::isfinite(pMin.x) and std::isfinite(pMin.y) and std::isfinite(pMin.z) and
+			std::isfinite(pMax.x) and std::isfinite(pMax.y) and std::isfinite(pMax.z);
+	}
+
+	/**
+	 * @brief Enlarge the box so that it contains the point p.
+	 */
+	void extend(const Point &p) {
+		pMin = Point{std::min(pMin.x, p.x), std::min(pMin.y, p.y), std::min(pMin.z, p.z)};
+		pMax = Point{std::max(pMax.x, p.x), std::max(pMax.y, p.y), std::max(pMax.z, p.z)};
+	}
+
+	/**
+	 * @brief Return the smallest box containing both this box and the other one.
+	 */
+	AABB merge(const AABB &other) const {
+		return AABB{
+			Point{std::min(pMin.x, other.pMin.x), std::min(pMin.y, other.pMin.y), std::min(pMin.z, other.pMin.z)},
+			Point{std::max(pMax.x, other.pMax.x), std::max(pMax.y, other.pMax.y), std::max(pMax.z, other.pMax.z)}};
+	}
+
+	/**
+	 * @brief Return the box containing the points that belong to both this box and the other one.
+	 * @details The result is empty if the boxes do not overlap.
+	 */
+	AABB overlap(const AABB &other) const {
+		return AABB{
+			Point{std::max(pMin.x, other.pMin.x), std::max(pMin.y, other.pMin.y), std::max(pMin.z, other.pMin.z)},
+			Point{std::min(pMax.x, other.pMax.x), std::min(pMax.y, other.pMax.y), std::min(pMax.z, other.pMax.z)}};
+	}
+
+	bool overlaps(const AABB &other) const {
+		return !overlap(other).isEmpty();
+	}
+
+	bool contains(const Point &p) const {
+		return pMin.x <= p.x and p.x <= pMax.x and
+			pMin.y <= p.y and p.y <= pMax.y and
+			pMin.z <= p.z and p.z <= pMax.z;
+	}
+
+	Point centroid() const {
+		return Point{.5f * (pMin.x + pMax.x), .5f * (pMin.y + pMax.y), .5f * (pMin.z + pMax.z)};
+	}
+
+	float surfaceArea() const {
+		if (isEmpty())
+			return 0.f;
+		float dx = pMax.x - pMin.x, dy = pMax.y - pMin.y, dz = pMax.z - pMin.z;
+		return 2.f * (dx * dy + dy * dz + dz * dx);
+	}
+
+	/**
+	 * @brief Return the axis (0: x, 1: y, 2: z) along which the box is largest.
+	 */
+	int largestAxis() const {
+		float dx = pMax.x - pMin.x, dy = pMax.y - pMin.y, dz = pMax.z - pMin.z;
+		if (dx > dy and dx > dz)
+			return 0;
+		return dy > dz ? 1 : 2;
+	}
+
+	/**
+	 * @brief 	Slab test between the box and a ray.
+	 * @details The ray is given by its origin and the inverse of its direction, so that it can be precomputed once for many boxes.
+	 * 			Only the portion of the ray in [tmin, tmax] is considered.
+	 *
+	 * @param origin	The origin of the ray.
+	 * @param invDir	The componentwise inverse of the ray direction.
+	 * @param tmin		The lower end of the ray parameter range.
+	 * @param tmax		The upper end of the ray parameter range.
+	 * @param tEnter	Set to the ray parameter at which the ray enters the box.
+	 * @return true if the ray hits the box in [tmin, tmax]. Empty boxes are never hit.
+	 */
+	bool intersect(const Point &origin, const Vec &invDir, float tmin, float tmax, float &tEnter) const {
+		if (isEmpty())
+			return false;
+		for (int i{}; i < 3; i++) {
+			float tNear = (pMin[i] - origin[i]) * invDir[i];
+			float tFar = (pMax[i] - origin[i]) * invDir[i];
+			if (tNear > tFar)
+				std::swap(tNear, tFar);
+			// Be conservative with respect to rounding errors
+			tFar *= 1.00000024f;
+			// Written so that NaNs (0 * inf, for rays parallel to a slab) leave tmin and tmax unchanged
+			tmin = tNear > tmin ? tNear : tmin;
+			tmax = tFar < tmax ? tFar : tmax;
+			if (tmin > tmax)
+				return false;
+		}
+		tEnter = tmin;
+		return true;
+	}
+
+	bool intersect(Ray ray) const {
+		float tEnter;
+		return intersect(ray.origin, Vec{1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z}, ray.tmin, ray.tmax, tEnter);
+	}
+
+	bool operator==(const AABB &other) const {
+		return areClose(pMin, other.pMin, 1e-5f) and areClose(pMax, other.pMax, 1e-5f);
+	}
+
+	operator std::string() const {
+		std::ostringstream ss;
+		ss << "AABB(" << std::string{pMin} << ", " << std::string{pMax} << ")";
+		return ss.str();
+	}
+};
+
+/**
+ * @brief Return the bounding box of the transformed box.
+ * @details The transformed corners are enclosed in a new axis-aligned box. Non finite boxes are returned unchanged.
+ */
+AABB operator*(const Transformation &tr, AABB box) {
+	if (!box.isFinite())
+		return box;
+	AABB result;
+	for (int i{}; i < 8; i++)
+		result.extend(tr * Point{
+			(i & 1) ? box.pMax.x : box.pMin.x,
+			(i & 2) ? box.pMax.y : box.pMin.y,
+			(i & 4) ? box.pMax.z : box.pMin.z});
+	return result;
+}
+
+/**
+ * @brief A node of a flattened BVH.
+ * @details Nodes are stored in depth-first order: the first child of an inner node immediately follows it.
+ *
+ * @param box	The bounding box of all the primitives in the subtree.
+ * @param first	For a leaf, the offset of its first primitive in BVH::indices; for an inner node, the index of its second child.
+ * @param count	The number of primitives of a leaf, 0 for inner nodes.
+ * @param axis	The axis the primitives of an inner node were split along.
+ */
+struct BVHNode {
+	AABB box;
+	int first;
+	int count;
+	int axis;
+};
+
+/**
+ * @brief A bounding volume hierarchy built with the surface area heuristic (SAH).
+ * @details The BVH only stores indices of primitives, so that it can be used with any kind of primitive
+ * 			(e.g. the shapes of a World) given their bounding boxes.
+ *
+ * @param nodes		The flattened tree.
+ * @param indices	The indices of the primitives, sorted so that each leaf refers to a contiguous range.
+ */
+struct BVH {
+	std::vector<BVHNode> nodes;
+	std::vector<int> indices;
+
+	BVH() {}
+	BVH(const std::vector<AABB> &bounds) {
+		build(bounds);
+	}
+
+	/**
+	 * @brief Build the tree over a list of finite bounding boxes.
+	 *
+	 * @param bounds	The bounding box of each primitive: primitive i has bounds[i].
+	 */
+	void build(const std::vector<AABB> &bounds) {
+		nodes.clear();
+		indices.resize(bounds.size());
+		for (int i{}; i < (int) bounds.size(); i++)
+			indices[i] = i;
+		if (bounds.empty())
+			return;
+
+		std::vector<Point> centroids;
+		centroids.reserve(bounds.size());
+		for (auto &box : bounds)
+			centroids.push_back(box.centroid());
+
+		nodes.reserve(2 * bounds.size());
+		buildNode(bounds, centroids, 0, (int) bounds.size(), 0);
+	}
+
+	/**
+	 * @brief 	Visit all the primitives whose bounding box may be hit by the ray before tmax.
+	 * @details Children are visited front to back, so that the callback can shrink tmax
+	 * 			when it finds a hit and let the traversal skip farther subtrees.
+	 * 			Setting tmax below ray.tmin (e.g. to -infinity) stops the traversal.
+	 *
+	 * @tparam F		The callback type, with signature void(int index, float &tmax).
+	 * @param ray		The ray.
+	 * @param tmax		The current upper bound for the ray parameter (e.g. the closest hit found so far).
+	 * @param visit		The callback, called with the index of each primitive to test.
+	 */
+	template <typename F> void traverse(Ray ray, float &tmax, F &&visit) const {
+		if (nodes.empty())
+			return;
+
+		Vec invDir{1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z};
+		const bool dirIsNeg[3] = {invDir.x < 0.f, invDir.y < 0.f, invDir.z < 0.f};
+		int stack[maxDepth + 1];
+		int top = 0, current = 0;
+
+		for (;;) {
+			const BVHNode &node = nodes[current];
+			float tEnter;
+			if (node.box.intersect(ray.origin, invDir, ray.tmin, tmax, tEnter)) {
+				if (node.count > 0) {
+					for (int i{node.first}; i < node.first + node.count; i++) {
+						visit(indices[i], tmax);
+						if (tmax < ray.tmin)
+							return;
+					}
+				} else {
+					// Visit first the child which is nearer to the ray origin
+					if (dirIsNeg[node.axis]) {
+						stack[top++] = current + 1;
+						current = node.first;
+					} else {
+						stack[top++] = node.first;
+						current = current + 1;
+					}
+					continue;
+				}
+			}
+			if (top == 0)
+				break;
+			current = stack[--top];
+		}
+	}
+
+	/**
+	 * @brief 	Return true if the tree can be traversed safely, e.g. after reading it from a file.
+	 * @details Every leaf must refer to a range of indices, every index must refer to one of nPrimitives primitives,
+	 * 			and the children of every inner node must follow it, not deeper than the traversal stack allows.
+	 */
+	bool isValid(size_t nPrimitives) const {
+		for (int index : indices)
+			if (index < 0 or (size_t) index >= nPrimitives)
+				return false;
+
+		// The depth of each node, or -1 if it cannot be reached from the root
+		std::vector<int> depth(nodes.size(), -1);
+		if (!nodes.empty())
+			depth[0] = 0;
+		for (size_t i{}; i < nodes.size(); i++) {
+			const BVHNode &node = nodes[i];
+			if (depth[i] < 0)
+				continue;
+			if (node.count < 0)
+				return false;
+			if (node.count > 0) {
+				if (node.first < 0 or (size_t) node.first + node.count > indices.size())
+					return false;
+				continue;
+			}
+			if (node.axis < 0 or node.axis > 2 or depth[i] > maxDepth)
+				return false;
+			if (node.first <= (int) i + 1 or (size_t) node.first >= nodes.size())
+				return false;
+			depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+			depth[node.first] = std::max(depth[node.first], depth[i] + 1);
+		}
+		return true;
+	}
+
+private:
+	static const int nBins = 12;
+	static const int maxLeafSize = 4;
+	static const int maxDepth = 64;
+
+	/**
+	 * @brief Recursively build the subtree containing the primitives indices[begin, end).
+	 *
+	 * @return int	The index of the new node in nodes.
+	 */
+	int buildNode(const std::vector<AABB> &bounds, const std::vector<Point> &centroids, int begin, int end, int depth) {
+		int index = nodes.size();
+		nodes.push_back(BVHNode{});
+
+		AABB box, centroidBox;
+		for (int i{begin}; i < end; i++) {
+			box = box.merge(bounds[indices[i]]);
+			centroidBox.extend(centroids[indices[i]]);
+		}
+		nodes[index].box = box;
+
+		int n = end - begin;
+		int axis = centroidBox.largestAxis();
+		float cMin = centroidBox.pMin[axis], extent = centroidBox.pMax[axis] - cMin;
+		if (n == 1 or extent <= 0.f or depth >= maxDepth)
+			return makeLeaf(index, begin, n);
+
+		// Bin the primitives according to their centroids
+		struct Bin {
+			AABB box;
+			int count = 0;
+		} bins[nBins];
+		auto binIndex = [&](int i) {
+			int b = nBins * ((centroids[i][axis] - cMin) / extent);
+			return std::min(b, nBins - 1);
+		};
+		for (int i{begin}; i < end; i++) {
+			Bin &bin = bins[binIndex(indices[i])];
+			bin.box = bin.box.merge(bounds[indices[i]]);
+			bin.count++;
+		}
+
+		// Sweep the bins to evaluate the SAH cost of splitting after each of them
+		float rightArea[nBins - 1];
+		int rightCount[nBins - 1];
+		AABB accumulated;
+		int count = 0;
+		for (int b{nBins - 1}; b > 0; b--) {
+			accumulated = accumulated.merge(bins[b].box);
+			count += bins[b].count;
+			rightArea[b - 1] = accumulated.surfaceArea();
+			rightCount[b - 1] = count;
+		}
+		float bestCost = std::numeric_limits<float>::infinity();
+		int bestSplit = 0;
+		accumulated = AABB{};
+		count = 0;
+		for (int b{}; b < nBins - 1; b++) {
+			accumulated = accumulated.merge(bins[b].box);
+			count += bins[b].count;
+			float cost = accumulated.surfaceArea() * count + rightArea[b] * rightCount[b];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+
+		// Compare with the cost of a leaf, assuming that a traversal step costs as much as a primitive intersection
+		float area = box.surfaceArea();
+		float splitCost = 1.f + (area > 0.f and std::isfinite(area) ? bestCost / area : 0.f);
+		if (n <= maxLeafSize and splitCost >= n)
+			return makeLeaf(index, begin, n);
+
+		int *mid = std::partition(&indices[begin], &indices[begin] + n, [&](int i) {
+			return binIndex(i) <= bestSplit;
+		});
+		int middle = mid - &indices[0];
+		if (middle == begin or middle == end) {
+			// All the primitives fell on the same side: split them in two halves
+			middle = (begin + end) / 2;
+			std::nth_element(&indices[begin], &indices[middle], &indices[begin] + n, [&](int i, int j) {
+				return centroids[i][axis] < centroids[j][axis];
+			});
+		}
+
+		nodes[index].axis = axis;
+		nodes[index].count = 0;
+		buildNode(bounds, centroids, begin, middle, depth + 1);
+		nodes[index].first = buildNode(bounds, centroids, middle, end, depth + 1);
+		return index;
+	}
+
+	int makeLeaf(int index, int begin, int n) {
+		nodes[index].first = begin;
+		nodes[index].count = n;
+		nodes[index].axis = 0;
+		return index;
+	}
+};
+
+#endif // BVH_H
@@ -19,6 +19,8 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 #define CAMERA_H
 
 #include <limits>
+#include <algorithm>
+#include <type_traits>
 #include <iostream>
 #include "geometry.h"
 #include "hdr-image.h"
@@ -68,10 +70,17 @@ struct Ray {
 	}
 };
 
-Ray operator*(Transformation tr, Ray ray) {
+Ray operator*(const Transformation &tr, Ray ray) {
 	return Ray(tr * ray.origin, tr * ray.dir, ray.depth, ray.tmin, ray.tmax);
 }
 
+/**
+ * @brief Transform the ray with the inverse of tr. It is the same as tr.inverse() * ray, without building the inverse Transformation.
+ */
+Ray applyInverse(const Transformation &tr, Ray ray) {
+	return Ray(tr.applyInverse(ray.origin), tr.applyInverse(ray.dir), ray.depth, ray.tmin, ray.tmax);
+}
+
 /** Camera class
  * 
  * @brief This is the class regarding the observer looking at the scene.
@@ -156,18 +165,21 @@ struct PerspectiveCamera : Camera {
  * @brief Tracer of the scene. 
  * Given the image and the camera it fires rays through each pixel.
  * If `samplesPerSide` is given (not zero) stratified sampling is applied.
+ * The image is rendered in square tiles of `tileSize` pixels per side, which are distributed dynamically among the threads.
+ * Each pixel draws its random numbers from its own stream, derived from `pcg`, so the result does not depend on the number of threads.
  */
 struct ImageTracer {
 	HdrImage &image;
 	Camera &camera;
 	int samplesPerSide;
+	int tileSize;
 	PCG pcg{};
 
 	ImageTracer(HdrImage &image, Camera &camera): 
-		image{image}, camera{camera}, samplesPerSide{} {}
+		image{image}, camera{camera}, samplesPerSide{}, tileSize{32} {}
 
-	ImageTracer(HdrImage &image, Camera &camera, int samples): 
-		image{image}, camera{camera}, samplesPerSide{samples} {}
+	ImageTracer(HdrImage &image, Camera &camera, int samples, int tileSize = 32, PCG pcg = PCG{}): 
+		image{image}, camera{camera}, samplesPerSide{samples}, tileSize{tileSize}, pcg{pcg} {}
 
 	/**
 	 * @brief Return a Ray starting from the observer and passing through the screen at (col, row)
@@ -184,6 +196,39 @@ struct ImageTracer {
 		return camera.fireRay(u, v);
 	}
 
+	/**
+	 * @brief Compute the color of the pixel at (col, row), summing over all the antialiasing samples.
+	 * If the color function accepts a PCG as second argument, it is given the random stream of the pixel.
+	 *
+	 * @tparam T	The signature of the color function
+	 * @param colorFunc The function to compute a Color given a Ray
+	 * @param col The column of the pixel
+	 * @param row The row of the pixel
+	 * @return Color
+	 */
+	template <typename T> Color renderPixel(T &colorFunc, int col, int row) {
+		PCG pixelPcg{pcg.split((uint64_t) row * image.width + col)};
+		auto color = [&](Ray ray) {
+			if constexpr (std::is_invocable_v<T&, Ray, PCG&>)
+				return colorFunc(ray, pixelPcg);
+			else
+				return colorFunc(ray);
+		};
+
+		if (samplesPerSide <= 0)
+			return color(fireRay(col, row));
+
+		Color cumColor{0.f, 0.f, 0.f};
+		for (int rowPixel = 0; rowPixel < samplesPerSide; rowPixel++) {
+			for (int colPixel = 0; colPixel < samplesPerSide; colPixel++) {
+				float uPixel = (colPixel+pixelPcg.randFloat())/samplesPerSide;
+				float vPixel = (rowPixel+pixelPcg.randFloat())/samplesPerSide;
+				cumColor += color(fireRay(col, row, uPixel, vPixel));
+			}
+		}
+		return cumColor;
+	}
+
 	/**
 	 * @brief Write the scene to the image, calculating the color for each pixel using the color function
 	 *
@@ -191,28 +236,24 @@ struct ImageTracer {
 	 * @param color The function to compute a Color given a Ray
 	 */
 	template <typename T> void fireAllRays(T colorFunc, bool showProgress = true) {
-		for (int row = 0; row < image.height; row++) {
-			if (showProgress){
-				std::cerr << "\rRendering: " << 100*row/(image.height) << "% " << std::flush;
-			}
-			for (int col = 0; col < image.width; col++) {
-				Color cumColor{0.f, 0.f, 0.f};
-				if (samplesPerSide > 0) {
-					#pragma omp parallel for collapse(2)
-					for (int rowPixel = 0; rowPixel<samplesPerSide; rowPixel++) {
-						for (int colPixel = 0; colPixel<samplesPerSide; colPixel++) {
-							float uPixel = (colPixel+pcg.randFloat())/samplesPerSide;
-							float vPixel = (rowPixel+pcg.randFloat())/samplesPerSide;
-							Ray ray = fireRay(col, row, uPixel, vPixel);
-							cumColor += colorFunc(ray);
-						}
-					}
-					image.setPixel(col, row, cumColor);
-				} else {
-					Ray ray = fireRay(col, row);
-					Color color = colorFunc(ray);
-					image.setPixel(col, row, color);
-				}
+		int size = tileSize > 0 ? tileSize : 1;
+		int nTilesX = (image.width + size - 1) / size;
+		int nTilesY = (image.height + size - 1) / size;
+		int nTiles = nTilesX * nTilesY;
+		int tilesDone = 0;
+
+		// Tiles have very different costs, so they are handed out one at a time to the first idle thread
+		#pragma omp parallel for schedule(dynamic, 1)
+		for (int tile = 0; tile < nTiles; tile++) {
+			int col0 = (tile % nTilesX) * size, row0 = (tile / nTilesX) * size;
+			int col1 = std::min(col0 + size, image.width), row1 = std::min(row0 + size, image.height);
+			for (int row = row0; row < row1; row++)
+				for (int col = col0; col < col1; col++)
+					image.setPixel(col, row, renderPixel(colorFunc, col, row));
+
+			if (showProgress) {
+				#pragma omp critical(progress)
+				std::cerr << "\rRendering: " << 100*(++tilesDone)/nTiles << "% " << std::flush;
 			}
 		}
 		if (showProgress)
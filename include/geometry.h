@@ -83,7 +83,7 @@ struct Vec {
 		return !(*this == other);
 	}
 
-	Vec operator+(const Vec &other) {
+	Vec operator+(const Vec &other) const {
 		return _sum<Vec, Vec, Vec>(*this, other);
 	}
 
@@ -91,22 +91,15 @@ struct Vec {
 		return Vec{-x, -y, -z};
 	}
 
-	Vec operator-(const Vec &other) {
+	Vec operator-(const Vec &other) const {
 		return _sum<Vec, Vec, Vec>(*this, -other);
 	}
 
-	Vec operator*(const float c) {
+	Vec operator*(const float c) const {
 		return scalarMultiplication<Vec>(*this, c);
 	}
 
-	Vec operator=(const Vec &other) {
-		x = other.x;
-		y = other.y;
-		z = other.z;
-		return *this;
-	}
-
-	float operator[](const size_t i) {
+	float operator[](const size_t i) const {
 		switch (i) {
 		case 0:
 			return x;
@@ -123,7 +116,7 @@ struct Vec {
 		return x*other.x + y*other.y + z*other.z;
 	}
 
-	Vec cross(const Vec &other) {
+	Vec cross(const Vec &other) const {
 		return Vec{y*other.z - z*other.y, z*other.x - x*other.z, x*other.y - y*other.x};
 	}
 
@@ -157,12 +150,13 @@ struct Point {
 	Point(float x = 0.f, float y = 0.f, float z = 0.f) : x{x}, y{y}, z{z} {}
 	Point(const Point &) = default;
 	Point(Point &&) = default;
+	Point &operator=(const Point &) = default;
 
 	Point operator*(const float c) {
 		return scalarMultiplication<Point>(*this, c);
 	}
 
-	Point operator+(const Point &other) {
+	Point operator+(const Point &other) const {
 		return _sum<Point, Point, Point>(*this, other);
 	}
 
@@ -170,17 +164,10 @@ struct Point {
 		return Point{-x, -y, -z};
 	}
 
-	Vec operator-(const Point &other) {
+	Vec operator-(const Point &other) const {
 		return _sum<Point, Point, Vec>(*this, -other);
 	}
 
-	Point operator=(const Point &other) {
-		x = other.x;
-		y = other.y;
-		z = other.z;
-		return *this;
-	}
-
 	// Compare Points with a default precision.
 	// For a different precision, call areClose<Point> directly.
 	bool operator==(const Point &other) {
@@ -199,7 +186,7 @@ struct Point {
 		return ss.str();
 	}
 
-	float operator[](const size_t i) {
+	float operator[](const size_t i) const {
 		switch (i) {
 		case 0:
 			return x;
@@ -244,13 +231,6 @@ struct Normal {
 		return Normal{-x, -y, -z};
 	}
 
-	Normal operator=(const Normal &other) {
-		x = other.x;
-		y = other.y;
-		z = other.z;
-		return *this;
-	}
-
 	Vec toVec() {
 		return Vec{x, y, z};
 	}
@@ -262,7 +242,7 @@ struct Normal {
 		return ss.str();
 	}
 
-	float operator[](const size_t i) {
+	float operator[](const size_t i) const {
 		switch (i) {
 		case 0:
 			return x;
@@ -276,6 +256,31 @@ struct Normal {
 	}
 };
 
+/**
+ * @brief 	The kind of a Transformation, used to apply it with the cheapest valid computation.
+ * @details IDENTITY, TRANSLATION and SCALING are set by the corresponding functions,
+ * 			LINEAR by rotationX/Y/Z (it is any 3x3 linear map, without translation),
+ * 			AFFINE by the composition of different kinds, GENERAL by explicit matrices.
+ */
+enum class TransformationKind { IDENTITY, TRANSLATION, SCALING, LINEAR, AFFINE, GENERAL };
+
+/**
+ * @brief Return the kind of the composition of two transformations of the given kinds.
+ */
+TransformationKind composeKinds(TransformationKind a, TransformationKind b) {
+	using K = TransformationKind;
+	if (a == K::IDENTITY)
+		return b;
+	if (b == K::IDENTITY or a == b)
+		return a;
+	if (a == K::GENERAL or b == K::GENERAL)
+		return K::GENERAL;
+	// Compositions of scalings and rotations do not translate points
+	if ((a == K::SCALING or a == K::LINEAR) and (b == K::SCALING or b == K::LINEAR))
+		return K::LINEAR;
+	return K::AFFINE;
+}
+
 struct Transformation {
 	// The transformation matrix, defaulting to the identity
 	float m[4][4] = {{1.f, 0.f, 0.f, 0.f},
@@ -287,9 +292,11 @@ struct Transformation {
 			{0.f, 1.f, 0.f, 0.f},
 			{0.f, 0.f, 1.f, 0.f},
 			{0.f, 0.f, 0.f, 1.f}};
+	// What kind of transformation m is
+	TransformationKind kind = TransformationKind::IDENTITY;
 
 	// Create a generic transformation overwriting m and mInv
-	Transformation(float m[4][4], float mInv[4][4]) {
+	Transformation(float m[4][4], float mInv[4][4], TransformationKind kind = TransformationKind::GENERAL) : kind{kind} {
 		for (int i{}; i < 4; i++) {
 			for (int j{}; j < 4; j++) {
 				this->m[i][j] = m[i][j];
@@ -304,6 +311,7 @@ struct Transformation {
 			m[i][i] = diag[i];
 			mInv[i][i] = diagInv[i];
 		}
+		kind = diag[3] == 1.f and diagInv[3] == 1.f ? TransformationKind::SCALING : TransformationKind::GENERAL;
 	}
 
 	// Create the identity transformation
@@ -320,7 +328,7 @@ struct Transformation {
 				}
 			}
 		}
-		return Transformation{m, mInv};
+		return Transformation{m, mInv, composeKinds(kind, t.kind)};
 	}
 
 	Transformation operator*=(Transformation t) {
@@ -337,41 +345,32 @@ struct Transformation {
 
 
 	// Transformation of points
-	Point operator*(Point p) {
-		float x = m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3];
-		float y = m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3];
-		float z = m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3];
-		float w = m[3][0] * p.x + m[3][1] * p.y + m[3][2] * p.z + m[3][3];
-
-		if (w != 1) {
-			x /= w;
-			y /= w;
-			z /= w;
-		}
-
-		return Point{x, y, z};
+	Point operator*(Point p) const {
+		return transformPoint(m, p);
 	}
 
 	// Transformation of vectors
-	Vec operator*(Vec p) {
-		float x = m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z;
-		float y = m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z;
-		float z = m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z;
-
-		return Vec{x, y, z};
+	Vec operator*(Vec v) const {
+		return transformVec(m, v);
 	}
 
 	// Transformation of normals (using mInv transposed)
-	Normal operator*(Normal n) {
-		float x = mInv[0][0] * n.x + mInv[1][0] * n.y + mInv[2][0] * n.z;
-		float y = mInv[0][1] * n.x + mInv[1][1] * n.y + mInv[2][1] * n.z;
-		float z = mInv[0][2] * n.x + mInv[1][2] * n.y + mInv[2][2] * n.z;
+	Normal operator*(Normal n) const {
+		return transformNormal(mInv, n);
+	}
+
+	// Inverse transformation of points, using mInv directly: same as inverse() * p, without building a Transformation
+	Point applyInverse(Point p) const {
+		return transformPoint(mInv, p);
+	}
 
-		return Normal{x, y, z};
+	// Inverse transformation of vectors, same as inverse() * v
+	Vec applyInverse(Vec v) const {
+		return transformVec(mInv, v);
 	}
 
 	// Inverse transformation
-	Transformation inverse() {
+	Transformation inverse() const {
 		float m[4][4];
 		float mInv[4][4];
 
@@ -381,7 +380,7 @@ struct Transformation {
 				mInv[i][j] = this->m[i][j];
 			}
 		}
-		return Transformation{m, mInv};
+		return Transformation{m, mInv, kind};
 	}
 
 	// Compare Transformations with a default precision.
@@ -398,6 +397,76 @@ struct Transformation {
 	bool operator!=(const Transformation &other) {
 		return !(*this == other);
 	}
+
+private:
+	// Apply the matrix a (m or mInv) to a point, skipping the products that are known to be trivial for this kind
+	Point transformPoint(const float a[4][4], Point p) const {
+		switch (kind) {
+		case TransformationKind::IDENTITY:
+			return p;
+		case TransformationKind::TRANSLATION:
+			return Point{p.x + a[0][3], p.y + a[1][3], p.z + a[2][3]};
+		case TransformationKind::SCALING:
+			return Point{a[0][0] * p.x, a[1][1] * p.y, a[2][2] * p.z};
+		case TransformationKind::LINEAR:
+			return Point{
+				a[0][0] * p.x + a[0][1] * p.y + a[0][2] * p.z,
+				a[1][0] * p.x + a[1][1] * p.y + a[1][2] * p.z,
+				a[2][0] * p.x + a[2][1] * p.y + a[2][2] * p.z};
+		case TransformationKind::AFFINE:
+			return Point{
+				a[0][0] * p.x + a[0][1] * p.y + a[0][2] * p.z + a[0][3],
+				a[1][0] * p.x + a[1][1] * p.y + a[1][2] * p.z + a[1][3],
+				a[2][0] * p.x + a[2][1] * p.y + a[2][2] * p.z + a[2][3]};
+		default:
+			break;
+		}
+
+		float x = a[0][0] * p.x + a[0][1] * p.y + a[0][2] * p.z + a[0][3];
+		float y = a[1][0] * p.x + a[1][1] * p.y + a[1][2] * p.z + a[1][3];
+		float z = a[2][0] * p.x + a[2][1] * p.y + a[2][2] * p.z + a[2][3];
+		float w = a[3][0] * p.x + a[3][1] * p.y + a[3][2] * p.z + a[3][3];
+
+		if (w != 1) {
+			x /= w;
+			y /= w;
+			z /= w;
+		}
+
+		return Point{x, y, z};
+	}
+
+	// Apply the matrix a (m or mInv) to a vector
+	Vec transformVec(const float a[4][4], Vec v) const {
+		switch (kind) {
+		case TransformationKind::IDENTITY:
+		case TransformationKind::TRANSLATION:
+			return v;
+		case TransformationKind::SCALING:
+			return Vec{a[0][0] * v.x, a[1][1] * v.y, a[2][2] * v.z};
+		default:
+			return Vec{
+				a[0][0] * v.x + a[0][1] * v.y + a[0][2] * v.z,
+				a[1][0] * v.x + a[1][1] * v.y + a[1][2] * v.z,
+				a[2][0] * v.x + a[2][1] * v.y + a[2][2] * v.z};
+		}
+	}
+
+	// Apply the transpose of the matrix a (mInv) to a normal
+	Normal transformNormal(const float a[4][4], Normal n) const {
+		switch (kind) {
+		case TransformationKind::IDENTITY:
+		case TransformationKind::TRANSLATION:
+			return n;
+		case TransformationKind::SCALING:
+			return Normal{a[0][0] * n.x, a[1][1] * n.y, a[2][2] * n.z};
+		default:
+			return Normal{
+				a[0][0] * n.x + a[1][0] * n.y + a[2][0] * n.z,
+				a[0][1] * n.x + a[1][1] * n.y + a[2][1] * n.z,
+				a[0][2] * n.x + a[1][2] * n.y + a[2][2] * n.z};
+		}
+	}
 };
 
 // Function that construct a translation Transformation given a Vec
@@ -410,7 +479,7 @@ Transformation translation(const Vec v) {
 						{0.f, 1.f, 0.f, -v.y},
 						{0.f, 0.f, 1.f, -v.z},
 						{0.f, 0.f, 0.f, 1.f}};
-	return Transformation{m, mInv};
+	return Transformation{m, mInv, TransformationKind::TRANSLATION};
 }
 
 /**
@@ -452,7 +521,7 @@ Transformation rotationX(const float theta) {
 						{0.f, cos, sin, 0.f}, 
 						{0.f, -sin, cos, 0.f},
 						{0.f, 0.f, 0.f, 1.f}};
-	return Transformation{m, mInv};
+	return Transformation{m, mInv, TransformationKind::LINEAR};
 }
 
 /**
@@ -470,7 +539,7 @@ Transformation rotationY(const float theta) {
 						{0.f, 1.f, 0.f, 0.f}, 
 						{sin, 0.f, cos, 0.f},
 						{0.f, 0.f, 0.f, 1.f}};
-	return Transformation{m, mInv};
+	return Transformation{m, mInv, TransformationKind::LINEAR};
 }
 
 /**
@@ -488,7 +557,7 @@ Transformation rotationZ(const float theta) {
 						{-sin, cos, 0.f, 0.f},
 						{0.f, 0.f, 1.f, 0.f},
 						{0.f, 0.f, 0.f, 1.f}};
-	return Transformation{m, mInv};
+	return Transformation{m, mInv, TransformationKind::LINEAR};
 }
 
 struct Vec2D {
@@ -496,12 +565,6 @@ struct Vec2D {
 	Vec2D() {}
 	Vec2D(float u, float v): u{u}, v{v} {}
 
-	Vec2D operator=(const Vec2D &other) {
-		u = other.u;
-		v = other.v;
-		return *this;
-	}
-
 	bool operator==(const Vec2D &other) const {
 		const float epsilon = 1e-5;
 		return (std::abs(u - other.u) < epsilon and std::abs(v - other.v) < epsilon);
@@ -23,15 +23,44 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 #include <vector>
 #include <string>
 #include <cmath>
+#include <algorithm>
 #include <gd.h>
 #undef NDEBUG
 #include <cassert>
 #include "color.h"
+#include "mapped-file.h"
 
 enum class Endianness { littleEndian, bigEndian };
 
 float clamp(const float x);
 
+// Conversion of color components to 8 bits with gamma correction, using a lookup table instead of pow.
+// A component c in [0, 1] is converted to the integer part of 255 * c^(1/gamma); smaller or NaN components
+// are converted to 0, and larger ones to 255. The gamma factor must be positive.
+struct GammaTable {
+	GammaTable(float gamma);
+
+	int operator()(const float c) const {
+		if (!(c > 0.f))
+			return 0;
+		if (c >= thresholds[255])
+			return 255;
+		// Start from the level of the lower end of the bucket containing c, which is computed exactly.
+		// Here c < thresholds[255] <= 1, but the compiler cannot tell the bucket is in range
+		int level = bucketLevels[std::min((int) (c * nBuckets), nBuckets - 1)];
+		while (c >= thresholds[level + 1])
+			level++;
+		return level;
+	}
+
+private:
+	static constexpr int nBuckets = 1024;
+	// thresholds[k] is the smallest component converted to k or more
+	float thresholds[256];
+	// bucketLevels[i] is the level of i / nBuckets
+	unsigned char bucketLevels[nBuckets];
+};
+
 struct HdrImage {
 	int width, height;
 	std::vector<Color> pixels;
@@ -57,9 +86,18 @@ struct HdrImage {
 		return x >= 0 and x < width and y >= 0 and y < height;
 	}
 
-	// Evaluate index for pixels[]
+	// Evaluate index for pixels[]: pixels are stored row by row, starting from the top-left corner
 	int pixelOffset(const int x, const int y) {
-		return x*height + y;
+		return y*width + x;
+	}
+
+	// Get the row at height y, whose width pixels are contiguous in memory
+	Color *row(const int y) {
+		return pixels.data() + (size_t) y*width;
+	}
+
+	const Color *row(const int y) const {
+		return pixels.data() + (size_t) y*width;
 	}
 
 	// Gets color of the pixel in (x, y)
@@ -74,13 +112,8 @@ struct HdrImage {
 		pixels[pixelOffset(x, y)] = c;
 	}
 
-	// Evalutate average luminosity with log-average
-	float averageLuminosity(float delta=1e-10) {
-		float s = 0.0;
-		for (auto it = pixels.begin(); it != pixels.end(); ++it)
-			s += std::log10(delta + it->luminosity());
-		return pow(10, s / pixels.size());
-	}
+	// Evalutate average luminosity with log-average; the logarithms are summed in double precision
+	float averageLuminosity(float delta=1e-10);
 
 	HdrImage operator+(HdrImage &other) {
 		assert(other.height == height);
@@ -125,23 +158,19 @@ struct HdrImage {
 		return *this;
 	}
 
-	// write&read pfm file image
+	// write&read pfm file image, one scanline at a time
 	void writePfm(std::ostream &stream, Endianness endianness=Endianness::littleEndian);
 	void readPfm(std::istream &stream);
+	// Read the pfm image from the content of a file
+	void readPfm(const char *data, size_t size);
+	// Read the pfm file mapping it in memory
 	void readPfm(std::string fileName) {
-		std::ifstream stream;
-		stream.open(fileName);
-		if (!stream.is_open())
-			throw std::runtime_error(fileName + ": no such file or directory");
-		readPfm(stream);
+		MappedFile file{fileName};
+		readPfm(file.data, file.size);
 	}
 
 	// Normalization of pixels given a factor and (optional) luminosity
-	void normalizeImage(const float factor, const float luminosity) {
-		for (auto it = pixels.begin(); it != pixels.end(); ++it){
-			(*it) = (*it)*(factor/luminosity);
-		}
-	}
+	void normalizeImage(const float factor, const float luminosity);
 
 	void normalizeImage(const float factor){
 		float luminosity = averageLuminosity();
@@ -149,13 +178,7 @@ struct HdrImage {
 	}
 
 	// Apply clump function to color components
-	void clampImage(){
-		for (auto it = pixels.begin(); it != pixels.end(); ++it){
-			it->r = clamp(it->r);
-			it->g = clamp(it->g);
-			it->b = clamp(it->b);
-		}
-	}
+	void clampImage();
 
 	// Write png image file
 	void writePng(const char filename[], int compression, bool palette, float gamma);
@@ -181,4 +204,20 @@ class InvalidPfmFileFormat : public std::runtime_error {
 void parseImageSize(std::string line, int &width, int &height);
 Endianness parseEndianness(std::string line);
 
+// A pfm file whose header is read when it is constructed, and whose rows are read only when they are needed.
+// The file is opened again at each read, so that many of them can be kept at once.
+struct PfmReader {
+	std::string fileName;
+	int width, height;
+
+	PfmReader(const std::string &fileName);
+
+	// Read the rows from y to y + n - 1 into colors, stored row by row as in HdrImage
+	void readRows(const int y, const int n, Color *colors) const;
+
+private:
+	Endianness endianness;
+	std::streamoff dataOffset;
+};
+
 #endif // HDR_IMAGE_H
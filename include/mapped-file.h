@@ -0,0 +1,77 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief 	A read-only view of a whole file, mapped in memory.
+ * @details The file is unmapped when the object is destroyed, so the object cannot be copied.
+ *
+ * @param data	The content of the file (not null-terminated).
+ * @param size	The size of the file in bytes.
+ */
+struct MappedFile {
+	const char *data = nullptr;
+	size_t size = 0;
+
+	MappedFile(const std::string &fileName) {
+		int fd = open(fileName.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error(fileName + ": no such file or directory");
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			close(fd);
+			throw std::runtime_error(fileName + ": cannot read file");
+		}
+		size = st.st_size;
+		// Empty files cannot be mapped
+		if (size > 0) {
+			void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (addr == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error(fileName + ": cannot map file in memory");
+			}
+			data = static_cast<const char *>(addr);
+			// Tell the kernel that the file will be read from the beginning to the end
+			madvise(addr, size, MADV_SEQUENTIAL);
+		}
+		close(fd);
+	}
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	~MappedFile() {
+		if (data != nullptr)
+			munmap((void *) data, size);
+	}
+
+	std::string_view view() const {
+		return std::string_view{data, size};
+	}
+};
+
+#endif // MAPPED_FILE_H
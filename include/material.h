@@ -20,6 +20,9 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 
 #include <memory>
 #include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
 #include "geometry.h"
 #include "hdr-image.h"
 #include "random.h"
@@ -27,12 +30,17 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 
 /**
  * @brief Abstract struct for pigments.
+ * @details Uniform pigments are tagged with their kind, so that at() can read them without a virtual call.
  * 
  * @see UniformPigment
  * @see CheckeredPigment
  * @see ImagePigment
  */
 struct Pigment {
+	enum class Kind {UNIFORM, OTHER};
+	Kind kind;
+
+	Pigment(Kind kind = Kind::OTHER) : kind{kind} {}
 
 	/**
 	 * @brief Overloading operator(). It let you get the color in a given surface coordinates (u, v).
@@ -41,6 +49,16 @@ struct Pigment {
 	 * @return Color 
 	 */
 	virtual Color operator()(Vec2D coords) = 0;
+
+	/**
+	 * @brief Return the same color as operator(), reading it directly for a UniformPigment.
+	 * @details The other pigments go through the virtual call: a switch over all the kinds is not faster,
+	 * 			see benchmark/shading.cpp.
+	 * 
+	 * @param coords 
+	 * @return Color 
+	 */
+	Color at(Vec2D coords);
 };
 
 /**
@@ -50,11 +68,11 @@ struct Pigment {
  * @see CheckeredPigment
  * @see ImagePigment
  */
-struct UniformPigment : public Pigment {
+struct UniformPigment final : public Pigment {
 	Color color{};
 
-	UniformPigment() : Pigment() {}
-	UniformPigment(Color color) : Pigment(), color{color} {}
+	UniformPigment() : Pigment(Kind::UNIFORM) {}
+	UniformPigment(Color color) : Pigment(Kind::UNIFORM), color{color} {}
 
 	/**
 	 * @brief Overloading operator(). It let you get the color in a given surface coordinates (u, v).
@@ -125,12 +143,22 @@ struct ImagePigment : public Pigment {
 	}
 };
 
+Color Pigment::at(Vec2D coords) {
+	if (kind == Kind::UNIFORM)
+		return static_cast<UniformPigment *>(this)->color;
+	return (*this)(coords);
+}
+
 /**
  * @brief Abstract class for a generic BxDF.
+ * @details The built-in BxDFs are tagged with their kind, and dispatchEval and dispatchScatterRay
+ * 			call them without a virtual call. BxDFs defined elsewhere keep the kind OTHER.
  * 
  */
 struct BRDF {
+	enum class Kind {DIFFUSE, SPECULAR, DIELECTRIC, OTHER};
 	std::shared_ptr<Pigment> pigment;
+	Kind kind = Kind::OTHER;
 	BRDF(): BRDF{UniformPigment{}} {}
 	template <class T> BRDF(const T &pigment): pigment{std::make_shared<T>(pigment)} {}
 	BRDF(const std::shared_ptr<Pigment> pigment): pigment{pigment} {}
@@ -138,6 +166,16 @@ struct BRDF {
 	virtual Color eval(Normal normal, Vec in, Vec out, Vec2D uv) = 0;
 	virtual Ray scatterRay(PCG &pcg, Vec incomingDir, Point interactionPoint, Normal normal, int depth, bool inward) = 0;
 
+	/**
+	 * @brief Same as eval, switching on the kind of BxDF instead of using a virtual call.
+	 */
+	Color dispatchEval(Normal normal, Vec in, Vec out, Vec2D uv);
+
+	/**
+	 * @brief Same as scatterRay, switching on the kind of BxDF instead of using a virtual call.
+	 */
+	Ray dispatchScatterRay(PCG &pcg, Vec incomingDir, Point interactionPoint, Normal normal, int depth, bool inward);
+
 	/**
 	 * @brief Returns a scattered direction.
 	 * 
@@ -180,17 +218,17 @@ struct BRDF {
 
 };
 
-struct DiffusiveBRDF : BRDF {
+struct DiffusiveBRDF final : BRDF {
 	float reflectance;
 	DiffusiveBRDF(float reflectance = 1.f):
-		reflectance{reflectance}, BRDF() {};
+		reflectance{reflectance}, BRDF() { kind = Kind::DIFFUSE; };
 	template <class T> DiffusiveBRDF(const T &pigment):
-		reflectance{1.f}, BRDF(pigment) {};
+		reflectance{1.f}, BRDF(pigment) { kind = Kind::DIFFUSE; };
 	template <class T> DiffusiveBRDF(float reflectance, const T &pigment):
-		reflectance{reflectance}, BRDF(pigment) {};
+		reflectance{reflectance}, BRDF(pigment) { kind = Kind::DIFFUSE; };
 	
 	virtual Color eval(Normal normal, Vec in, Vec out, Vec2D uv) override {
-		return (*pigment)(uv) * (reflectance / M_PI);
+		return pigment->at(uv) * (reflectance / M_PI);
 	}
 
 	virtual Ray scatterRay(PCG &pcg, Vec incomingDir, Point interactionPoint, Normal normal, int depth, bool inward = true) override {
@@ -201,21 +239,21 @@ struct DiffusiveBRDF : BRDF {
 	}
 };
 
-struct SpecularBRDF : BRDF {
+struct SpecularBRDF final : BRDF {
 	float thresholdAngle = M_PI/1800.f;
 	float roughness = 0.f;
 	SpecularBRDF(float roughness, float thresholdAngle):
-		thresholdAngle{thresholdAngle}, roughness{roughness}, BRDF() {};
+		thresholdAngle{thresholdAngle}, roughness{roughness}, BRDF() { kind = Kind::SPECULAR; };
 	template <class T> SpecularBRDF(float roughness, const T &pigment):
-		roughness{roughness}, BRDF(pigment) {};
+		roughness{roughness}, BRDF(pigment) { kind = Kind::SPECULAR; };
 	template <class T> SpecularBRDF(float roughness, float thresholdAngle, const T &pigment):
-		thresholdAngle{thresholdAngle}, roughness{roughness}, BRDF(pigment) {};
+		thresholdAngle{thresholdAngle}, roughness{roughness}, BRDF(pigment) { kind = Kind::SPECULAR; };
 
 	virtual Color eval(Normal normal, Vec in, Vec out, Vec2D uv) override {
 		float thetaIn = acos(normal.toVec().dot(in));
 		float thetaOut = acos(normal.toVec().dot(out));
 		if (abs(thetaIn - thetaOut) < thresholdAngle)
-			return (*pigment)(uv);
+			return pigment->at(uv);
 		else
 			return BLACK;
 	}
@@ -225,17 +263,17 @@ struct SpecularBRDF : BRDF {
 	}
 };
 
-struct DielectricBSDF : BRDF {
+struct DielectricBSDF final : BRDF {
 	float refractionIndex;
 	float roughness = 0.f;
-	DielectricBSDF() : BRDF(UniformPigment{WHITE}), refractionIndex{1.f} {}
-	DielectricBSDF(float ri, float roughness) : BRDF(UniformPigment{WHITE}), refractionIndex{ri}, roughness{roughness} {}
-	template<class T> DielectricBSDF(float ri, float roughness, const T &pigment) : BRDF(pigment), refractionIndex{ri}, roughness{roughness} {}
-	template<class T> DielectricBSDF(float ri, const T &pigment) : BRDF(pigment), refractionIndex{ri}, roughness{0} {}
-	template<class T> DielectricBSDF(const T &pigment) : BRDF(pigment), refractionIndex{1.f}, roughness{0} {}
+	DielectricBSDF() : BRDF(UniformPigment{WHITE}), refractionIndex{1.f} { kind = Kind::DIELECTRIC; }
+	DielectricBSDF(float ri, float roughness) : BRDF(UniformPigment{WHITE}), refractionIndex{ri}, roughness{roughness} { kind = Kind::DIELECTRIC; }
+	template<class T> DielectricBSDF(float ri, float roughness, const T &pigment) : BRDF(pigment), refractionIndex{ri}, roughness{roughness} { kind = Kind::DIELECTRIC; }
+	template<class T> DielectricBSDF(float ri, const T &pigment) : BRDF(pigment), refractionIndex{ri}, roughness{0} { kind = Kind::DIELECTRIC; }
+	template<class T> DielectricBSDF(const T &pigment) : BRDF(pigment), refractionIndex{1.f}, roughness{0} { kind = Kind::DIELECTRIC; }
 
 	virtual Color eval(Normal normal, Vec in, Vec out, Vec2D uv) override {
-		return (*pigment)(uv) * (1.f / M_PI);
+		return pigment->at(uv) * (1.f / M_PI);
 	}
 
 
@@ -271,6 +309,33 @@ struct DielectricBSDF : BRDF {
 	}
 };
 
+// The built-in BxDFs are final, so the calls below are not virtual
+Color BRDF::dispatchEval(Normal normal, Vec in, Vec out, Vec2D uv) {
+	switch (kind) {
+	case Kind::DIFFUSE:
+		return static_cast<DiffusiveBRDF *>(this)->eval(normal, in, out, uv);
+	case Kind::SPECULAR:
+		return static_cast<SpecularBRDF *>(this)->eval(normal, in, out, uv);
+	case Kind::DIELECTRIC:
+		return static_cast<DielectricBSDF *>(this)->eval(normal, in, out, uv);
+	default:
+		return eval(normal, in, out, uv);
+	}
+}
+
+Ray BRDF::dispatchScatterRay(PCG &pcg, Vec incomingDir, Point interactionPoint, Normal normal, int depth, bool inward) {
+	switch (kind) {
+	case Kind::DIFFUSE:
+		return static_cast<DiffusiveBRDF *>(this)->scatterRay(pcg, incomingDir, interactionPoint, normal, depth, inward);
+	case Kind::SPECULAR:
+		return static_cast<SpecularBRDF *>(this)->scatterRay(pcg, incomingDir, interactionPoint, normal, depth, inward);
+	case Kind::DIELECTRIC:
+		return static_cast<DielectricBSDF *>(this)->scatterRay(pcg, incomingDir, interactionPoint, normal, depth, inward);
+	default:
+		return scatterRay(pcg, incomingDir, interactionPoint, normal, depth, inward);
+	}
+}
+
 struct Material {
 	std::shared_ptr<BRDF> brdf;
 	std::shared_ptr<Pigment> emittedRadiance;
@@ -280,6 +345,50 @@ struct Material {
 	//template <class P> Material(const P &emittedRadiance) : Material{DiffusiveBRDF{}, emittedRadiance} {} // Cannot have both Material(brdf) and Material(emittedRadiance) using templates
 	template <class B, class P> Material(const B &brdf, const P &emittedRadiance) : brdf{std::make_shared<B>(brdf)}, emittedRadiance{std::make_shared<P>(emittedRadiance)} {}
 	Material(std::shared_ptr<BRDF> brdf, std::shared_ptr<Pigment> emittedRadiance) : brdf{brdf}, emittedRadiance{emittedRadiance} {}
+
+	/**
+	 * @brief Return false only if the material surely does not emit light, i.e. its emitted radiance is uniformly black.
+	 */
+	bool isEmissive() const {
+		if (emittedRadiance->kind != Pigment::Kind::UNIFORM)
+			return true;
+		Color color{static_cast<const UniformPigment &>(*emittedRadiance).color};
+		return color.r > 0.f or color.g > 0.f or color.b > 0.f;
+	}
+};
+
+/**
+ * @brief	The materials of a scene, which shapes and hit records refer to by their index.
+ * @details	Each material is stored once: adding a material with the same BRDF and emitted radiance
+ * 			of one already in the table returns the index of the latter.
+ * 			The index -1 refers to the default material, used by the shapes built without one.
+ */
+struct MaterialTable {
+	std::vector<Material> materials;
+	Material defaultMaterial;
+
+	/**
+	 * @brief Add the material to the table, if it is not there yet, and return its index.
+	 */
+	int add(const Material &material) {
+		auto key = std::make_pair(material.brdf.get(), material.emittedRadiance.get());
+		auto found = indices.find(key);
+		if (found != indices.end())
+			return found->second;
+		materials.push_back(material);
+		return indices[key] = std::size(materials) - 1;
+	}
+
+	const Material &operator[](int index) const {
+		return index >= 0 ? materials[index] : defaultMaterial;
+	}
+
+	int size() const {
+		return std::size(materials);
+	}
+
+private:
+	std::map<std::pair<const BRDF *, const Pigment *>, int> indices;
 };
 
 #endif // MATERIAL_H
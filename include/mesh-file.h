@@ -0,0 +1,375 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <climits>
+#include "geometry.h"
+#include "shape.h"
+#include "mapped-file.h"
+
+class InvalidMeshFileFormat : public std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Remove the first whitespace-separated word from the line and return it (empty if there are no more words).
+ */
+static std::string_view nextWord(std::string_view &line) {
+	const char *whitespace = " \t\r";
+	size_t begin = line.find_first_not_of(whitespace);
+	if (begin == std::string_view::npos) {
+		line = std::string_view{};
+		return line;
+	}
+	size_t end = std::min(line.find_first_of(whitespace, begin), line.size());
+	std::string_view word{line.substr(begin, end - begin)};
+	line.remove_prefix(end);
+	return word;
+}
+
+/**
+ * @brief Parse the whole word as a number, returning false if it is not a valid one.
+ */
+template <typename T> static bool parseNumber(std::string_view word, T &value) {
+	if (!word.empty() and word[0] == '+')
+		word.remove_prefix(1);
+	if (word.empty())
+		return false;
+	auto [end, error] = std::from_chars(word.data(), word.data() + word.size(), value);
+	return error == std::errc{} and end == word.data() + word.size();
+}
+
+/**
+ * @brief 	Read a mesh from the content of a Wavefront OBJ file.
+ * @details Only vertex positions ("v") and faces ("f") are read, and polygons are split into triangle fans;
+ * 			texture coordinates, normals, groups and materials are ignored.
+ *
+ * @param text	The content of the file.
+ * @return std::shared_ptr<const MeshData>
+ */
+std::shared_ptr<const MeshData> readObj(std::string_view text) {
+	std::vector<Point> vertices;
+	std::vector<int> indices, polygon;
+	int lineNumber = 0;
+
+	while (!text.empty()) {
+		size_t end = std::min(text.find('\n'), text.size());
+		std::string_view line{text.substr(0, end)};
+		text.remove_prefix(std::min(end + 1, text.size()));
+		lineNumber++;
+		auto error = [&](std::string message) {
+			return InvalidMeshFileFormat{"line " + std::to_string(lineNumber) + ": " + message};
+		};
+
+		std::string_view keyword{nextWord(line)};
+		if (keyword == "v") {
+			float x, y, z;
+			if (!parseNumber(nextWord(line), x) or !parseNumber(nextWord(line), y) or !parseNumber(nextWord(line), z))
+				throw error("invalid vertex");
+			vertices.push_back(Point{x, y, z});
+		} else if (keyword == "f") {
+			polygon.clear();
+			for (std::string_view word{nextWord(line)}; !word.empty(); word = nextWord(line)) {
+				// Only the position index is used from "v", "v/vt", "v//vn" and "v/vt/vn"
+				int index;
+				if (!parseNumber(word.substr(0, word.find('/')), index))
+					throw error("invalid face");
+				// Indices start from 1, negative indices are relative to the last vertex
+				index = index < 0 ? (int) vertices.size() + index : index - 1;
+				if (index < 0 or index >= (int) vertices.size())
+					throw error("vertex index out of range");
+				polygon.push_back(index);
+			}
+			if (polygon.size() < 3)
+				throw error("a face must have at least three vertices");
+			for (size_t i{1}; i + 1 < polygon.size(); i++)
+				indices.insert(indices.end(), {polygon[0], polygon[i], polygon[i + 1]});
+		}
+	}
+	return std::make_shared<const MeshData>(std::move(vertices), std::move(indices));
+}
+
+enum class PlyType { INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64 };
+
+static PlyType parsePlyType(std::string_view name) {
+	if (name == "char" or name == "int8")
+		return PlyType::INT8;
+	if (name == "uchar" or name == "uint8")
+		return PlyType::UINT8;
+	if (name == "short" or name == "int16")
+		return PlyType::INT16;
+	if (name == "ushort" or name == "uint16")
+		return PlyType::UINT16;
+	if (name == "int" or name == "int32")
+		return PlyType::INT32;
+	if (name == "uint" or name == "uint32")
+		return PlyType::UINT32;
+	if (name == "float" or name == "float32")
+		return PlyType::FLOAT32;
+	if (name == "double" or name == "float64")
+		return PlyType::FLOAT64;
+	throw InvalidMeshFileFormat{"unknown PLY type " + std::string{name}};
+}
+
+static bool isPlyInteger(PlyType type) {
+	return type != PlyType::FLOAT32 and type != PlyType::FLOAT64;
+}
+
+/**
+ * @brief Return the size in bytes of a binary value of the given type.
+ */
+static size_t plySize(PlyType type) {
+	static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+	return sizes[(int) type];
+}
+
+/**
+ * @brief Read a binary value of the given type, advancing p.
+ *
+ * @param p			The position of the value, moved past it.
+ * @param end		The end of the file.
+ * @param type		The type of the value.
+ * @param swapBytes	Whether the endianness of the file differs from the one of the machine.
+ * @return double
+ */
+static double readPlyValue(const char *&p, const char *end, PlyType type, bool swapBytes) {
+	size_t size = plySize(type);
+	if ((size_t) (end - p) < size)
+		throw InvalidMeshFileFormat{"unexpected end of file"};
+	char bytes[8];
+	std::memcpy(bytes, p, size);
+	if (swapBytes)
+		std::reverse(bytes, bytes + size);
+	p += size;
+
+	switch (type) {
+	case PlyType::INT8: { int8_t v; std::memcpy(&v, bytes, size); return v; }
+	case PlyType::UINT8: { uint8_t v; std::memcpy(&v, bytes, size); return v; }
+	case PlyType::INT16: { int16_t v; std::memcpy(&v, bytes, size); return v; }
+	case PlyType::UINT16: { uint16_t v; std::memcpy(&v, bytes, size); return v; }
+	case PlyType::INT32: { int32_t v; std::memcpy(&v, bytes, size); return v; }
+	case PlyType::UINT32: { uint32_t v; std::memcpy(&v, bytes, size); return v; }
+	case PlyType::FLOAT32: { float v; std::memcpy(&v, bytes, size); return v; }
+	case PlyType::FLOAT64: { double v; std::memcpy(&v, bytes, size); return v; }
+	}
+	return 0.;
+}
+
+/**
+ * @brief Read a list count or a vertex index, which must be a non-negative int, advancing p.
+ */
+static int readPlyIndex(const char *&p, const char *end, PlyType type, bool swapBytes) {
+	double value = readPlyValue(p, end, type, swapBytes);
+	// Also rejects NaN, before the conversion to int
+	if (!(value >= 0. and value <= INT_MAX) or value != std::trunc(value))
+		throw InvalidMeshFileFormat{"invalid list count or vertex index"};
+	return (int) value;
+}
+
+/**
+ * @brief 	Read a mesh from the content of a binary (little or big endian) PLY file.
+ * @details The x, y, z properties of the "vertex" element and the "vertex_indices" list of the "face" element are read,
+ * 			and polygons are split into triangle fans; any other element or property is skipped.
+ *
+ * @param data	The content of the file.
+ * @return std::shared_ptr<const MeshData>
+ */
+std::shared_ptr<const MeshData> readPly(std::string_view data) {
+	// What each property is used for
+	enum class Role { NONE, X, Y, Z, INDICES };
+	struct Property {
+		Role role = Role::NONE;
+		PlyType type = PlyType::FLOAT32;
+		bool isList = false;
+		PlyType countType = PlyType::UINT8;
+	};
+	struct Element {
+		std::string name;
+		size_t count = 0;
+		std::vector<Property> properties;
+	};
+
+	// Header
+	std::vector<Element> elements;
+	bool isLittleEndian = true, foundFormat = false, foundEnd = false;
+	if (data.substr(0, 3) != "ply")
+		throw InvalidMeshFileFormat{"missing PLY magic number"};
+	while (!data.empty() and !foundEnd) {
+		size_t end = std::min(data.find('\n'), data.size());
+		std::string_view line{data.substr(0, end)};
+		data.remove_prefix(std::min(end + 1, data.size()));
+
+		std::string_view keyword{nextWord(line)};
+		if (keyword == "format") {
+			std::string_view format{nextWord(line)};
+			if (format == "binary_little_endian")
+				isLittleEndian = true;
+			else if (format == "binary_big_endian")
+				isLittleEndian = false;
+			else
+				throw InvalidMeshFileFormat{"unsupported PLY format " + std::string{format} + ", only binary files can be read"};
+			foundFormat = true;
+		} else if (keyword == "element") {
+			Element element;
+			element.name = std::string{nextWord(line)};
+			if (!parseNumber(nextWord(line), element.count))
+				throw InvalidMeshFileFormat{"invalid number of " + element.name + " elements"};
+			elements.push_back(element);
+		} else if (keyword == "property") {
+			if (elements.empty())
+				throw InvalidMeshFileFormat{"property without element"};
+			Element &element{elements.back()};
+			Property property;
+			std::string_view type{nextWord(line)};
+			property.isList = type == "list";
+			if (property.isList) {
+				property.countType = parsePlyType(nextWord(line));
+				if (!isPlyInteger(property.countType))
+					throw InvalidMeshFileFormat{"list counts must be integers"};
+				type = nextWord(line);
+			}
+			property.type = parsePlyType(type);
+			std::string_view name{nextWord(line)};
+			if (element.name == "vertex" and !property.isList) {
+				if (name == "x")
+					property.role = Role::X;
+				else if (name == "y")
+					property.role = Role::Y;
+				else if (name == "z")
+					property.role = Role::Z;
+			} else if (element.name == "face" and property.isList and (name == "vertex_indices" or name == "vertex_index")) {
+				if (!isPlyInteger(property.type))
+					throw InvalidMeshFileFormat{"vertex indices must be integers"};
+				property.role = Role::INDICES;
+			}
+			element.properties.push_back(property);
+		} else if (keyword == "end_header") {
+			foundEnd = true;
+		}
+	}
+	if (!foundFormat or !foundEnd)
+		throw InvalidMeshFileFormat{"invalid PLY header"};
+
+	const uint16_t one = 1;
+	const bool machineIsLittleEndian = *(const uint8_t *) &one == 1;
+	const bool swapBytes = isLittleEndian != machineIsLittleEndian;
+
+	// Body
+	std::vector<Point> vertices;
+	std::vector<int> indices, polygon;
+	const char *p = data.data(), *end = data.data() + data.size();
+	for (auto &element : elements) {
+		const bool isVertex = element.name == "vertex";
+		if (isVertex) {
+			// Each of x, y, z must appear exactly once
+			unsigned found = 0;
+			for (auto &property : element.properties) {
+				if (property.role == Role::NONE)
+					continue;
+				unsigned bit = 1u << ((int) property.role - (int) Role::X);
+				if (found & bit)
+					throw InvalidMeshFileFormat{"duplicate x, y or z property of vertices"};
+				found |= bit;
+			}
+			if (found != 0b111)
+				throw InvalidMeshFileFormat{"vertices must have x, y, z properties"};
+		}
+
+		// Check the number of elements against the smallest size they can take, before allocating memory for them
+		size_t minSize = 0;
+		for (auto &property : element.properties)
+			minSize += plySize(property.isList ? property.countType : property.type);
+		if (minSize == 0)
+			continue;
+		if (element.count > (size_t) (end - p) / minSize)
+			throw InvalidMeshFileFormat{"unexpected end of file"};
+		if (isVertex)
+			vertices.reserve(element.count);
+
+		for (size_t i{}; i < element.count; i++) {
+			float xyz[3];
+			for (auto &property : element.properties) {
+				if (property.isList) {
+					int n = readPlyIndex(p, end, property.countType, swapBytes);
+					if (property.role == Role::INDICES) {
+						polygon.clear();
+						for (int k{}; k < n; k++)
+							polygon.push_back(readPlyIndex(p, end, property.type, swapBytes));
+						if (polygon.size() < 3)
+							throw InvalidMeshFileFormat{"a face must have at least three vertices"};
+						for (size_t k{1}; k + 1 < polygon.size(); k++)
+							indices.insert(indices.end(), {polygon[0], polygon[k], polygon[k + 1]});
+					} else {
+						for (int k{}; k < n; k++)
+							readPlyValue(p, end, property.type, swapBytes);
+					}
+				} else {
+					float value = readPlyValue(p, end, property.type, swapBytes);
+					if (property.role != Role::NONE)
+						xyz[(int) property.role - (int) Role::X] = value;
+				}
+			}
+			if (isVertex)
+				vertices.push_back(Point{xyz[0], xyz[1], xyz[2]});
+		}
+	}
+
+	for (int index : indices)
+		if (index < 0 or index >= (int) vertices.size())
+			throw InvalidMeshFileFormat{"vertex index out of range"};
+	return std::make_shared<const MeshData>(std::move(vertices), std::move(indices));
+}
+
+/**
+ * @brief 	Read a mesh from a Wavefront OBJ or binary PLY file.
+ * @details The file is mapped in memory instead of being read through a stream.
+ * 			PLY files are recognized by their magic number, OBJ files by the ".obj" extension.
+ *
+ * @param fileName	The name of the file.
+ * @return std::shared_ptr<const MeshData>
+ */
+std::shared_ptr<const MeshData> readMeshFile(const std::string &fileName) {
+	MappedFile file{fileName};
+	std::string_view data{file.view()};
+	std::string extension{fileName.substr(std::min(fileName.rfind('.'), fileName.size()))};
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+	try {
+		if (data.substr(0, 3) == "ply" or extension == ".ply")
+			return readPly(data);
+		if (extension == ".obj")
+			return readObj(data);
+	} catch (InvalidMeshFileFormat &e) {
+		throw InvalidMeshFileFormat{fileName + ": " + e.what()};
+	}
+	throw InvalidMeshFileFormat{fileName + ": unknown mesh format, expected an OBJ or PLY file"};
+}
+
+#endif // MESH_FILE_H
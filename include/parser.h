@@ -19,10 +19,13 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 #define PARSER_H
 
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <sstream>
+#include <iterator>
 #include <cctype>
 #include <vector>
+#include <algorithm>
 #include <unordered_map>
 #include <tuple>
 #include <cmath>
@@ -32,9 +35,9 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 #include "material.h"
 #include "camera.h"
 #include "shape.h"
+#include "mesh-file.h"
 
-#define WHITESPACE std::string{" #\t\n\r"}
-#define SYMBOLS std::string{"()<>[],*"}
+#define SYMBOLS std::string_view{"()<>[],*"}
 
 /**
  * @brief   Location of the token.
@@ -65,7 +68,7 @@ struct GrammarError : std::runtime_error {
 enum class Keyword {
 	NEW, MATERIAL, PLANE, SPHERE, TRIANGLE, DIFFUSE, SPECULAR, DIELECTRIC, UNIFORM, CHECKERED,
 	IMAGE, IDENTITY, TRANSLATION, ROTATION_X, ROTATION_Y, ROTATION_Z,
-	SCALING, CAMERA, ORTHOGONAL, PERSPECTIVE, FLOAT, UNION, DIFFERENCE, INTERSECTION, BOX
+	SCALING, CAMERA, ORTHOGONAL, PERSPECTIVE, FLOAT, UNION, DIFFERENCE, INTERSECTION, BOX, MESH
 };
 
 /**
@@ -78,82 +81,40 @@ enum class TokenType {
 /**
  * @brief A union to store the value of a token
  */
+// The strings are views into the text of the scene, so tokens can be copied freely
 union TokenUnion {
 	TokenUnion() {}
-	~TokenUnion() {}
 	Keyword k;
-	std::string s;
+	std::string_view s;
 	float f;
 	char ch;
 };
 
 /**
- * @brief A struct to store tokens
+ * @brief	A token read from the scene.
+ * @details	Only the offset of its first character in the text is stored: the SourceLocation is computed
+ * 			by InputStream::locationOf when an error must be reported.
  */
 struct Token {
-	SourceLocation location;
+	size_t offset;
 	TokenType type;
 	TokenUnion value;
 
-	Token(SourceLocation location = SourceLocation{}) : location{location} {}
-	Token(const Token &other) : location{other.location}, type{other.type} {
-		switch (type) {
-		case TokenType::KEYWORD:
-			value.k = other.value.k;
-			break;
-		case TokenType::IDENTIFIER:
-		case TokenType::STRING:
-			// The string value.s is not initialized, therefore we cannot use the assignement operator.
-			// We need to initialize it, calling the constructor.
-			new(&value.s) std::string{other.value.s};
-			break;
-		case TokenType::FLOAT:
-			value.f = other.value.f;
-			break;
-		case TokenType::SYMBOL:
-			value.ch = other.value.ch;
-			break;
-		case TokenType::STOP:
-			break;
-		}
-	}
-
-	Token operator=(const Token &other) {
-		location = other.location;
-		type = other.type;
-		switch (type) {
-		case TokenType::KEYWORD:
-			value.k = other.value.k;
-			break;
-		case TokenType::IDENTIFIER:
-		case TokenType::STRING:
-			new(&value.s) std::string{other.value.s};
-			break;
-		case TokenType::FLOAT:
-			value.f = other.value.f;
-			break;
-		case TokenType::SYMBOL:
-			value.ch = other.value.ch;
-			break;
-		case TokenType::STOP:
-			break;
-		}
-		return *this;
-	}
+	Token(size_t offset = 0) : offset{offset} {}
 
 	void assignKeyword(Keyword k) {
 		type = TokenType::KEYWORD;
 		value.k = k;
 	}
 
-	void assignIdentifier(std::string s) {
+	void assignIdentifier(std::string_view s) {
 		type = TokenType::IDENTIFIER;
-		new(&value.s) std::string{s};
+		value.s = s;
 	}
 
-	void assignString(std::string s) {
+	void assignString(std::string_view s) {
 		type = TokenType::STRING;
-		new(&value.s) std::string{s};
+		value.s = s;
 	}
 
 	void assignFloat(float f) {
@@ -170,7 +131,7 @@ struct Token {
 		type = TokenType::STOP;
 	}
 
-	void assignKeywordOrIdentifier(std::string s) {
+	void assignKeywordOrIdentifier(std::string_view s) {
 		auto it = keywordTable.find(s);
 		if (it != keywordTable.end())
 			assignKeyword(it->second);
@@ -185,12 +146,12 @@ struct Token {
 			for (; it != keywordTable.end(); it++)
 				if (it->second == value.k)
 					break;
-			return "Keyword{" + it->first + "}";
+			return "Keyword{" + std::string{it->first} + "}";
 		}
 		case TokenType::IDENTIFIER:
-			return "Identifier{" + value.s + "}";
+			return "Identifier{" + std::string{value.s} + "}";
 		case TokenType::STRING:
-			return "String{\"" + value.s + "\"}";
+			return "String{\"" + std::string{value.s} + "\"}";
 		case TokenType::FLOAT: {
 			std::ostringstream ss;
 			ss << "Float{\"" << value.f << "\"}";
@@ -208,8 +169,8 @@ struct Token {
 	}
 	
 private:
-	// Associate each keyword with the Keyword enum value
-	std::unordered_map<std::string, Keyword> const keywordTable = {
+	// Associate each keyword with the Keyword enum value; it is shared, so that building a token does not copy it
+	inline static std::unordered_map<std::string_view, Keyword> const keywordTable = {
 		{"new", Keyword::NEW}, {"material", Keyword::MATERIAL},
 		{"plane", Keyword::PLANE}, {"sphere", Keyword::SPHERE},
 		{"diffuse", Keyword::DIFFUSE}, {"specular", Keyword::SPECULAR},
@@ -222,7 +183,7 @@ private:
 		{"float", Keyword::FLOAT}, {"union", Keyword::UNION},
 		{"difference", Keyword::DIFFERENCE}, {"intersection", Keyword::INTERSECTION},
 		{"box", Keyword::BOX}, {"dielectric", Keyword::DIELECTRIC},
-		{"triangle", Keyword::TRIANGLE}
+		{"triangle", Keyword::TRIANGLE}, {"mesh", Keyword::MESH}
 	};
 };
 
@@ -239,128 +200,143 @@ struct Scene {
 	std::shared_ptr<Camera> camera = nullptr;
 	std::unordered_map<std::string, FloatVariable> floatVariables;
 	float aspectRatio;
+	// The files read while parsing the scene, i.e. images and meshes
+	std::vector<std::string> files;
 };
 
 /**
  * @brief   Wrapper used to parse the scene file.
- * @details It keeps updated the line number and the column number.
+ * @details The whole text of the scene is kept in memory, either in a buffer or in a file mapped in memory
+ *          by the caller, and the tokens refer to it without copying it.
+ *          Line and column numbers are computed only when they are needed, e.g. to report an error,
+ *          by scanning the text up to the requested position.
  *          It lets look-ahead tokens and un-read characters.
  */
 struct InputStream {
-	std::istream &stream;
-	SourceLocation location;
-	SourceLocation savedLocation;
+	// Used only when the text is read from a stream
+	std::string buffer;
+	std::string_view text;
+	// Offset in text of the next character to read
+	size_t position = 0;
+	// Location of the first character of text
+	SourceLocation start;
 	Token savedToken{};
 	bool isSavedToken = false;
 	int tabulations;
 
-	InputStream(std::istream &stream, std::string filename, int tabulations=4) : stream{stream}, tabulations{tabulations} {
-		location.filename = filename;
-	}
+	InputStream(std::istream &stream, std::string filename, int tabulations=4) : 
+		InputStream{stream, SourceLocation{filename}, tabulations} {}
 	InputStream(std::istream &stream, SourceLocation location, int tabulations=4) : 
-		stream{stream}, location{location}, tabulations{tabulations} {}
+		buffer{std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{}}, text{buffer}, start{location}, tabulations{tabulations} {}
+
+	/**
+	 * @brief Read the scene from text, e.g. a MappedFile, which must outlive the InputStream and the tokens read.
+	 */
+	InputStream(std::string_view text, std::string filename, int tabulations=4) : 
+		InputStream{text, SourceLocation{filename}, tabulations} {}
+	InputStream(std::string_view text, SourceLocation location, int tabulations=4) : 
+		text{text}, start{location}, tabulations{tabulations} {}
+
+	// The tokens refer to text, which may be the buffer
+	InputStream(const InputStream &) = delete;
+	InputStream &operator=(const InputStream &) = delete;
+
+	/**
+	 * @brief Return the location of the character at the given offset in the text.
+	 */
+	SourceLocation locationAt(size_t offset) const {
+		SourceLocation loc{start};
+		for (char ch : text.substr(0, offset)) {
+			if (ch == '\n') {
+				loc.line += 1;
+				loc.col = 1;
+			} else if (ch == '\t') {
+				loc.col += tabulations;
+			} else {
+				loc.col += 1;
+			}
+		}
+		return loc;
+	}
+
+	/**
+	 * @brief Return the location of the next character to read.
+	 */
+	SourceLocation location() const {
+		return locationAt(position);
+	}
+
+	/**
+	 * @brief Return the location of the first character of the token.
+	 */
+	SourceLocation locationOf(const Token &token) const {
+		return locationAt(token.offset);
+	}
 
 	Token parseStringToken() {
-		std::string s{};
-		Token token{location};
-		for (;;) {
-			switch (int ch = readChar()) {
-			case std::char_traits<char>::eof():
-				throw GrammarError(location, std::string{"unterminated string"});
-				break;
-			case '"':
-				goto loopEnd;
-				break;
-			default:
-				s += ch;
-				break;
-			}
+		Token token{position - 1};
+		size_t end = text.find('"', position);
+		if (end == std::string_view::npos) {
+			position = text.size();
+			throw GrammarError(location(), std::string{"unterminated string"});
 		}
-	loopEnd:
-		token.assignString(s);
+		token.assignString(text.substr(position, end - position));
+		position = end + 1;
 		return token;
 	}
 
-	Token parseFloatToken(char firstChar) {
-		std::string s{firstChar};
-		Token token{location};
+	Token parseFloatToken() {
+		Token token{position - 1};
+		size_t end = position;
+		while (end < text.size() and (std::isdigit(text[end]) or std::string_view{".eE+-"}.find(text[end]) != std::string_view::npos))
+			end++;
+		std::string_view s{text.substr(token.offset, end - token.offset)};
+		position = end;
 		float f;
-		for (;;) {
-			int ch = readChar();
-			if (std::isdigit(ch) or std::string{".eE+-"}.find(ch) != std::string::npos) {
-				s += ch;
-			} else if (ch == std::char_traits<char>::eof()) {
-				break;
-			} else {
-				unreadChar(ch);
-				break;
-			}
-		}
-		try {
-			f = std::stof(s);
-		} catch (std::exception e) {
-			throw GrammarError(location, std::string{s} + "is an invalid floating point number");
-		}
+		if (!parseNumber(s, f))
+			throw GrammarError(location(), std::string{s} + " is an invalid floating point number");
 		token.assignFloat(f);
 		return token;
 	}
 
-	Token parseKeywordOrIdentifierToken(char firstChar) {
-		std::string s{firstChar};
-		Token token{location};
-		for (;;) {
-			int ch = readChar();
-			if (std::isalnum(ch) or ch == '_') {
-				s += ch;
-			} else if (ch == std::char_traits<char>::eof()) {
-				break;
-			} else {
-				unreadChar(ch);
-				break;
-			}
-		}
-		token.assignKeywordOrIdentifier(s);
+	Token parseKeywordOrIdentifierToken() {
+		Token token{position - 1};
+		size_t end = position;
+		while (end < text.size() and (std::isalnum(text[end]) or text[end] == '_'))
+			end++;
+		position = end;
+		token.assignKeywordOrIdentifier(text.substr(token.offset, end - token.offset));
 		return token;
 	}
 
-	void updatePosition(char ch) {
-		if (ch == '\n') {
-			location.line += 1;
-			location.col = 1;
-		} else if (ch == '\t') {
-			location.col += tabulations;
-		} else {
-			location.col += 1;
-		}
-	}
-
 	int readChar() {
-		int ch;
-		ch = stream.get();
-		if (ch != std::char_traits<char>::eof()) {
-			savedLocation = location;
-			updatePosition(ch);
-		}
-		return ch;
+		if (position == text.size())
+			return std::char_traits<char>::eof();
+		return text[position++];
 	}
 
 	void unreadChar(int ch) {
-		stream.putback(ch);
-		location = savedLocation;
+		if (ch != std::char_traits<char>::eof())
+			position--;
 	}
 
 	void skipWhitespacesAndComments() {
-		int ch = readChar();
-		while (std::string{WHITESPACE}.find(ch) != std::string::npos and ch != std::char_traits<char>::eof()) {
-			if (ch == '#') {
-				do
-					ch = readChar();
-				while (ch != '\r' and ch != '\n' and ch != std::char_traits<char>::eof());
-			} else {
-				ch = readChar();
+		while (position < text.size()) {
+			switch (text[position]) {
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+				position++;
+				break;
+			case '#':
+				while (position < text.size() and text[position] != '\r' and text[position] != '\n')
+					position++;
+				break;
+			default:
+				return;
 			}
 		}
-		unreadChar(ch);
 	}
 
 	void unreadToken(Token token) {
@@ -376,68 +352,69 @@ struct InputStream {
 		skipWhitespacesAndComments();
 		int ch = readChar();
 		if (ch == std::char_traits<char>::eof()) {	// End of input stream
-			Token stop{location};
+			Token stop{position};
 			stop.assignStop();
 			return stop;
-		} else if (SYMBOLS.find(ch) != std::string::npos) {	// Symbol
-			Token symbol{location};
+		} else if (SYMBOLS.find(ch) != std::string_view::npos) {	// Symbol
+			Token symbol{position - 1};
 			symbol.assignSymbol(ch);
 			return symbol;
 		} else if (ch == '"') {		// String
 			return parseStringToken();
-		} else if (std::isdigit(ch) or std::string{"+-."}.find(ch) != std::string::npos) {	// Float
-			return parseFloatToken(ch);
+		} else if (std::isdigit(ch) or std::string_view{"+-."}.find(ch) != std::string_view::npos) {	// Float
+			return parseFloatToken();
 		} else if (std::isalpha(ch) or ch == '_') {	// Keyword or identifier
-			return parseKeywordOrIdentifierToken(ch);
+			return parseKeywordOrIdentifierToken();
 		} else {
-			throw GrammarError(location, "Invalid character " + std::string{static_cast<char>(ch)});
+			throw GrammarError(locationAt(position - 1), "Invalid character " + std::string{static_cast<char>(ch)});
 		}
 	}
 
 	void expectSymbol(char ch) {
 		Token token{readToken()};
 		if (token.type != TokenType::SYMBOL or token.value.ch != ch)
-			throw GrammarError(token.location, "Got " + std::string{token} + " instead of " + ch);
+			throw GrammarError(locationOf(token), "Got " + std::string{token} + " instead of " + ch);
 	}
 
 	Keyword expectKeywords(std::vector<Keyword> ks) {
 		Token token{readToken()};
 		if (token.type != TokenType::KEYWORD)
-			throw GrammarError(token.location, "Expected keyword, got " + std::string{token});
+			throw GrammarError(locationOf(token), "Expected keyword, got " + std::string{token});
 		for (auto it = ks.begin(); it != ks.end(); it++)
 			if (*it == token.value.k)
 				return *it;
-		throw GrammarError(token.location, "Got unexpected " + std::string{token});
+		throw GrammarError(locationOf(token), "Got unexpected " + std::string{token});
 	}
 
-	float expectNumber(Scene scene){
+	float expectNumber(Scene &scene){
 		Token token = readToken();
 		if (token.type == TokenType::FLOAT)
 			return token.value.f;
 		else if (token.type == TokenType::IDENTIFIER){
-			std::string varName = token.value.s;
-			if (scene.floatVariables.find(varName) == scene.floatVariables.end())
-				throw GrammarError(location, "Unknow variable "+varName);
-			return scene.floatVariables[varName].value;
+			std::string varName{token.value.s};
+			auto variable = scene.floatVariables.find(varName);
+			if (variable == scene.floatVariables.end())
+				throw GrammarError(location(), "Unknow variable "+varName);
+			return variable->second.value;
 		}
-		throw GrammarError(token.location, "Got "+std::string(token)+ ", expected a float");
+		throw GrammarError(locationOf(token), "Got "+std::string(token)+ ", expected a float");
 	}
 
 	std::string expectString(){
 		Token token = readToken();
 		if (!(token.type==TokenType::STRING))
-			throw GrammarError(token.location, "Got "+std::string(token)+ ", expected a string");
-		return token.value.s;
+			throw GrammarError(locationOf(token), "Got "+std::string(token)+ ", expected a string");
+		return std::string{token.value.s};
 	}
 
 	std::string expectIdentifier(){
 		Token token = readToken();
 		if (!(token.type==TokenType::IDENTIFIER))
-			throw GrammarError(token.location, "Got "+std::string(token)+ ", expected an identifier");
-		return token.value.s;
+			throw GrammarError(locationOf(token), "Got "+std::string(token)+ ", expected an identifier");
+		return std::string{token.value.s};
 	}
 
-	Vec parseVec(Scene scene) {
+	Vec parseVec(Scene &scene) {
 		expectSymbol('[');
 		float x{expectNumber(scene)};
 		expectSymbol(',');
@@ -449,7 +426,7 @@ struct InputStream {
 		return Vec{x, y, z};
 	}
 
-	Color parseColor(Scene scene) {
+	Color parseColor(Scene &scene) {
 		expectSymbol('<');
 		float r{expectNumber(scene)};
 		expectSymbol(',');
@@ -461,7 +438,7 @@ struct InputStream {
 		return Color{r, g, b};
 	}
 
-	std::shared_ptr<Pigment> parsePigment(Scene scene) {
+	std::shared_ptr<Pigment> parsePigment(Scene &scene) {
 		Keyword k{expectKeywords(std::vector{Keyword::UNIFORM, Keyword::CHECKERED, Keyword::IMAGE})};
 		std::shared_ptr<Pigment> result;
 
@@ -484,6 +461,7 @@ struct InputStream {
 		case Keyword::IMAGE: {
 			std::string file{expectString()};
 			HdrImage image{file};
+			addFile(scene, file);
 			expectSymbol(',');
 			Color c{parseColor(scene)};
 			result = std::make_shared<ImagePigment>(ImagePigment{image * c});
@@ -499,7 +477,7 @@ struct InputStream {
 	// diffuse(pigment)
 	// specular(pigment, roughness)
 	// dielectric(pigment, roughness, refractionIndex)
-	std::shared_ptr<BRDF> parseBRDF(Scene scene) {
+	std::shared_ptr<BRDF> parseBRDF(Scene &scene) {
 		Keyword k{expectKeywords(std::vector{Keyword::DIFFUSE, Keyword::SPECULAR, Keyword::DIELECTRIC})};
 		expectSymbol('(');
 		std::shared_ptr<Pigment> pigment{parsePigment(scene)};
@@ -529,7 +507,7 @@ struct InputStream {
 		return brdf;
 	}
 
-	std::tuple<std::string, Material> parseMaterial(Scene scene) {
+	std::tuple<std::string, Material> parseMaterial(Scene &scene) {
 		std::string name{expectIdentifier()};
 		expectSymbol('(');
 		std::shared_ptr<BRDF> brdf{parseBRDF(scene)};
@@ -540,7 +518,7 @@ struct InputStream {
 		return std::tuple<std::string, Material>{name, Material{brdf, emittedRadiance}};
 	}
 
-	Transformation parseTransformation(Scene scene) {
+	Transformation parseTransformation(Scene &scene) {
 		Transformation result{};
 
 		for (;;) {
@@ -600,7 +578,7 @@ struct InputStream {
 		return result;
 	}
 
-	std::shared_ptr<Camera> parseCamera(Scene scene) {
+	std::shared_ptr<Camera> parseCamera(Scene &scene) {
 		expectSymbol('(');
 		Keyword typeKeyw = expectKeywords(std::vector{Keyword::PERSPECTIVE, Keyword::ORTHOGONAL});
 		expectSymbol(',');
@@ -617,38 +595,47 @@ struct InputStream {
 		return cam;
 	}
 
+	// Record a file read by the scene, once
+	void addFile(Scene &scene, const std::string &file) {
+		if (std::find(scene.files.begin(), scene.files.end(), file) == scene.files.end())
+			scene.files.push_back(file);
+	}
+
+	// The index of a declared material in the material table of the world
+	int expectMaterial(Scene &scene){
+		std::string materialName = expectIdentifier();
+		auto material = scene.materials.find(materialName);
+		if (material == scene.materials.end())
+			throw GrammarError(location(), "Unknown material "+materialName);
+		return scene.world.materials.add(material->second);
+	}
+
 	// plane(material, transformation)
-	Plane parsePlane(Scene scene){
+	Plane parsePlane(Scene &scene){
 		expectSymbol('(');
-		std::string materialName = expectIdentifier();
-		if (scene.materials.find(materialName) == scene.materials.end())
-			throw GrammarError(location, "Unknown material "+materialName);
+		int material = expectMaterial(scene);
 		expectSymbol(',');
 		Transformation transformation = parseTransformation(scene);
 		expectSymbol(')');
 
-		return Plane{transformation, scene.materials[materialName]};
+		return Plane{transformation, material};
 	}
 
 	// sphere(material, transformation)
-	Sphere parseSphere(Scene scene){
+	Sphere parseSphere(Scene &scene){
 		expectSymbol('(');
-		std::string materialName = expectIdentifier();
-		if (scene.materials.find(materialName) == scene.materials.end())
-			throw GrammarError(location, "Unknown material "+materialName);
+		int material = expectMaterial(scene);
 		expectSymbol(',');
 		Transformation transformation = parseTransformation(scene);
 		expectSymbol(')');
 
-		return Sphere{transformation, scene.materials[materialName]};
+		return Sphere{transformation, material};
 	}
 
 	// triangle(material, pointA, pointB, pointC, transformation)
-	Triangle parseTriangle(Scene scene){
+	Triangle parseTriangle(Scene &scene){
 		expectSymbol('(');
-		std::string materialName = expectIdentifier();
-		if (scene.materials.find(materialName) == scene.materials.end())
-			throw GrammarError(location, "Unknown material "+materialName);
+		int material = expectMaterial(scene);
 		expectSymbol(',');
 		Vec vecA{parseVec(scene)};
 		Point pointA{vecA.x, vecA.y, vecA.z};
@@ -662,16 +649,34 @@ struct InputStream {
 		Transformation transformation = parseTransformation(scene);
 		expectSymbol(')');
 
-		return Triangle{pointA, pointB, pointC, transformation, scene.materials[materialName]};
+		return Triangle{pointA, pointB, pointC, transformation, material};
 	}
 
+	// mesh(material, file, transformation)
+	TriangleMesh parseMesh(Scene &scene){
+		expectSymbol('(');
+		int material = expectMaterial(scene);
+		expectSymbol(',');
+		size_t fileOffset{position};
+		std::string file{expectString()};
+		expectSymbol(',');
+		Transformation transformation = parseTransformation(scene);
+		expectSymbol(')');
+
+		std::shared_ptr<const MeshData> mesh;
+		try {
+			mesh = readMeshFile(file);
+		} catch (std::runtime_error &e) {
+			throw GrammarError(locationAt(fileOffset), e.what());
+		}
+		addFile(scene, file);
+		return TriangleMesh{mesh, transformation, material};
+	}
 
 	// box(material, pointMin, pointMax, transformation)
-	Box parseBox(Scene scene){
+	Box parseBox(Scene &scene){
 		expectSymbol('(');
-		std::string materialName = expectIdentifier();
-		if (scene.materials.find(materialName) == scene.materials.end())
-			throw GrammarError(location, "Unknown material "+materialName);
+		int material = expectMaterial(scene);
 		expectSymbol(',');
 		Vec vecMin{parseVec(scene)};
 		Point pointMin{vecMin.x, vecMin.y, vecMin.z};
@@ -682,12 +687,12 @@ struct InputStream {
 		Transformation transformation = parseTransformation(scene);
 		expectSymbol(')');
 
-		return Box{pointMin, pointMax, transformation, scene.materials[materialName]};
+		return Box{pointMin, pointMax, transformation, material};
 	}
 
 
-	std::shared_ptr<Shape> parseShape(Scene scene) {
-		Keyword typeKeyw = expectKeywords(std::vector{Keyword::SPHERE, Keyword::PLANE, Keyword::UNION, Keyword::DIFFERENCE, Keyword::INTERSECTION, Keyword::BOX, Keyword::TRIANGLE});
+	std::shared_ptr<Shape> parseShape(Scene &scene) {
+		Keyword typeKeyw = expectKeywords(std::vector{Keyword::SPHERE, Keyword::PLANE, Keyword::UNION, Keyword::DIFFERENCE, Keyword::INTERSECTION, Keyword::BOX, Keyword::TRIANGLE, Keyword::MESH});
 		switch (typeKeyw) {
 		case Keyword::SPHERE:
 			return std::make_shared<Sphere>(parseSphere(scene));
@@ -703,13 +708,15 @@ struct InputStream {
 			return std::make_shared<Box>(parseBox(scene));
 		case Keyword::TRIANGLE:
 			return std::make_shared<Triangle>(parseTriangle(scene));
+		case Keyword::MESH:
+			return std::make_shared<TriangleMesh>(parseMesh(scene));
 		default:
 			exit(1);	// We should never get here
 		}
 	}
 
 
-	CSGUnion parseUnion(Scene scene) {
+	CSGUnion parseUnion(Scene &scene) {
 		expectSymbol('(');
 		auto shape1{parseShape(scene)};
 		expectSymbol(',');
@@ -721,7 +728,7 @@ struct InputStream {
 		return CSGUnion(shape1, shape2, transformation);
 	}
 
-	CSGDifference parseDifference(Scene scene) {
+	CSGDifference parseDifference(Scene &scene) {
 		expectSymbol('(');
 		auto shape1{parseShape(scene)};
 		expectSymbol(',');
@@ -733,7 +740,7 @@ struct InputStream {
 		return CSGDifference(shape1, shape2, transformation);
 	}
 
-	CSGIntersection parseIntersection(Scene scene) {
+	CSGIntersection parseIntersection(Scene &scene) {
 		expectSymbol('(');
 		auto shape1{parseShape(scene)};
 		expectSymbol(',');
@@ -764,12 +771,12 @@ struct InputStream {
 
 			// We expect a keyword
 			if (token.type != TokenType::KEYWORD)
-				throw GrammarError{token.location, "Expected keyword, got " + std::string{token}};
+				throw GrammarError{locationOf(token), "Expected keyword, got " + std::string{token}};
 
 			switch (token.value.k) {
 			case Keyword::FLOAT: {
 				std::string name{expectIdentifier()};
-				SourceLocation loc{location};
+				size_t offset{position};
 				expectSymbol('(');
 				float value{expectNumber(scene)};
 				expectSymbol(')');
@@ -777,7 +784,7 @@ struct InputStream {
 				if (v == scene.floatVariables.end())	// Variable not defined yet: add it to the list
 					scene.floatVariables[name] = value;
 				else if (!v->second.isOverriden)	// Variable defined two times in the file: error
-					throw GrammarError{loc, "variable " + name + " already defined"};
+					throw GrammarError{locationAt(offset), "variable " + name + " already defined"};
 				// The other possibility is that the variable is defined both in the file and in the variables function parameter.
 				// In that case, we do nothing: the stored value is the one in the parameter.
 				break;
@@ -791,14 +798,19 @@ struct InputStream {
 			case Keyword::TRIANGLE:
 				scene.world.add(parseTriangle(scene));
 				break;
+			case Keyword::MESH:
+				scene.world.add(parseMesh(scene));
+				break;
 			case Keyword::CAMERA:
 				if (scene.camera != nullptr)
-					throw GrammarError{location, "Camera already defined"};
+					throw GrammarError{location(), "Camera already defined"};
 				scene.camera = parseCamera(scene);
 				break;
 			case Keyword::MATERIAL: {
 				auto material{parseMaterial(scene)};
 				scene.materials.insert({std::get<0>(material), std::get<1>(material)});
+				// The shapes using the material will find it in the table
+				scene.world.materials.add(std::get<1>(material));
 				break;
 			}
 			case Keyword::UNION:
@@ -814,13 +826,13 @@ struct InputStream {
 				scene.world.add(parseBox(scene));
 				break;
 			default:
-				throw GrammarError{location, "Unexpected keyword " + std::string{token}};
+				throw GrammarError{location(), "Unexpected keyword " + std::string{token}};
 				break;
 			}
 		}
 		
 		if (scene.camera == nullptr)
-			throw GrammarError{location, "No camera defined"};
+			throw GrammarError{location(), "No camera defined"};
 		return scene;
 	}
 };
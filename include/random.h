@@ -48,6 +48,22 @@ struct PCG {
 		return (float)(*this)() / UINT32_MAX;
 	}
 
+	/**
+	 * @brief Return a new generator for the stream identified by `index`, e.g. a pixel.
+	 * The result depends only on the current state of this generator and on `index`, so streams can be derived concurrently and in any order.
+	 *
+	 * @param index The identifier of the stream
+	 * @return PCG
+	 */
+	PCG split(uint64_t index) const {
+		// Mix the index with the splitmix64 finalizer, so that neighbouring indices select unrelated sequences
+		uint64_t seq = inc ^ (index * 0x9e3779b97f4a7c15);
+		seq = (seq ^ (seq >> 30)) * 0xbf58476d1ce4e5b9;
+		seq = (seq ^ (seq >> 27)) * 0x94d049bb133111eb;
+		seq ^= seq >> 31;
+		return PCG{state, seq};
+	}
+
 	Vec randDir(Normal normal) {
 		ONB onb{normal};
 		float cosThetaSq = randFloat();
@@ -27,8 +27,15 @@ struct Renderer {
 	Color backgroundColor;
 
 	Renderer() {}
-	Renderer(World w) : world{w} {}
-	Renderer(World w, Color bg = BLACK) : world{w}, backgroundColor{bg} {}
+	// Build the BVH now, so that it is not built concurrently by the rendering threads
+	Renderer(World w) : world{w} {
+		if (!world.isBVHUpToDate())
+			world.buildBVH();
+	}
+	Renderer(World w, Color bg = BLACK) : world{w}, backgroundColor{bg} {
+		if (!world.isBVHUpToDate())
+			world.buildBVH();
+	}
 
 	virtual Color operator()(Ray ray) = 0;
 };
@@ -49,7 +56,7 @@ struct OnOffRenderer : public Renderer {
 	* @return Color 
 	*/
 	virtual Color operator()(Ray ray) override {
-		return world.rayIntersection(ray).hit ? color : backgroundColor;
+		return world.anyIntersection(ray) ? color : backgroundColor;
 	}
 };
 
@@ -70,7 +77,7 @@ struct FlatRenderer : public Renderer {
 	*/
 	virtual Color operator()(Ray ray) override {
 		HitRecord record = world.rayIntersection(ray);
-		return record.hit ? (*record.material.brdf->pigment)(record.surfacePoint) : backgroundColor;
+		return record.hit ? world.materials[record.material].brdf->pigment->at(record.surfacePoint) : backgroundColor;
 	}
 };
 
@@ -98,6 +105,18 @@ struct PathTracer : public Renderer {
 	PathTracer(World w, PCG pcg = PCG{}, int nRays = 10, int maxDepth = 2, int minDepth = 3, Color bg = BLACK) : Renderer(w, bg), pcg{pcg}, nRays{nRays}, maxDepth{maxDepth}, minDepth{minDepth} {}
 
 	virtual Color operator()(Ray ray) override {
+		return (*this)(ray, pcg);
+	}
+
+	/**
+	* @brief Trace the ray drawing random numbers from the given generator instead of the shared one.
+	* This way each pixel can use its own stream and the renderer can be called concurrently.
+	*
+	* @param ray
+	* @param pcg
+	* @return Color
+	*/
+	Color operator()(Ray ray, PCG &pcg) {
 		if (ray.depth > maxDepth)
 			return BLACK;
 
@@ -105,9 +124,9 @@ struct PathTracer : public Renderer {
 		if (!hit.hit)
 			return backgroundColor;
 
-		Material hitMaterial{hit.material};
-		Color hitColor{(*hitMaterial.brdf->pigment)(hit.surfacePoint)};
-		Color emittedRadiance{(*hitMaterial.emittedRadiance)(hit.surfacePoint)};
+		const Material &hitMaterial{world.materials[hit.material]};
+		Color hitColor{hitMaterial.brdf->pigment->at(hit.surfacePoint)};
+		Color emittedRadiance{hitMaterial.emittedRadiance->at(hit.surfacePoint)};
 		bool inward = hit.inward; //Be carefull: not all shapes have it implemented
 		float hitColorLum = std::max({hitColor.r, hitColor.g, hitColor.b});
 
@@ -125,11 +144,149 @@ struct PathTracer : public Renderer {
 
 		if (hitColorLum > 0.f)
 			for (int i{}; i < nRays; i++)
-				cumulativeRadiance += hitColor * (*this)(hitMaterial.brdf->scatterRay(
-					pcg, hit.ray.dir, hit.worldPoint, hit.normal, ray.depth+1, inward));	
+				cumulativeRadiance += hitColor * (*this)(hitMaterial.brdf->dispatchScatterRay(
+					pcg, hit.ray.dir, hit.worldPoint, hit.normal, ray.depth+1, inward), pcg);	
 
 		return emittedRadiance + cumulativeRadiance / (float) nRays;
 	}
 };
 
+/**
+ * @brief Return the weight of a sample drawn with density pdf, when another strategy has density otherPdf (power heuristic).
+ */
+float powerHeuristic(float pdf, float otherPdf) {
+	return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+/**
+ * @brief Path tracer following a single scattered ray at each bounce, instead of nRays recursive ones.
+ * @details The contribution of each bounce is weighted by the product of the colors of the surfaces hit so far (the throughput),
+ * 			so the cost of a sample grows linearly with the depth. Noise is reduced by firing more samples per pixel.
+ * 			If sampleEmitters is true, at each diffuse surface a point is also sampled on a light source (next-event estimation),
+ * 			and the two estimates of the light reaching the surface are combined with multiple importance sampling.
+ *
+ * @param maxDepth			Maximum depth of the path.
+ * @param minDepth			Depth to start Russian roulette.
+ * @param sampleEmitters	Whether to sample the emitters of the world explicitly.
+ */
+struct IterativePathTracer : public Renderer {
+	PCG pcg;
+	int maxDepth, minDepth;
+	bool sampleEmitters;
+	IterativePathTracer() {}
+	IterativePathTracer(World w, PCG pcg = PCG{}, int maxDepth = 2, int minDepth = 3, bool sampleEmitters = false, Color bg = BLACK) :
+		Renderer(w, bg), pcg{pcg}, maxDepth{maxDepth}, minDepth{minDepth}, sampleEmitters{sampleEmitters} {
+		world.collectEmitters();
+	}
+
+	virtual Color operator()(Ray ray) override {
+		return (*this)(ray, pcg);
+	}
+
+	/**
+	* @brief Trace the ray drawing random numbers from the given generator instead of the shared one.
+	*
+	* @param ray
+	* @param pcg
+	* @return Color
+	*/
+	Color operator()(Ray ray, PCG &pcg) {
+		Color radiance = BLACK;
+		Color throughput = WHITE;
+		bool nextEvent = sampleEmitters and !world.emitters.empty();
+		// Density of the direction of ray, if it was scattered by a diffuse surface where an emitter was also sampled
+		float scatterPdf = 0.f;
+
+		while (ray.depth <= maxDepth) {
+			HitRecord hit{world.rayIntersection(ray)};
+			if (!hit.hit)
+				return radiance + throughput * backgroundColor;
+
+			const Material &hitMaterial{world.materials[hit.material]};
+			Color hitColor{hitMaterial.brdf->pigment->at(hit.surfacePoint)};
+			Color emittedRadiance{hitMaterial.emittedRadiance->at(hit.surfacePoint)};
+			if (scatterPdf > 0.f and isEmitter(hit))
+				emittedRadiance = emittedRadiance * powerHeuristic(scatterPdf, emitterPdf(hit, ray.origin));
+			radiance += throughput * emittedRadiance;
+			float hitColorLum = std::max({hitColor.r, hitColor.g, hitColor.b});
+			if (hitColorLum <= 0.f)
+				break;
+
+			// The emitters are sampled only if the scattered ray could reach them as well
+			bool diffuse = nextEvent and ray.depth < maxDepth and hitMaterial.brdf->kind == BRDF::Kind::DIFFUSE;
+			if (diffuse)
+				radiance += throughput * hitColor * sampleEmitter(hit, pcg);
+
+			// Russian roulette
+			if (ray.depth >= minDepth) {
+				float q = std::max(0.05f, 1 - hitColorLum);
+				if (pcg.randFloat() > q)
+					hitColor /= (1.f - q);
+				else
+					break;
+			}
+
+			throughput *= hitColor;
+			ray = hitMaterial.brdf->dispatchScatterRay(pcg, hit.ray.dir, hit.worldPoint, hit.normal, ray.depth+1, hit.inward);
+			scatterPdf = diffuse ? std::max(0.f, unitNormal(hit.normal).dot(ray.dir)) / (float) M_PI : 0.f;
+		}
+		return radiance;
+	}
+
+private:
+	static Vec unitNormal(Normal normal) {
+		Vec n{normal.toVec()};
+		n.normalize();
+		return n;
+	}
+
+	/**
+	 * @brief Return true if the shape hit could have been sampled by sampleEmitter.
+	 */
+	bool isEmitter(const HitRecord &hit) {
+		return hit.shape and hit.shape->canSampleSurface() and world.materials[hit.material].isEmissive();
+	}
+
+	/**
+	 * @brief Return the density per unit solid angle, as seen from origin, with which sampleEmitter picks the point hit.
+	 */
+	float emitterPdf(const HitRecord &hit, Point origin) {
+		Vec toLight{hit.worldPoint - origin};
+		float distSq = toLight.squaredNorm();
+		float cosEmitter = std::abs(unitNormal(hit.normal).dot(toLight)) / std::sqrt(distSq);
+		if (cosEmitter <= 0.f)
+			return 0.f;
+		return hit.shape->surfacePdf(hit.normal) * distSq / (cosEmitter * world.emitters.size());
+	}
+
+	/**
+	 * @brief 	Estimate the radiance reaching the hit point directly from a random point of a random emitter.
+	 * @details The estimate is weighted for multiple importance sampling with the diffuse scattering,
+	 * 			and it is already multiplied by the cosine over pi, so that it must only be multiplied by the color of the surface.
+	 */
+	Color sampleEmitter(const HitRecord &hit, PCG &pcg) {
+		int nEmitters = world.emitters.size();
+		int index = std::min<int>(pcg.randFloat() * nEmitters, nEmitters - 1);
+		const Shape &emitter = *world.shapes[world.emitters[index]];
+		SurfaceSample sample{emitter.sampleSurface(pcg)};
+
+		Vec toLight{sample.point - hit.worldPoint};
+		float distSq = toLight.squaredNorm();
+		float dist = std::sqrt(distSq);
+		toLight = toLight * (1.f / dist);
+		float cosSurface = unitNormal(hit.normal).dot(toLight);
+		float cosEmitter = std::abs(unitNormal(sample.normal).dot(toLight));
+		if (cosSurface <= 0.f or cosEmitter <= 0.f or sample.pdf <= 0.f)
+			return BLACK;
+
+		// Shadow ray, stopping just before the sampled point
+		if (world.anyIntersection(Ray{hit.worldPoint, toLight, 0, 1e-5f, dist * (1.f - 1e-3f)}))
+			return BLACK;
+
+		float lightPdf = sample.pdf * distSq / (cosEmitter * nEmitters);
+		float scatterPdf = cosSurface / M_PI;
+		return world.materials[emitter.materialIndex].emittedRadiance->at(sample.uv) * (scatterPdf / lightPdf * powerHeuristic(lightPdf, scatterPdf));
+	}
+};
+
 #endif //   RENDERER_H
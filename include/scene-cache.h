@@ -0,0 +1,579 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <filesystem>
+#include <unistd.h>
+#include "parser.h"
+#include "mapped-file.h"
+
+/**
+ * @brief	Return the key identifying a scene in the cache: the hash (64-bit FNV-1a) of the text of the scene file,
+ * 			of the variables overridden from the command line and of the aspect ratio of the camera.
+ * @details The files read by the scene, i.e. images and meshes, are only known after parsing it, so they are not part of the key:
+ * 			the snapshot records their stamps instead (see fileStamp).
+ */
+uint64_t sceneCacheKey(std::string_view text, const std::unordered_map<std::string, float> &variables, float aspectRatio) {
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&hash](const void *data, size_t size) {
+		const unsigned char *bytes = static_cast<const unsigned char *>(data);
+		for (size_t i{}; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+	};
+
+	add(text.data(), text.size());
+	// The order of the variables in the map is unspecified
+	std::vector<std::pair<std::string, float>> sorted{variables.begin(), variables.end()};
+	std::sort(sorted.begin(), sorted.end());
+	for (auto &[name, value] : sorted) {
+		add(name.c_str(), name.size() + 1);
+		add(&value, sizeof(value));
+	}
+	add(&aspectRatio, sizeof(aspectRatio));
+	return hash;
+}
+
+/**
+ * @brief	Return the size and the time of the last modification of a file, which change when the file is written,
+ * 			or {-1, -1} if the file cannot be found.
+ */
+std::pair<int64_t, int64_t> fileStamp(const std::string &fileName) {
+	std::error_code sizeError, timeError;
+	auto size = std::filesystem::file_size(fileName, sizeError);
+	auto time = std::filesystem::last_write_time(fileName, timeError);
+	if (sizeError or timeError)
+		return {-1, -1};
+	return {(int64_t) size, (int64_t) time.time_since_epoch().count()};
+}
+
+/**
+ * @brief	Serialize a parsed scene into a binary snapshot, that SceneCacheReader turns back into the same scene.
+ * @details The snapshot holds the camera, the material table, the shapes and the BVHs of the world and of the meshes,
+ * 			so that reading it needs neither parsing nor building any acceleration structure.
+ * 			Numbers are stored in the native representation, so the snapshot is only meant to be read on the same machine.
+ * 			Pigments, BxDFs and meshes shared by several objects are stored once, and refer to each other by index.
+ * 			Only the pigments, BxDFs, shapes and cameras built by the parser can be stored.
+ *
+ * @param data	The snapshot written so far.
+ */
+struct SceneCacheWriter {
+	std::string data;
+
+	/**
+	 * @brief Write the header and the whole scene. The BVH of the world is built if it is not up to date.
+	 */
+	void writeScene(Scene &scene, uint64_t key) {
+		data.append(MAGIC, sizeof(MAGIC));
+		write(VERSION);
+		write(key);
+		write((int32_t) scene.files.size());
+		for (auto &file : scene.files) {
+			auto [size, time] = fileStamp(file);
+			writeVector(std::vector<char>{file.begin(), file.end()});
+			write(size);
+			write(time);
+		}
+
+		writeCamera(*scene.camera);
+		write(scene.aspectRatio);
+
+		World &world{scene.world};
+		write((int32_t) world.materials.size());
+		for (auto &material : world.materials.materials) {
+			writeBRDF(material.brdf);
+			writePigment(material.emittedRadiance);
+		}
+
+		write((int32_t) std::size(world.shapes));
+		for (auto &shape : world.shapes)
+			writeShape(*shape);
+
+		if (!world.isBVHUpToDate())
+			world.buildBVH();
+		writeBVH(world.getBVH());
+		writeVector(world.getUnbounded());
+	}
+
+	// Identify the file, and the version of its layout
+	static constexpr char MAGIC[8] = {'I', 'R', 'S', 'C', 'E', 'N', 'E', '\0'};
+	static constexpr uint32_t VERSION = 3;
+
+	enum class PigmentTag : uint8_t {UNIFORM, CHECKERED, IMAGE};
+	enum class CameraTag : uint8_t {PERSPECTIVE, ORTHOGONAL};
+	enum class ShapeTag : uint8_t {SPHERE, PLANE, TRIANGLE, MESH, BOX, UNION, DIFFERENCE, INTERSECTION};
+
+private:
+	std::map<const Pigment *, int32_t> pigments;
+	std::map<const BRDF *, int32_t> brdfs;
+	std::map<const MeshData *, int32_t> meshes;
+
+	template <typename T> void write(const T &value) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		data.append(reinterpret_cast<const char *>(&value), sizeof(T));
+	}
+
+	template <typename T> void writeVector(const std::vector<T> &values) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		write((int64_t) values.size());
+		data.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+	}
+
+	/**
+	 * @brief	Write the index of an object in the table, and return true if it is the first time it is written.
+	 * @details The reader knows the object is new when the index is equal to the number of objects read so far.
+	 */
+	template <typename T> bool writeReference(std::map<const T *, int32_t> &table, const T *object) {
+		auto found = table.find(object);
+		if (found != table.end()) {
+			write(found->second);
+			return false;
+		}
+		int32_t index = std::size(table);
+		table[object] = index;
+		write(index);
+		return true;
+	}
+
+	void writePigment(const std::shared_ptr<Pigment> &pigment) {
+		if (!writeReference(pigments, pigment.get()))
+			return;
+		if (auto uniform = dynamic_cast<const UniformPigment *>(pigment.get())) {
+			write(PigmentTag::UNIFORM);
+			write(uniform->color);
+		} else if (auto checkered = dynamic_cast<const CheckeredPigment *>(pigment.get())) {
+			write(PigmentTag::CHECKERED);
+			write(checkered->c1);
+			write(checkered->c2);
+			write((int32_t) checkered->nSteps);
+		} else if (auto image = dynamic_cast<const ImagePigment *>(pigment.get())) {
+			write(PigmentTag::IMAGE);
+			write((int32_t) image->img.width);
+			write((int32_t) image->img.height);
+			writeVector(image->img.pixels);
+		} else {
+			throw std::runtime_error("cannot store a pigment of unknown type in the scene cache");
+		}
+	}
+
+	void writeBRDF(const std::shared_ptr<BRDF> &brdf) {
+		if (!writeReference(brdfs, brdf.get()))
+			return;
+		write(brdf->kind);
+		switch (brdf->kind) {
+		case BRDF::Kind::DIFFUSE:
+			write(static_cast<const DiffusiveBRDF &>(*brdf).reflectance);
+			break;
+		case BRDF::Kind::SPECULAR:
+			write(static_cast<const SpecularBRDF &>(*brdf).thresholdAngle);
+			write(static_cast<const SpecularBRDF &>(*brdf).roughness);
+			break;
+		case BRDF::Kind::DIELECTRIC:
+			write(static_cast<const DielectricBSDF &>(*brdf).refractionIndex);
+			write(static_cast<const DielectricBSDF &>(*brdf).roughness);
+			break;
+		default:
+			throw std::runtime_error("cannot store a BxDF of unknown type in the scene cache");
+		}
+		writePigment(brdf->pigment);
+	}
+
+	void writeCamera(const Camera &camera) {
+		if (auto perspective = dynamic_cast<const PerspectiveCamera *>(&camera)) {
+			write(CameraTag::PERSPECTIVE);
+			write(perspective->transformation);
+		} else if (auto orthogonal = dynamic_cast<const OrthogonalCamera *>(&camera)) {
+			write(CameraTag::ORTHOGONAL);
+			write(orthogonal->transformation);
+		} else {
+			throw std::runtime_error("cannot store a camera of unknown type in the scene cache");
+		}
+		write(camera.a);
+		write(camera.d);
+	}
+
+	void writeBVH(const BVH &bvh) {
+		writeVector(bvh.nodes);
+		writeVector(bvh.indices);
+	}
+
+	void writeMesh(const std::shared_ptr<const MeshData> &mesh) {
+		if (!writeReference(meshes, mesh.get()))
+			return;
+		writeVector(mesh->vertices);
+		writeVector(mesh->indices);
+		writeBVH(mesh->bvh);
+		writeVector(mesh->areaCdf);
+	}
+
+	// Each shape starts with its tag, its transformation and the index of its material
+	void writeShape(const Shape &shape) {
+		auto writeCommon = [&](ShapeTag tag) {
+			write(tag);
+			write(shape.transformation);
+			write((int32_t) shape.materialIndex);
+		};
+
+		if (dynamic_cast<const Sphere *>(&shape)) {
+			writeCommon(ShapeTag::SPHERE);
+		} else if (auto plane = dynamic_cast<const Plane *>(&shape)) {
+			writeCommon(ShapeTag::PLANE);
+			write((int32_t) plane->scale);
+		} else if (auto triangle = dynamic_cast<const Triangle *>(&shape)) {
+			writeCommon(ShapeTag::TRIANGLE);
+			// The vertices are already transformed
+			write(triangle->vertex(0));
+			write(triangle->vertex(1));
+			write(triangle->vertex(2));
+		} else if (auto mesh = dynamic_cast<const TriangleMesh *>(&shape)) {
+			writeCommon(ShapeTag::MESH);
+			writeMesh(mesh->mesh);
+		} else if (auto box = dynamic_cast<const Box *>(&shape)) {
+			writeCommon(ShapeTag::BOX);
+			write(box->pMin);
+			write(box->pMax);
+		} else if (auto csg = dynamic_cast<const CSGUnion *>(&shape)) {
+			writeCommon(ShapeTag::UNION);
+			writeShape(*csg->a);
+			writeShape(*csg->b);
+		} else if (auto csg = dynamic_cast<const CSGDifference *>(&shape)) {
+			writeCommon(ShapeTag::DIFFERENCE);
+			writeShape(*csg->a);
+			writeShape(*csg->b);
+		} else if (auto csg = dynamic_cast<const CSGIntersection *>(&shape)) {
+			writeCommon(ShapeTag::INTERSECTION);
+			writeShape(*csg->a);
+			writeShape(*csg->b);
+		} else {
+			throw std::runtime_error("cannot store a shape of unknown type in the scene cache");
+		}
+	}
+};
+
+/**
+ * @brief	Rebuild a scene from a snapshot written by SceneCacheWriter.
+ * @details The reader only copies the data out of the snapshot, which can therefore be a file mapped in memory.
+ * 			A std::runtime_error is thrown if the snapshot is truncated or malformed.
+ *
+ * @param data	The part of the snapshot not read yet.
+ */
+struct SceneCacheReader {
+	std::string_view data;
+	// The files read by the scene, listed in the header
+	std::vector<std::string> files;
+
+	SceneCacheReader(std::string_view data): data{data} {}
+
+	/**
+	 * @brief 	Read the header of the snapshot, returning false if it was not written by this version or for this key,
+	 * 			or if any of the files read by the scene has changed since.
+	 */
+	bool readHeader(uint64_t key) {
+		using Writer = SceneCacheWriter;
+		if (data.size() < sizeof(Writer::MAGIC) or std::memcmp(data.data(), Writer::MAGIC, sizeof(Writer::MAGIC)) != 0)
+			return false;
+		data.remove_prefix(sizeof(Writer::MAGIC));
+		if (read<uint32_t>() != Writer::VERSION or read<uint64_t>() != key)
+			return false;
+
+		int32_t nFiles = read<int32_t>();
+		for (int32_t i{}; i < nFiles; i++) {
+			std::vector<char> name{readVector<char>()};
+			files.emplace_back(name.begin(), name.end());
+			int64_t size = read<int64_t>(), time = read<int64_t>();
+			if (fileStamp(files.back()) != std::pair{size, time})
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Read the scene following the header.
+	 */
+	Scene readScene() {
+		Scene scene;
+		scene.files = files;
+		scene.camera = readCamera();
+		scene.aspectRatio = read<float>();
+
+		World &world{scene.world};
+		int32_t nMaterials = read<int32_t>();
+		for (int32_t i{}; i < nMaterials; i++) {
+			std::shared_ptr<BRDF> brdf{readBRDF()};
+			std::shared_ptr<Pigment> emittedRadiance{readPigment()};
+			world.materials.add(Material{brdf, emittedRadiance});
+		}
+
+		int32_t nShapes = read<int32_t>();
+		world.shapes.reserve(std::max(nShapes, 0));
+		for (int32_t i{}; i < nShapes; i++)
+			world.shapes.push_back(readShape(world.materials));
+
+		BVH bvh{readBVH(nShapes)};
+		std::vector<int> unbounded{readVector<int>()};
+		for (auto index : unbounded)
+			check(index >= 0 and index < nShapes);
+		world.setBVH(std::move(bvh), std::move(unbounded));
+		return scene;
+	}
+
+private:
+	std::vector<std::shared_ptr<Pigment>> pigments;
+	std::vector<std::shared_ptr<BRDF>> brdfs;
+	std::vector<std::shared_ptr<const MeshData>> meshes;
+
+	void check(bool condition) {
+		if (!condition)
+			throw std::runtime_error("corrupted scene cache");
+	}
+
+	template <typename T> T read() {
+		static_assert(std::is_trivially_copyable_v<T>);
+		check(data.size() >= sizeof(T));
+		T value;
+		std::memcpy(&value, data.data(), sizeof(T));
+		data.remove_prefix(sizeof(T));
+		return value;
+	}
+
+	template <typename T> std::vector<T> readVector() {
+		static_assert(std::is_trivially_copyable_v<T>);
+		int64_t size = read<int64_t>();
+		check(size >= 0 and (uint64_t) size <= data.size() / sizeof(T));
+		std::vector<T> values(size);
+		std::memcpy(values.data(), data.data(), size * sizeof(T));
+		data.remove_prefix(size * sizeof(T));
+		return values;
+	}
+
+	/**
+	 * @brief 	Read the index of an object in the table, returning true if the object is new and must be read next.
+	 */
+	template <typename T> bool readReference(const std::vector<T> &table, int32_t &index) {
+		index = read<int32_t>();
+		check(index >= 0 and index <= (int32_t) std::size(table));
+		return index == (int32_t) std::size(table);
+	}
+
+	std::shared_ptr<Pigment> readPigment() {
+		int32_t index;
+		if (!readReference(pigments, index))
+			return pigments[index];
+
+		std::shared_ptr<Pigment> pigment;
+		switch (read<SceneCacheWriter::PigmentTag>()) {
+		case SceneCacheWriter::PigmentTag::UNIFORM:
+			pigment = std::make_shared<UniformPigment>(read<Color>());
+			break;
+		case SceneCacheWriter::PigmentTag::CHECKERED: {
+			Color c1{read<Color>()};
+			Color c2{read<Color>()};
+			pigment = std::make_shared<CheckeredPigment>(c1, c2, read<int32_t>());
+			break;
+		}
+		case SceneCacheWriter::PigmentTag::IMAGE: {
+			HdrImage image;
+			image.width = read<int32_t>();
+			image.height = read<int32_t>();
+			image.pixels = readVector<Color>();
+			check(image.width >= 0 and image.height >= 0 and std::size(image.pixels) == (size_t) image.width * image.height);
+			pigment = std::make_shared<ImagePigment>(std::move(image));
+			break;
+		}
+		default:
+			check(false);
+		}
+		pigments.push_back(pigment);
+		return pigment;
+	}
+
+	std::shared_ptr<BRDF> readBRDF() {
+		int32_t index;
+		if (!readReference(brdfs, index))
+			return brdfs[index];
+
+		// The pigment follows the parameters, but it is needed to build the BxDF
+		BRDF::Kind kind{read<BRDF::Kind>()};
+		float first{}, second{};
+		switch (kind) {
+		case BRDF::Kind::DIFFUSE:
+			first = read<float>();
+			break;
+		case BRDF::Kind::SPECULAR:
+		case BRDF::Kind::DIELECTRIC:
+			first = read<float>();
+			second = read<float>();
+			break;
+		default:
+			check(false);
+		}
+		std::shared_ptr<Pigment> pigment{readPigment()};
+
+		std::shared_ptr<BRDF> brdf;
+		if (kind == BRDF::Kind::DIFFUSE)
+			brdf = std::make_shared<DiffusiveBRDF>(first, pigment);
+		else if (kind == BRDF::Kind::SPECULAR)
+			brdf = std::make_shared<SpecularBRDF>(second, first, pigment);
+		else
+			brdf = std::make_shared<DielectricBSDF>(first, second, pigment);
+		brdfs.push_back(brdf);
+		return brdf;
+	}
+
+	std::shared_ptr<Camera> readCamera() {
+		SceneCacheWriter::CameraTag tag{read<SceneCacheWriter::CameraTag>()};
+		Transformation transformation{read<Transformation>()};
+		float a = read<float>(), d = read<float>();
+		if (tag == SceneCacheWriter::CameraTag::PERSPECTIVE)
+			return std::make_shared<PerspectiveCamera>(a, d, transformation);
+		check(tag == SceneCacheWriter::CameraTag::ORTHOGONAL);
+		return std::make_shared<OrthogonalCamera>(a, transformation);
+	}
+
+	// Read a BVH over nPrimitives primitives, checking that it can be traversed safely
+	BVH readBVH(size_t nPrimitives) {
+		BVH bvh;
+		bvh.nodes = readVector<BVHNode>();
+		bvh.indices = readVector<int>();
+		check(bvh.isValid(nPrimitives));
+		return bvh;
+	}
+
+	std::shared_ptr<const MeshData> readMesh() {
+		int32_t index;
+		if (!readReference(meshes, index))
+			return meshes[index];
+
+		std::vector<Point> vertices{readVector<Point>()};
+		std::vector<int> indices{readVector<int>()};
+		check(indices.size() % 3 == 0);
+		for (auto vertex : indices)
+			check(vertex >= 0 and vertex < (int) std::size(vertices));
+		const size_t nTriangles = indices.size() / 3;
+		BVH bvh{readBVH(nTriangles)};
+		std::vector<float> areaCdf{readVector<float>()};
+		check(areaCdf.size() == nTriangles);
+		auto mesh = std::make_shared<const MeshData>(std::move(vertices), std::move(indices), std::move(bvh), std::move(areaCdf));
+		meshes.push_back(mesh);
+		return mesh;
+	}
+
+	std::shared_ptr<Shape> readShape(const MaterialTable &materials) {
+		SceneCacheWriter::ShapeTag tag{read<SceneCacheWriter::ShapeTag>()};
+		Transformation transformation{read<Transformation>()};
+		int32_t materialIndex = read<int32_t>();
+		check(materialIndex >= -1 and materialIndex < materials.size());
+
+		std::shared_ptr<Shape> shape;
+		switch (tag) {
+		case SceneCacheWriter::ShapeTag::SPHERE:
+			shape = std::make_shared<Sphere>(transformation, materialIndex);
+			break;
+		case SceneCacheWriter::ShapeTag::PLANE:
+			shape = std::make_shared<Plane>(transformation, materialIndex, read<int32_t>());
+			break;
+		case SceneCacheWriter::ShapeTag::TRIANGLE: {
+			Point a{read<Point>()}, b{read<Point>()}, c{read<Point>()};
+			auto triangle = std::make_shared<Triangle>(a, b, c, Transformation{}, materialIndex);
+			triangle->transformation = transformation;
+			shape = triangle;
+			break;
+		}
+		case SceneCacheWriter::ShapeTag::MESH:
+			shape = std::make_shared<TriangleMesh>(readMesh(), transformation, materialIndex);
+			break;
+		case SceneCacheWriter::ShapeTag::BOX: {
+			Point pMin{read<Point>()}, pMax{read<Point>()};
+			check(pMin.x < pMax.x and pMin.y < pMax.y and pMin.z < pMax.z);
+			shape = std::make_shared<Box>(pMin, pMax, transformation, materialIndex);
+			break;
+		}
+		case SceneCacheWriter::ShapeTag::UNION: {
+			std::shared_ptr<Shape> a{readShape(materials)};
+			shape = std::make_shared<CSGUnion>(a, readShape(materials), transformation, materialIndex);
+			break;
+		}
+		case SceneCacheWriter::ShapeTag::DIFFERENCE: {
+			std::shared_ptr<Shape> a{readShape(materials)};
+			shape = std::make_shared<CSGDifference>(a, readShape(materials), transformation, materialIndex);
+			break;
+		}
+		case SceneCacheWriter::ShapeTag::INTERSECTION: {
+			std::shared_ptr<Shape> a{readShape(materials)};
+			shape = std::make_shared<CSGIntersection>(a, readShape(materials), transformation, materialIndex);
+			break;
+		}
+		default:
+			check(false);
+		}
+		return shape;
+	}
+};
+
+/**
+ * @brief	Write the snapshot of the scene to a file.
+ * @details The snapshot is written to a temporary file which is then renamed, so that processes rendering
+ * 			the same scene at the same time never read a partially written snapshot.
+ */
+void writeSceneCache(const std::string &fileName, uint64_t key, Scene &scene) {
+	SceneCacheWriter writer;
+	writer.writeScene(scene, key);
+
+	std::string tmpName{fileName + ".tmp" + std::to_string(getpid())};
+	std::ofstream stream{tmpName, std::ios::binary};
+	stream.write(writer.data.data(), writer.data.size());
+	stream.close();
+	if (!stream or std::rename(tmpName.c_str(), fileName.c_str()) != 0) {
+		std::remove(tmpName.c_str());
+		throw std::runtime_error(fileName + ": cannot write scene cache");
+	}
+}
+
+/**
+ * @brief 	Read the snapshot of a scene from a file mapped in memory.
+ *
+ * @return	true if the scene was read, false if the file does not exist, is not a valid snapshot or was written for another key.
+ */
+bool readSceneCache(const std::string &fileName, uint64_t key, Scene &scene) {
+	try {
+		MappedFile file{fileName};
+		SceneCacheReader reader{file.view()};
+		if (!reader.readHeader(key))
+			return false;
+		scene = reader.readScene();
+		return true;
+	} catch (std::runtime_error &e) {
+		return false;
+	}
+}
+
+#endif // SCENE_CACHE_H
@@ -24,11 +24,13 @@
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <utility>
 #include <cmath>
 #include <cfloat>
 #include "geometry.h"
 #include "camera.h"
 #include "material.h"
+#include "bvh.h"
 
 struct Shape;
 
@@ -41,7 +43,9 @@ struct Shape;
  * @param surfacePoint	Point of the surface where the ray intersects the shape.
  * @param t				Distance from the origin of the ray to the intersection point.
  * @param ray			Ray that hits the shape.
- * @param shape			The @a shared_ptr<Shape> corresponding to the shape hit by the ray.
+ * @param material		Index of the material of the shape at the hit point in the MaterialTable of the World, or -1 for the default material.
+ * @param inward		Whether the ray enters the shape.
+ * @param shape			The shape of the World hit by the ray; it is set only by World, and it is nullptr otherwise.
  * 
  * @see Ray
  * @see Shape
@@ -53,15 +57,16 @@ struct HitRecord {
 	Vec2D surfacePoint;
 	float t;
 	Ray ray;
-	Material material;
+	int material = -1;
 	bool inward;
+	const Shape *shape = nullptr;
 
 	HitRecord() {}
 	HitRecord(const HitRecord &other) :	//
 		hit{other.hit}, worldPoint{other.worldPoint}, normal{other.normal}, //
 		surfacePoint{other.surfacePoint}, t{other.t}, ray{other.ray}, // 
-		material{other.material}, inward{other.inward} {}
-	HitRecord(Point worldPoint, Normal normal, Vec2D surfacePoint, float t, Ray ray, Material material, bool inward) : //
+		material{other.material}, inward{other.inward}, shape{other.shape} {}
+	HitRecord(Point worldPoint, Normal normal, Vec2D surfacePoint, float t, Ray ray, int material, bool inward) : //
 		hit{true}, worldPoint{worldPoint}, normal{normal}, surfacePoint{surfacePoint}, //
 		t{t}, ray{ray}, material{material}, inward{inward} {}
 
@@ -75,6 +80,7 @@ struct HitRecord {
 			ray = other.ray;
 			material = other.material;
 			inward = other.inward;
+			shape = other.shape;
 		}
 		return *this;
 	}	
@@ -88,11 +94,46 @@ struct HitRecord {
 	}
 };
 
+/**
+ * @brief 	The data about a hit kept while looking for the closest one, before computing its HitRecord.
+ * @details Besides t, each shape stores here what it needs to complete the hit, e.g. the face of a box
+ * 			or the triangle and the barycentric coordinates of a mesh.
+ *
+ * @param t		Distance from the origin of the ray to the intersection point.
+ * @param index	Shape-specific index, e.g. of a triangle or a face.
+ * @param u		Shape-specific coordinate, e.g. barycentric.
+ * @param v		Shape-specific coordinate, e.g. barycentric.
+ *
+ * @see Shape::intersect
+ */
+struct PendingHit {
+	float t = 0.f;
+	int index = 0;
+	float u = 0.f, v = 0.f;
+};
+
+/**
+ * @brief A point sampled on the surface of a shape, e.g. to use the shape as a light source.
+ *
+ * @param point		The sampled point, in world coordinates.
+ * @param normal	The unit normal to the surface at the point.
+ * @param uv		The surface coordinates of the point.
+ * @param pdf		The probability density of the point, per unit area in world coordinates.
+ */
+struct SurfaceSample {
+	Point point;
+	Normal normal;
+	Vec2D uv;
+	float pdf;
+};
+
 /**
  * @brief A Shape abstract struct.
  *
  * @param transformation	The transformation to be applied to the shape.
- * @param material			The material of the shape.
+ * @param materialIndex		The index of the material of the shape in the MaterialTable of the World it is added to, or -1 for the default material.
+ * 							It is chosen when the shape is built, e.g. with world.materials.add(material), so the shape must only be added
+ * 							to that World or to its copies, which copy the table too.
  * 
  * @see Sphere
  * @see Plane
@@ -104,41 +145,131 @@ struct HitRecord {
  */
 struct Shape {
 	Transformation transformation;
-	Material material;
+	int materialIndex = -1;
 
-	Shape(): Shape{Transformation{}, Material{}} {}
-	Shape(Material material): Shape{Transformation{}, material} {}
-	Shape(Transformation transformation): Shape{transformation, Material{}} {}
-	Shape(Transformation transformation, Material material): transformation{transformation}, material{material} {}
+	Shape(): Shape{Transformation{}, -1} {}
+	Shape(int materialIndex): Shape{Transformation{}, materialIndex} {}
+	Shape(Transformation transformation): Shape{transformation, -1} {}
+	Shape(Transformation transformation, int materialIndex): transformation{transformation}, materialIndex{materialIndex} {}
 
 	/**
 	 * @brief Return a HitRecord corresponding to the first intersection between the shape and the ray.
 	 */
-	virtual HitRecord rayIntersection(Ray ray) = 0;
+	virtual HitRecord rayIntersection(Ray ray) const = 0;
 
 	/**
 	 * @brief Return a vector of HitRecord corresponding to all the intersections, ordered by increasing t.
 	 */
-	virtual std::vector<HitRecord> allIntersections(Ray ray) = 0;
+	virtual std::vector<HitRecord> allIntersections(Ray ray) const = 0;
 
-	virtual bool isInner(Point p) = 0;
+	/**
+	 * @brief 	Find the first intersection with the ray, without computing normal, surface coordinates and material.
+	 * @details This is the first phase of rayIntersection: World calls it on every candidate shape,
+	 * 			and then calls completeHit only on the closest one. By default it falls back to rayIntersection.
+	 *
+	 * @param ray
+	 * @param hit	Filled with t and the data needed by completeHit, if there is an intersection.
+	 * @return true if the ray hits the shape
+	 */
+	virtual bool intersect(Ray ray, PendingHit &hit) const {
+		HitRecord record{rayIntersection(ray)};
+		hit.t = record.t;
+		return record.hit;
+	}
+
+	/**
+	 * @brief Return the HitRecord of a hit found by intersect with the same ray.
+	 */
+	virtual HitRecord completeHit(Ray ray, const PendingHit &hit) const {
+		return rayIntersection(ray);
+	}
+
+	/**
+	 * @brief 	Return true if the ray hits the shape between tmin and tmax, e.g. to test the visibility between two points.
+	 * @details It is the same as rayIntersection(ray).hit, but shapes can stop at the first hit and avoid building a HitRecord.
+	 */
+	virtual bool anyIntersection(Ray ray) const {
+		return rayIntersection(ray).hit;
+	}
+
+	virtual bool isInner(Point p) const = 0;
+
+	/**
+	 * @brief 	Return an axis-aligned box containing the whole shape, in the coordinates of its parent.
+	 * @details By default the box is infinite, meaning that the shape cannot be bounded.
+	 */
+	virtual AABB boundingBox() const {
+		return AABB::infinite();
+	}
+
+	/**
+	 * @brief Return true if points can be sampled on the surface with sampleSurface. By default they cannot.
+	 */
+	virtual bool canSampleSurface() const {
+		return false;
+	}
+
+	/**
+	 * @brief 	Sample a point on the surface of the shape.
+	 * @details Points are uniformly distributed in area before applying the transformation.
+	 */
+	virtual SurfaceSample sampleSurface(PCG &pcg) const {
+		assert(canSampleSurface());
+		return SurfaceSample{};
+	}
+
+	/**
+	 * @brief Return the probability density per unit area of sampling a point of the surface with the given (world) normal.
+	 */
+	virtual float surfacePdf(Normal normal) const {
+		return 0.f;
+	}
 
 	virtual operator std::string() = 0;
+
+protected:
+	/**
+	 * @brief Return the unit normal in world coordinates corresponding to a normal before the transformation.
+	 */
+	Normal worldNormal(Normal normal) const {
+		Vec n{(transformation * normal).toVec()};
+		n.normalize();
+		return Normal{n.x, n.y, n.z};
+	}
+
+	/**
+	 * @brief 	Return the density per unit area of a point with the given world normal,
+	 * 			when points are sampled uniformly on a surface of area objectArea before the transformation.
+	 * @details The linear part M of the transformation scales the areas around a point with unit normal n by |det M| / |M^T n|.
+	 */
+	float areaPdf(float objectArea, Normal normal) const {
+		const float (&m)[4][4] = transformation.m;
+		Vec n{normal.x, normal.y, normal.z};
+		n.normalize();
+		Vec transposed{
+			m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+			m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+			m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z};
+		float det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+			- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+		return transposed.norm() / (std::abs(det) * objectArea);
+	}
 };
 
 /**
  * @brief A unit Sphere object derived from Shape.
  * 
  * @param transformation	The transformation to be applied to the unit sphere centered at the origin.
- * @param material			The material of the sphere.
+ * @param material			The index of the material of the sphere in the MaterialTable of its World.
  * 
  * @see Shape
  */
 struct Sphere : public Shape {
 	Sphere(): Shape() {}
 	Sphere(Transformation transformation): Shape(transformation) {}
-	Sphere(Material material): Shape(material) {}
-	Sphere(Transformation transformation, Material material): Shape(transformation, material) {}
+	Sphere(int material): Shape(material) {}
+	Sphere(Transformation transformation, int material): Shape(transformation, material) {}
 
 	/**
 	 * @brief 	Return a HitRecord corresponding to the first intersection between the sphere and the ray.
@@ -147,25 +278,28 @@ struct Sphere : public Shape {
 	 * @param ray 
 	 * @return HitRecord 
 	 */
-	virtual HitRecord rayIntersection(Ray ray) override {
-		Ray invRay{transformation.inverse() * ray};
-		Vec origin{invRay.origin.toVec()}, dir{invRay.dir};
-		float delta4 = (origin.dot(dir)) * (origin.dot(dir)) -
-			dir.squaredNorm() * (origin.squaredNorm() - 1.f);
+	virtual HitRecord rayIntersection(Ray ray) const override {
+		PendingHit hit;
+		return intersect(ray, hit) ? completeHit(ray, hit) : HitRecord{};
+	}
 
-		if (delta4 <= 0.f)
-			return HitRecord{};
+	virtual bool intersect(Ray ray, PendingHit &hit) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		float t1, t2;
+		if (!intersectionTimes(invRay, t1, t2))
+			return false;
 
-		float firstHit;
-		float sqrtDelta4 = std::sqrt(delta4);
-		float t1 = (-origin.dot(dir) - sqrtDelta4) / dir.squaredNorm();
-		float t2 = (-origin.dot(dir) + sqrtDelta4) / dir.squaredNorm();
 		if (invRay.tmin < t1 and t1 < invRay.tmax)
-			return intersection(t1, ray, invRay);
+			hit.t = t1;
 		else if (invRay.tmin < t2 and t2 < invRay.tmax)
-			return intersection(t2, ray, invRay);
+			hit.t = t2;
 		else
-			return HitRecord{};
+			return false;
+		return true;
+	}
+
+	virtual HitRecord completeHit(Ray ray, const PendingHit &hit) const override {
+		return intersection(hit.t, ray, applyInverse(transformation, ray));
 	}
 
 	/**
@@ -175,20 +309,13 @@ struct Sphere : public Shape {
 	 * @param ray 
 	 * @return std::vector<HitRecord> 
 	 */
-	virtual std::vector<HitRecord> allIntersections(Ray ray) override {
-		Ray invRay{transformation.inverse() * ray};
-		Vec origin{invRay.origin.toVec()}, dir{invRay.dir};
+	virtual std::vector<HitRecord> allIntersections(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
 		std::vector<HitRecord> intersections;
-
-		float delta4 = (origin.dot(dir)) * (origin.dot(dir)) -
-			dir.squaredNorm() * (origin.squaredNorm() - 1.f);
-
-		if (delta4 <= 0.f)
+		float t1, t2;
+		if (!intersectionTimes(invRay, t1, t2))
 			return intersections;
 
-		float sqrtDelta4 = std::sqrt(delta4);
-		float t1 = (-origin.dot(dir) - sqrtDelta4) / dir.squaredNorm();
-		float t2 = (-origin.dot(dir) + sqrtDelta4) / dir.squaredNorm();
 		if (invRay.tmin < t1 and t1 < invRay.tmax)
 			intersections.push_back(intersection(t1, ray, invRay));
 		if (invRay.tmin < t2 and t2 < invRay.tmax)
@@ -197,6 +324,14 @@ struct Sphere : public Shape {
 		return intersections;
 	}
 
+	virtual bool anyIntersection(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		float t1, t2;
+		if (!intersectionTimes(invRay, t1, t2))
+			return false;
+		return (invRay.tmin < t1 and t1 < invRay.tmax) or (invRay.tmin < t2 and t2 < invRay.tmax);
+	}
+
 	/**
 	 * @brief Check if a point is inside the sphere.
 	 * 
@@ -204,11 +339,45 @@ struct Sphere : public Shape {
 	 * @return true 
 	 * @return false 
 	 */
-	virtual bool isInner(Point p) override {
-		p = transformation.inverse() * p;
+	virtual bool isInner(Point p) const override {
+		p = transformation.applyInverse(p);
 		return p.x * p.x + p.y * p.y + p.z * p.z < 1.f;
 	}
 
+	/**
+	 * @brief 	Return the bounding box of the transformed sphere.
+	 * @details The transformed sphere is an ellipsoid, whose half-extent along each axis
+	 * 			is the norm of the corresponding row of the transformation matrix.
+	 *
+	 * @return AABB
+	 */
+	virtual AABB boundingBox() const override {
+		Point center{transformation * Point{}};
+		const float (&m)[4][4] = transformation.m;
+		Vec extent{
+			Vec{m[0][0], m[0][1], m[0][2]}.norm(),
+			Vec{m[1][0], m[1][1], m[1][2]}.norm(),
+			Vec{m[2][0], m[2][1], m[2][2]}.norm()};
+		return AABB{center - extent, center + extent};
+	}
+
+	virtual bool canSampleSurface() const override {
+		return true;
+	}
+
+	virtual SurfaceSample sampleSurface(PCG &pcg) const override {
+		float z = 1.f - 2.f * pcg.randFloat();
+		float r = std::sqrt(std::max(0.f, 1.f - z * z));
+		float phi = 2.f * M_PI * pcg.randFloat();
+		Point p{r * std::cos(phi), r * std::sin(phi), z};
+		Normal normal{worldNormal(Normal{p.x, p.y, p.z})};
+		return SurfaceSample{transformation * p, normal, spherePointToUV(p), surfacePdf(normal)};
+	}
+
+	virtual float surfacePdf(Normal normal) const override {
+		return areaPdf(4.f * M_PI, normal);
+	}
+
 	virtual operator std::string() override {
 		std::ostringstream ss;
 		ss << "Sphere";
@@ -216,6 +385,25 @@ struct Sphere : public Shape {
 	}
 
 private:
+	/**
+	 * @brief Compute the values t1 < t2 of the ray parameter where the ray, in the sphere coordinates, crosses the unit sphere.
+	 *
+	 * @return false if the ray misses the sphere
+	 */
+	bool intersectionTimes(Ray invRay, float &t1, float &t2) const {
+		Vec origin{invRay.origin.toVec()}, dir{invRay.dir};
+		float delta4 = (origin.dot(dir)) * (origin.dot(dir)) -
+			dir.squaredNorm() * (origin.squaredNorm() - 1.f);
+
+		if (delta4 <= 0.f)
+			return false;
+
+		float sqrtDelta4 = std::sqrt(delta4);
+		t1 = (-origin.dot(dir) - sqrtDelta4) / dir.squaredNorm();
+		t2 = (-origin.dot(dir) + sqrtDelta4) / dir.squaredNorm();
+		return true;
+	}
+
 	/**
 	 * @brief Wrapper of intersection info.
 	 * 
@@ -224,7 +412,7 @@ private:
 	 * @param invRay 
 	 * @return HitRecord 
 	 */
-	HitRecord intersection(float t, Ray ray, Ray invRay) {
+	HitRecord intersection(float t, Ray ray, Ray invRay) const {
 		Point hitPoint{invRay(t)};
 		bool inward = !isInner(hitPoint - invRay.dir*1e-4f);
 		return HitRecord{
@@ -233,7 +421,7 @@ private:
 			spherePointToUV(hitPoint),
 			t,
 			ray,
-			material,
+			materialIndex,
 			inward};
 	}
 
@@ -244,7 +432,7 @@ private:
 	 * @param dir 		Direction of the incoming ray.
 	 * @return Normal 
 	 */
-	Normal sphereNormal(Point p, Vec dir) {
+	Normal sphereNormal(Point p, Vec dir) const {
 		Normal result{p.x, p.y, p.z};
 		return p.toVec().dot(dir) < 0. ? result : -result;
 	}
@@ -255,7 +443,7 @@ private:
 	 * @param p		3D world point.
 	 * @return Vec2D 
 	 */
-	Vec2D spherePointToUV(Point p) {
+	Vec2D spherePointToUV(Point p) const {
 		float v = std::atan2(p.y, p.x) / (float) (2 * M_PI);
 		return Vec2D{std::acos(p.z) / (float) M_PI, v>=0 ? v : v+1};
 	}
@@ -265,7 +453,7 @@ private:
  * @brief An ininite xy-plane object derived from Shape.
  * 
  * @param transformation	The transformation to be applied to the infinite xy-plane passing through the origin.
- * @param material			The material of the plane.
+ * @param material			The index of the material of the plane in the MaterialTable of its World.
  * 
  * @see Shape
  */
@@ -273,8 +461,8 @@ struct Plane : public Shape {
 	int scale;
 	Plane(): Shape() {}
 	Plane(Transformation transformation): Shape(transformation) {}
-	Plane(Material material, int scale=1): Shape(material), scale{scale} {}
-	Plane(Transformation transformation, Material material, int scale=1): Shape(transformation, material), scale{scale} {}
+	Plane(int material, int scale=1): Shape(material), scale{scale} {}
+	Plane(Transformation transformation, int material, int scale=1): Shape(transformation, material), scale{scale} {}
 
 	/**
 	 * @brief 	Return a HitRecord corresponding to the intersection between the ray and the plane.
@@ -283,27 +471,37 @@ struct Plane : public Shape {
 	 * @param ray 
 	 * @return HitRecord 
 	 */
-	virtual HitRecord rayIntersection(Ray ray) override {
-		Ray invRay{transformation.inverse() * ray};
+	virtual HitRecord rayIntersection(Ray ray) const override {
+		PendingHit hit;
+		return intersect(ray, hit) ? completeHit(ray, hit) : HitRecord{};
+	}
+
+	virtual bool intersect(Ray ray, PendingHit &hit) const override {
+		Ray invRay{applyInverse(transformation, ray)};
 		Vec origin{invRay.origin.toVec()}, dir{invRay.dir};
 		const float epsilon = 1e-5;
 
 		if (std::abs(dir.z - 0.f) < epsilon)
-			return HitRecord{};
+			return false;
 
 		float t = -origin.z / dir.z;
 		if (invRay.tmin > t or t > invRay.tmax)
-			return HitRecord{};
+			return false;
+		hit.t = t;
+		return true;
+	}
 
-		Point hitPoint{invRay(t)};
+	virtual HitRecord completeHit(Ray ray, const PendingHit &hit) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		Point hitPoint{invRay(hit.t)};
 		bool inward = !isInner(hitPoint - invRay.dir*1e-4f);
 		return HitRecord{
 			transformation * hitPoint,
 			transformation * planeNormal(hitPoint, invRay.dir),
 			planePointToUV(hitPoint),
-			t,
+			hit.t,
 			ray,
-			material,
+			materialIndex,
 			inward};
 	}
 
@@ -314,7 +512,7 @@ struct Plane : public Shape {
 	 * @param ray 
 	 * @return std::vector<HitRecord> 
 	 */
-	virtual std::vector<HitRecord> allIntersections(Ray ray) override {
+	virtual std::vector<HitRecord> allIntersections(Ray ray) const override {
 		HitRecord hit = rayIntersection(ray);
 		if (hit.hit)
 			return std::vector<HitRecord>{hit};
@@ -322,6 +520,11 @@ struct Plane : public Shape {
 			return std::vector<HitRecord>{};
 	}
 
+	virtual bool anyIntersection(Ray ray) const override {
+		PendingHit hit;
+		return intersect(ray, hit);
+	}
+
 	/**
 	 * @brief By convention, the plane inner part is the z<0 half space
 	 * 
@@ -329,11 +532,18 @@ struct Plane : public Shape {
 	 * @return true 
 	 * @return false 
 	 */
-	virtual bool isInner(Point p) override {
-		p = transformation.inverse() * p;
+	virtual bool isInner(Point p) const override {
+		p = transformation.applyInverse(p);
 		return p.z < 0;
 	}
 
+	/**
+	 * @brief Return an infinite box, as a plane cannot be bounded.
+	 */
+	virtual AABB boundingBox() const override {
+		return AABB::infinite();
+	}
+
 	virtual operator std::string() override {
 		std::ostringstream ss;
 		ss << "Plane";
@@ -349,7 +559,7 @@ private:
 	 * @param dir 
 	 * @return Normal 
 	 */
-	Normal planeNormal(Point p, Vec dir) {
+	Normal planeNormal(Point p, Vec dir) const {
 		Normal result{0.f, 0.f, 1.f};
 		return dir.z < 0. ? result : -result;
 	}
@@ -360,7 +570,7 @@ private:
 	 * @param p 
 	 * @return Vec2D 
 	 */
-	Vec2D planePointToUV(Point p) {
+	Vec2D planePointToUV(Point p) const {
 		//Move the origin of uv coords and scale up (or down) the texture map
 		Vec origin{-10.f, 10.f, -10.f};
 		Point ref = (p-origin)*(1.f/scale);
@@ -368,6 +578,93 @@ private:
 	}
 };
 
+/**
+ * @brief 	The data of a ray needed by the watertight ray-triangle intersection, computed once for all the triangles.
+ * @details The ray is translated to the origin and sheared so that its direction becomes the kz axis,
+ * 			i.e. the axis of the largest component of the direction.
+ * 			See S. Woop, C. Benthin, I. Wald, "Watertight Ray/Triangle Intersection", JCGT 2(1), 2013.
+ *
+ * @param origin		The origin of the ray.
+ * @param kx, ky, kz	The permutation of the axes.
+ * @param sx, sy, sz	The shear constants.
+ */
+struct TriangleRay {
+	Point origin;
+	int kx, ky, kz;
+	float sx, sy, sz;
+
+	TriangleRay(const Ray &ray): origin{ray.origin} {
+		const Vec &dir{ray.dir};
+		float ax = std::abs(dir.x), ay = std::abs(dir.y), az = std::abs(dir.z);
+		kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+		kx = (kz + 1) % 3;
+		ky = (kx + 1) % 3;
+		// Preserve the winding of the triangles
+		if (dir[kz] < 0.f)
+			std::swap(kx, ky);
+		sx = dir[kx] / dir[kz];
+		sy = dir[ky] / dir[kz];
+		sz = 1.f / dir[kz];
+	}
+};
+
+/**
+ * @brief 	Watertight intersection between a ray and the triangle abc.
+ * @details A ray passing through an edge or a vertex shared by several triangles hits at least one of them.
+ * 			Both sides of the triangle can be hit. Nothing is allocated.
+ *
+ * @param ray		The ray, already sheared.
+ * @param a			The first vertex.
+ * @param b			The second vertex.
+ * @param c			The third vertex.
+ * @param tmin		The lower end of the ray parameter range (excluded).
+ * @param tmax		The upper end of the ray parameter range (excluded).
+ * @param t			Set to the ray parameter of the intersection.
+ * @param beta		Set to the barycentric coordinate relative to b.
+ * @param gamma		Set to the barycentric coordinate relative to c.
+ * @return true if the ray hits the triangle.
+ */
+bool intersectTriangle(const TriangleRay &ray, const Point &a, const Point &b, const Point &c,
+		float tmin, float tmax, float &t, float &beta, float &gamma) {
+	const Point &o{ray.origin};
+	const float A[3] = {a.x - o.x, a.y - o.y, a.z - o.z};
+	const float B[3] = {b.x - o.x, b.y - o.y, b.z - o.z};
+	const float C[3] = {c.x - o.x, c.y - o.y, c.z - o.z};
+	const int kx = ray.kx, ky = ray.ky, kz = ray.kz;
+
+	// Shear the vertices so that the ray is along the z axis
+	const float ax = A[kx] - ray.sx * A[kz], ay = A[ky] - ray.sy * A[kz];
+	const float bx = B[kx] - ray.sx * B[kz], by = B[ky] - ray.sy * B[kz];
+	const float cx = C[kx] - ray.sx * C[kz], cy = C[ky] - ray.sy * C[kz];
+
+	// Scaled barycentric coordinates, as 2D edge functions
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+
+	// On an edge, recompute in double precision to get the sign right
+	if (u == 0.f or v == 0.f or w == 0.f) {
+		u = (float) ((double) cx * by - (double) cy * bx);
+		v = (float) ((double) ax * cy - (double) ay * cx);
+		w = (float) ((double) bx * ay - (double) by * ax);
+	}
+
+	if ((u < 0.f or v < 0.f or w < 0.f) and (u > 0.f or v > 0.f or w > 0.f))
+		return false;
+	const float det = u + v + w;
+	if (det == 0.f)
+		return false;
+
+	const float az = ray.sz * A[kz], bz = ray.sz * B[kz], cz = ray.sz * C[kz];
+	const float invDet = 1.f / det;
+	t = (u * az + v * bz + w * cz) * invDet;
+	if (!(tmin < t and t < tmax))
+		return false;
+	beta = v * invDet;
+	gamma = w * invDet;
+	return true;
+}
+
 /**
  * @brief A triangle object derived from Shape.
  * 
@@ -375,32 +672,38 @@ private:
  * @param B					A vertex.
  * @param C					A vertex.
  * @param transformation	The transformation to be applied to the triangle.
- * @param material			The material of the triangle.
+ * @param material			The index of the material of the triangle in the MaterialTable of its World.
  * 
  * @see Shape
  */
 struct Triangle : public Shape {
 
-	Triangle(): Shape() {}
+	Triangle(): Shape() {
+		computeNormal();
+	}
 	Triangle(Transformation transform): Shape(transform) {
 		A = transform*(this->A);
 		B = transform*(this->B);
 		C = transform*(this->C);
+		computeNormal();
 	}
-	Triangle(Transformation transform, Material material): Shape(transform, material) {
+	Triangle(Transformation transform, int material): Shape(transform, material) {
 		A = transform*(this->A);
 		B = transform*(this->B);
 		C = transform*(this->C);
+		computeNormal();
 	} 
 	Triangle(Point a, Point b, Point c, Transformation transform = Transformation{}) : Shape(transform) {
 		A = transform*a;
 		B = transform*b;
 		C = transform*c;
+		computeNormal();
 	}
-	Triangle(Point a, Point b, Point c, Transformation transform, Material material) : Shape(transform, material) {
+	Triangle(Point a, Point b, Point c, Transformation transform, int material) : Shape(transform, material) {
 		A = transform*a;
 		B = transform*b;
 		C = transform*c;
+		computeNormal();
 	}
 
 	/**
@@ -410,37 +713,26 @@ struct Triangle : public Shape {
 	 * @param ray 
 	 * @return HitRecord 
 	 */
-	virtual HitRecord rayIntersection(Ray ray) override {
-		float s[3][3] = {{(B-A).x, (C-A).x, ray.dir.x},
-						{(B-A).y, (C-A).y, ray.dir.y},
-						{(B-A).z, (C-A).z, ray.dir.z}};
-		Vec b{ray.origin-A};
-		float beta, gamma, t;
-
-		if (determinantOfMatrix(s) == 0.f)
-			return HitRecord{};
+	virtual HitRecord rayIntersection(Ray ray) const override {
+		PendingHit hit;
+		return intersect(ray, hit) ? completeHit(ray, hit) : HitRecord{};
+	}
 
-		std::vector<float> solution = findSolution(s, b);
-		if (!(ray.tmin < -solution[2] && -solution[2] < ray.tmax)
-			|| !(0 < solution[1] && solution[1] < 1)
-			|| !(0 < solution[0] && solution[0] < 1)
-			|| !(0 < 1-solution[0]-solution[1] && 1-solution[0]-solution[1] < 1)) {
-			return HitRecord{};
-		}
+	/**
+	 * @brief Find the intersection, storing the barycentric coordinates of the hit point in u and v.
+	 */
+	virtual bool intersect(Ray ray, PendingHit &hit) const override {
+		return intersectTriangle(TriangleRay{ray}, A, B, C, ray.tmin, ray.tmax, hit.t, hit.u, hit.v);
+	}
 
-		t = -solution[2];
-		gamma = solution[1];
-		beta = solution[0];
-		Point hitPoint = ray(t);
-		Vec perp = (B-A).cross(C-A);
-		Normal hitNormal = triangleNormal(perp, ray.dir);
+	virtual HitRecord completeHit(Ray ray, const PendingHit &hit) const override {
 		return HitRecord{
-			hitPoint,
-			hitNormal,
-			trianglePointToUV(beta, gamma),
-			t,
+			ray(hit.t),
+			triangleNormal(normal, ray.dir),
+			trianglePointToUV(hit.u, hit.v),
+			hit.t,
 			ray,
-			material,
+			materialIndex,
 			false};
 	}
 
@@ -451,7 +743,7 @@ struct Triangle : public Shape {
 	 * @param ray 
 	 * @return std::vector<HitRecord> 
 	 */
-	virtual std::vector<HitRecord> allIntersections(Ray ray) override {
+	virtual std::vector<HitRecord> allIntersections(Ray ray) const override {
 		HitRecord hit = rayIntersection(ray);
 		if (hit.hit)
 			return std::vector<HitRecord>{hit};
@@ -459,13 +751,54 @@ struct Triangle : public Shape {
 			return std::vector<HitRecord>{};
 	}
 
+	virtual bool anyIntersection(Ray ray) const override {
+		PendingHit hit;
+		return intersect(ray, hit);
+	}
+
 	/**
 	 * @deprecated Not implemented
 	 */
-	virtual bool isInner(Point p) override {
+	virtual bool isInner(Point p) const override {
 		return false;
 	}
 
+	/**
+	 * @brief Return the bounding box of the vertices, which are already transformed.
+	 */
+	virtual AABB boundingBox() const override {
+		AABB box;
+		box.extend(A);
+		box.extend(B);
+		box.extend(C);
+		return box;
+	}
+
+	virtual bool canSampleSurface() const override {
+		return area() > 0.f;
+	}
+
+	virtual SurfaceSample sampleSurface(PCG &pcg) const override {
+		float sqrtR = std::sqrt(pcg.randFloat()), r = pcg.randFloat();
+		float beta = sqrtR * (1.f - r), gamma = sqrtR * r;
+		Vec ab{B - A}, ac{C - A};
+		return SurfaceSample{A + ab * beta + ac * gamma, Normal{normal.x, normal.y, normal.z}, trianglePointToUV(beta, gamma), 1.f / area()};
+	}
+
+	/**
+	 * @brief The vertices are already transformed, so the density is uniform.
+	 */
+	virtual float surfacePdf(Normal normal) const override {
+		return 1.f / area();
+	}
+
+	/**
+	 * @brief Return the i-th vertex (0, 1 or 2) of the triangle, with the transformation already applied.
+	 */
+	Point vertex(int i) const {
+		return i == 0 ? A : (i == 1 ? B : C);
+	}
+
 	virtual operator std::string() override {
 		std::ostringstream ss;
 		ss << "Triangle";
@@ -475,16 +808,27 @@ struct Triangle : public Shape {
 private:
 
 	Point A{0.f, 0.f, 0.f}, B{0.f, 1.f, 0.f}, C{0.f, 0.f, 1.f};
+	// The unit normal, precomputed from the vertices
+	Vec normal;
+
+	void computeNormal() {
+		normal = (B-A).cross(C-A);
+		normal.normalize();
+	}
+
+	float area() const {
+		Vec ab{B - A}, ac{C - A};
+		return ab.cross(ac).norm() / 2.f;
+	}
 
 	/**
-	 * @brief Return the normal to the triangle at a given point, with a ray coming at a given direction.
+	 * @brief Return the normal to the triangle, with a ray coming at a given direction.
 	 * 
-	 * @param p 
+	 * @param p 	The unit normal.
 	 * @param dir 
 	 * @return Normal 
 	 */
-  	Normal triangleNormal(Vec p, Vec dir) {
-		p.normalize();
+  	Normal triangleNormal(Vec p, Vec dir) const {
 		Normal result{p.x, p.y, p.z};
 		return dir.dot(p) < 0. ? result : -result;
 	}
@@ -496,55 +840,234 @@ private:
 	 * @param gamma 
 	 * @return Vec2D 
 	 */
-	Vec2D trianglePointToUV(float beta, float gamma) {
+	Vec2D trianglePointToUV(float beta, float gamma) const {
 		return Vec2D{beta, gamma};
 	}
+};
 
-	float determinantOfMatrix(float mat[3][3]) {
-		float ans;
-		ans = mat[0][0] * (mat[1][1] * mat[2][2] - mat[2][1] * mat[1][2])
-			- mat[0][1] * (mat[1][0] * mat[2][2] - mat[1][2] * mat[2][0])
-			+ mat[0][2] * (mat[1][0] * mat[2][1] - mat[1][1] * mat[2][0]);
-		return ans;
+/**
+ * @brief 	The vertices and the triangles of a mesh, together with a BVH over the triangles.
+ * @details The data are shared by all the TriangleMesh objects built from them, e.g. the copies made by World::add
+ * 			or several instances of the same mesh with different transformations.
+ *
+ * @param vertices	The vertices of the mesh, contiguous in memory.
+ * @param indices	The indices in vertices of the vertices of each triangle, three per triangle.
+ * @param bvh		The BVH over the triangles.
+ */
+struct MeshData {
+	std::vector<Point> vertices;
+	std::vector<int> indices;
+	BVH bvh;
+	// The cumulative areas of the triangles, to sample them proportionally to their area
+	std::vector<float> areaCdf;
+
+	MeshData(std::vector<Point> vertices, std::vector<int> indices): vertices{std::move(vertices)}, indices{std::move(indices)} {
+		assert(this->indices.size() % 3 == 0);
+		std::vector<AABB> bounds(nTriangles());
+		areaCdf.resize(nTriangles());
+		float cumArea{};
+		for (int i{}; i < nTriangles(); i++) {
+			bounds[i].extend(vertex(i, 0));
+			bounds[i].extend(vertex(i, 1));
+			bounds[i].extend(vertex(i, 2));
+			cumArea += triangleNormal(i).norm() / 2.f;
+			areaCdf[i] = cumArea;
+		}
+		bvh.build(bounds);
 	}
 
 	/**
-	 * @brief Cramer method.
-	 * 
-	 * 
-	 * @param a 
-	 * @param b 
-	 * @return std::vector<float> 
-	 */
-	std::vector<float> findSolution(float a[3][3], Vec b) {
-		float coeff[3][4] = {
-			{a[0][0], a[0][1], a[0][2], b.x},
-			{a[1][0], a[1][1], a[1][2], b.y},
-			{a[2][0], a[2][1], a[2][2], b.z}
-		};
-		float m1[3][3] = {
-			{ coeff[0][3], coeff[0][1], coeff[0][2] },
-			{ coeff[1][3], coeff[1][1], coeff[1][2] },
-			{ coeff[2][3], coeff[2][1], coeff[2][2] }
-		};
-		float m2[3][3] = {
-			{ coeff[0][0], coeff[0][3], coeff[0][2] },
-			{ coeff[1][0], coeff[1][3], coeff[1][2] },
-			{ coeff[2][0], coeff[2][3], coeff[2][2] }
-		};
-		float m3[3][3] = {
-			{ coeff[0][0], coeff[0][1], coeff[0][3] },
-			{ coeff[1][0], coeff[1][1], coeff[1][3] },
-			{ coeff[2][0], coeff[2][1], coeff[2][3] }
-		};
+	 * @brief Use a BVH and areas computed beforehand, e.g. read from a scene cache, instead of computing them again.
+	 */
+	MeshData(std::vector<Point> vertices, std::vector<int> indices, BVH bvh, std::vector<float> areaCdf):
+		vertices{std::move(vertices)}, indices{std::move(indices)}, bvh{std::move(bvh)}, areaCdf{std::move(areaCdf)} {
+		assert(this->indices.size() % 3 == 0);
+	}
 
-		float D = determinantOfMatrix(a);
-		float D1 = determinantOfMatrix(m1);
-		float D2 = determinantOfMatrix(m2);
-		float D3 = determinantOfMatrix(m3);
-	
-		return std::vector<float> {D1/D, D2/D, D3/D};
-		
+	int nTriangles() const {
+		return indices.size() / 3;
+	}
+
+	/**
+	 * @brief Return the j-th vertex (0, 1 or 2) of the i-th triangle.
+	 */
+	const Point &vertex(int i, int j) const {
+		return vertices[indices[3 * i + j]];
+	}
+
+	/**
+	 * @brief Return the bounding box of the whole mesh, which is empty if the mesh has no triangles.
+	 */
+	AABB boundingBox() const {
+		return bvh.nodes.empty() ? AABB{} : bvh.nodes[0].box;
+	}
+
+	/**
+	 * @brief Return the cross product of two edges of the i-th triangle, whose norm is twice its area.
+	 */
+	Vec triangleNormal(int i) const {
+		Point a{vertex(i, 0)}, b{vertex(i, 1)}, c{vertex(i, 2)};
+		return (b - a).cross(c - a);
+	}
+
+	float area() const {
+		return areaCdf.empty() ? 0.f : areaCdf.back();
+	}
+};
+
+/**
+ * @brief 	A mesh of triangles derived from Shape.
+ * @details Unlike Triangle, the vertices are stored untransformed in a MeshData shared between copies,
+ * 			and the transformation is applied to the rays. The whole mesh has a single material.
+ *
+ * @param mesh				The vertices, triangles and BVH of the mesh.
+ * @param transformation	The transformation to be applied to the mesh.
+ * @param material			The index of the material of the mesh in the MaterialTable of its World.
+ *
+ * @see Shape
+ * @see MeshData
+ */
+struct TriangleMesh : public Shape {
+	std::shared_ptr<const MeshData> mesh;
+
+	TriangleMesh(std::shared_ptr<const MeshData> mesh, Transformation transformation = Transformation{}): Shape(transformation), mesh{mesh} {}
+	TriangleMesh(std::shared_ptr<const MeshData> mesh, Transformation transformation, int material): Shape(transformation, material), mesh{mesh} {}
+	TriangleMesh(std::vector<Point> vertices, std::vector<int> indices, Transformation transformation = Transformation{}):
+		TriangleMesh(std::make_shared<const MeshData>(std::move(vertices), std::move(indices)), transformation) {}
+	TriangleMesh(std::vector<Point> vertices, std::vector<int> indices, Transformation transformation, int material):
+		TriangleMesh(std::make_shared<const MeshData>(std::move(vertices), std::move(indices)), transformation, material) {}
+
+	/**
+	 * @brief 	Return a HitRecord corresponding to the closest intersection between the ray and the triangles of the mesh.
+	 * @details It must be inside the range ['tmin', 'tmax'].
+	 *
+	 * @param ray
+	 * @return HitRecord
+	 */
+	virtual HitRecord rayIntersection(Ray ray) const override {
+		PendingHit hit;
+		return intersect(ray, hit) ? completeHit(ray, hit) : HitRecord{};
+	}
+
+	/**
+	 * @brief Find the closest triangle hit, storing its index and the barycentric coordinates of the hit point.
+	 */
+	virtual bool intersect(Ray ray, PendingHit &hit) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		TriangleRay triangleRay{invRay};
+		float tClosest = invRay.tmax;
+		hit.index = -1;
+		mesh->bvh.traverse(invRay, tClosest, [&](int i, float &tmax) {
+			float t, beta, gamma;
+			if (intersectTriangle(i, triangleRay, invRay.tmin, tmax, t, beta, gamma)) {
+				tmax = t;
+				hit = PendingHit{t, i, beta, gamma};
+			}
+		});
+		return hit.index >= 0;
+	}
+
+	virtual HitRecord completeHit(Ray ray, const PendingHit &hit) const override {
+		return makeHitRecord(ray, applyInverse(transformation, ray), hit.index, hit.t, hit.u, hit.v);
+	}
+
+	/**
+	 * @brief 	Return a vector of HitRecords of all the intersections.
+	 * @details The records are ordered by increasing t.
+	 *
+	 * @param ray
+	 * @return std::vector<HitRecord>
+	 */
+	virtual std::vector<HitRecord> allIntersections(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		TriangleRay triangleRay{invRay};
+		std::vector<HitRecord> intersections;
+		float tmax = invRay.tmax;
+		mesh->bvh.traverse(invRay, tmax, [&](int i, float &tmax) {
+			float t, beta, gamma;
+			if (intersectTriangle(i, triangleRay, invRay.tmin, tmax, t, beta, gamma))
+				intersections.push_back(makeHitRecord(ray, invRay, i, t, beta, gamma));
+		});
+		std::sort(intersections.begin(), intersections.end());
+		return intersections;
+	}
+
+	virtual bool anyIntersection(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		TriangleRay triangleRay{invRay};
+		bool found = false;
+		float tmax = invRay.tmax;
+		mesh->bvh.traverse(invRay, tmax, [&](int i, float &tmax) {
+			float t, beta, gamma;
+			if (intersectTriangle(i, triangleRay, invRay.tmin, tmax, t, beta, gamma)) {
+				found = true;
+				// Stop the traversal
+				tmax = -std::numeric_limits<float>::infinity();
+			}
+		});
+		return found;
+	}
+
+	/**
+	 * @deprecated Not implemented, as meshes are not necessarily closed
+	 */
+	virtual bool isInner(Point p) const override {
+		return false;
+	}
+
+	virtual AABB boundingBox() const override {
+		return transformation * mesh->boundingBox();
+	}
+
+	virtual bool canSampleSurface() const override {
+		return mesh->area() > 0.f;
+	}
+
+	virtual SurfaceSample sampleSurface(PCG &pcg) const override {
+		auto it = std::upper_bound(mesh->areaCdf.begin(), mesh->areaCdf.end(), pcg.randFloat() * mesh->area());
+		int i = std::min<int>(it - mesh->areaCdf.begin(), mesh->nTriangles() - 1);
+		float sqrtR = std::sqrt(pcg.randFloat()), r = pcg.randFloat();
+		float beta = sqrtR * (1.f - r), gamma = sqrtR * r;
+		Point a{mesh->vertex(i, 0)}, b{mesh->vertex(i, 1)}, c{mesh->vertex(i, 2)};
+		Vec perp{mesh->triangleNormal(i)};
+		Normal normal{worldNormal(Normal{perp.x, perp.y, perp.z})};
+		return SurfaceSample{transformation * (a + (b - a) * beta + (c - a) * gamma), normal, Vec2D{beta, gamma}, surfacePdf(normal)};
+	}
+
+	virtual float surfacePdf(Normal normal) const override {
+		return areaPdf(mesh->area(), normal);
+	}
+
+	virtual operator std::string() override {
+		std::ostringstream ss;
+		ss << "TriangleMesh";
+		return ss.str();
+	}
+
+private:
+
+	/**
+	 * @brief Intersect the ray, in the coordinates of the mesh, with the i-th triangle.
+	 */
+	bool intersectTriangle(int i, const TriangleRay &ray, float tmin, float tmax, float &t, float &beta, float &gamma) const {
+		return ::intersectTriangle(ray, mesh->vertex(i, 0), mesh->vertex(i, 1), mesh->vertex(i, 2), tmin, tmax, t, beta, gamma);
+	}
+
+	HitRecord makeHitRecord(Ray ray, Ray invRay, int i, float t, float beta, float gamma) const {
+		const Point &a = mesh->vertex(i, 0), &b = mesh->vertex(i, 1), &c = mesh->vertex(i, 2);
+		Vec perp{Vec{b.x - a.x, b.y - a.y, b.z - a.z}.cross(Vec{c.x - a.x, c.y - a.y, c.z - a.z})};
+		perp.normalize();
+		Normal normal{perp.x, perp.y, perp.z};
+		if (invRay.dir.dot(perp) > 0.f)
+			normal = -normal;
+		return HitRecord{
+			transformation * invRay(t),
+			transformation * normal,
+			Vec2D{beta, gamma},
+			t,
+			ray,
+			materialIndex,
+			false};
 	}
 };
 
@@ -559,12 +1082,17 @@ private:
  * @see Shape.
  */
 struct CSGUnion : public Shape {
-	std::shared_ptr<Shape> a, b;
-	CSGUnion(std::shared_ptr<Shape> a, std::shared_ptr<Shape> b, Transformation transformation = Transformation{}): a{a}, b{b}, Shape(transformation) {}
+	// The children cannot change after construction, so that the boxes computed from them stay valid:
+	// shapes passed as shared pointers must not be changed through other pointers to them either
+	const std::shared_ptr<const Shape> a, b;
+	// Bounding boxes of a, b and of the whole shape, before applying the transformation
+	const AABB boxA{a->boundingBox()}, boxB{b->boundingBox()}, box{boxA.merge(boxB)};
+	CSGUnion(std::shared_ptr<Shape> a, std::shared_ptr<Shape> b, Transformation transformation = Transformation{}): Shape(transformation), a{a}, b{b} {}
+	CSGUnion(std::shared_ptr<Shape> a, std::shared_ptr<Shape> b, Transformation transformation, int material): Shape(transformation, material), a{a}, b{b} {}
 	template <class A, class B> CSGUnion(const A &a, const B &b): Shape(), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
-	template <class A, class B> CSGUnion(const A &a, const B &b, Material material): Shape(material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
+	template <class A, class B> CSGUnion(const A &a, const B &b, int material): Shape(material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
 	template <class A, class B> CSGUnion(const A &a, const B &b, Transformation transformation): Shape(transformation), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
-	template <class A, class B> CSGUnion(const A &a, const B &b, Transformation transformation, Material material): Shape(transformation, material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
+	template <class A, class B> CSGUnion(const A &a, const B &b, Transformation transformation, int material): Shape(transformation, material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
 
 	/**
 	 * @brief	Return a HitRecord corresponding to the intersection between the ray and the CSGUnion.
@@ -573,8 +1101,10 @@ struct CSGUnion : public Shape {
 	 * @param ray 
 	 * @return HitRecord 
 	 */
-	virtual HitRecord rayIntersection(Ray ray) override {
-		Ray invRay{transformation.inverse() * ray};
+	virtual HitRecord rayIntersection(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		if (!box.intersect(invRay))
+			return HitRecord{};
 
 		HitRecord hitA{a->rayIntersection(invRay)};
 		HitRecord hitB{b->rayIntersection(invRay)};
@@ -609,8 +1139,10 @@ struct CSGUnion : public Shape {
 	 * @param ray 
 	 * @return std::vector<HitRecord> 
 	 */
-	virtual std::vector<HitRecord> allIntersections(Ray ray) override {
-		Ray invRay{transformation.inverse() * ray};
+	virtual std::vector<HitRecord> allIntersections(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		if (!box.intersect(invRay))
+			return std::vector<HitRecord>{};
 		std::vector<HitRecord> hitA{a->allIntersections(invRay)};
 		std::vector<HitRecord> hitB{b->allIntersections(invRay)};
 		std::vector<HitRecord> intersections(hitA.size() + hitB.size());
@@ -625,9 +1157,23 @@ struct CSGUnion : public Shape {
 		return intersections;
 	}
 
-	virtual bool isInner(Point p) override {
-		p = transformation.inverse() * p;
-		return a->isInner(p) or b->isInner(p);
+	virtual bool anyIntersection(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		if (!box.intersect(invRay))
+			return false;
+		return a->anyIntersection(invRay) or b->anyIntersection(invRay);
+	}
+
+	virtual bool isInner(Point p) const override {
+		p = transformation.applyInverse(p);
+		return (boxA.contains(p) and a->isInner(p)) or (boxB.contains(p) and b->isInner(p));
+	}
+
+	/**
+	 * @brief Return the union of the bounding boxes of the two shapes, transformed.
+	 */
+	virtual AABB boundingBox() const override {
+		return transformation * box;
 	}
 
 	virtual operator std::string() override {
@@ -645,16 +1191,21 @@ struct CSGUnion : public Shape {
  * @param a		First shape.
  * @param b		Second shape.
  * @param transformation	The transformation to the shape.
- * @param material			The material of the shape.
+ * @param material			The index of the material of the shape in the MaterialTable of its World.
  * @see Shape.
  */
 struct CSGDifference : public Shape {
-	std::shared_ptr<Shape> a, b;
-	CSGDifference(std::shared_ptr<Shape> a, std::shared_ptr<Shape> b, Transformation transformation = Transformation{}): a{a}, b{b}, Shape(transformation) {}
+	// The children cannot change after construction, so that the boxes computed from them stay valid:
+	// shapes passed as shared pointers must not be changed through other pointers to them either
+	const std::shared_ptr<const Shape> a, b;
+	// Bounding boxes of a, b and of the whole shape, before applying the transformation
+	const AABB boxA{a->boundingBox()}, boxB{b->boundingBox()}, box{boxA};
+	CSGDifference(std::shared_ptr<Shape> a, std::shared_ptr<Shape> b, Transformation transformation = Transformation{}): Shape(transformation), a{a}, b{b} {}
+	CSGDifference(std::shared_ptr<Shape> a, std::shared_ptr<Shape> b, Transformation transformation, int material): Shape(transformation, material), a{a}, b{b} {}
 	template <class A, class B> CSGDifference(const A &a, const B &b): Shape(), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
-	template <class A, class B> CSGDifference(const A &a, const B &b, Material material): Shape(material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
+	template <class A, class B> CSGDifference(const A &a, const B &b, int material): Shape(material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
 	template <class A, class B> CSGDifference(const A &a, const B &b, Transformation transformation): Shape(transformation), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
-	template <class A, class B> CSGDifference(const A &a, const B &b, Transformation transformation, Material material): Shape(transformation, material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
+	template <class A, class B> CSGDifference(const A &a, const B &b, Transformation transformation, int material): Shape(transformation, material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
 
 	/**
 	 * @brief 	Return a HitRecord corresponding to the intersection between the ray and the CSGDifference.
@@ -663,15 +1214,18 @@ struct CSGDifference : public Shape {
 	 * @param ray 
 	 * @return HitRecord 
 	 */
-	virtual HitRecord rayIntersection(Ray ray) override {
-		Ray invRay{transformation.inverse() * ray};
+	virtual HitRecord rayIntersection(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		if (!box.intersect(invRay))
+			return HitRecord{};
 		std::vector<HitRecord> hitListA = a->allIntersections(invRay);
-		std::vector<HitRecord> hitListB = b->allIntersections(invRay);
+		// If the boxes do not overlap, no intersection with 'b' can be inside 'a'
+		std::vector<HitRecord> hitListB = boxA.overlaps(boxB) ? b->allIntersections(invRay) : std::vector<HitRecord>{};
 		HitRecord hitA{}, hitB{};
 
 		// An intersection with 'a' is also an intersection with 'a - b' iff it is not inside 'b'
 		for (auto h : hitListA) {
-			if (!b->isInner(h.worldPoint)) {
+			if (!boxB.contains(h.worldPoint) or !b->isInner(h.worldPoint)) {
 				hitA = h;
 				break;
 			}
@@ -679,7 +1233,7 @@ struct CSGDifference : public Shape {
 
 		// An intersection with 'b' is also an intersection with 'a - b' iff it is inside 'a'
 		for (auto h : hitListB) {
-			if (a->isInner(h.worldPoint)) {
+			if (boxA.contains(h.worldPoint) and a->isInner(h.worldPoint)) {
 				hitB = h;
 				break;
 			}
@@ -716,23 +1270,26 @@ struct CSGDifference : public Shape {
 	 * @param ray 
 	 * @return std::vector<HitRecord> 
 	 */
-	virtual std::vector<HitRecord> allIntersections(Ray ray) override {
-		Ray invRay{transformation.inverse() * ray};
+	virtual std::vector<HitRecord> allIntersections(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		if (!box.intersect(invRay))
+			return std::vector<HitRecord>{};
 		std::vector<HitRecord> hitListA = a->allIntersections(invRay);
-		std::vector<HitRecord> hitListB = b->allIntersections(invRay);
+		// If the boxes do not overlap, no intersection with 'b' can be inside 'a'
+		std::vector<HitRecord> hitListB = boxA.overlaps(boxB) ? b->allIntersections(invRay) : std::vector<HitRecord>{};
 		std::vector<HitRecord> validA;
 		std::vector<HitRecord> validB;
 
 
 		// An intersection with 'a' is also an intersection with 'a - b' iff it is not inside 'b'
 		for (auto h : hitListA) {
-			if (!b->isInner(h.worldPoint))
+			if (!boxB.contains(h.worldPoint) or !b->isInner(h.worldPoint))
 				validA.push_back(h);
 		}
 
 		// An intersection with 'b' is also an intersection with 'a - b' iff it is inside 'a'
 		for (auto h : hitListB) {
-			if (a->isInner(h.worldPoint))
+			if (boxA.contains(h.worldPoint) and a->isInner(h.worldPoint))
 				validB.push_back(h);
 		}
 
@@ -746,9 +1303,34 @@ struct CSGDifference : public Shape {
 		return intersections;
 	}
 
-	virtual bool isInner(Point p) override {
-		p = transformation.inverse() * p;
-		return a->isInner(p) and !b->isInner(p);
+	/**
+	 * @brief Return true if the ray hits 'a' outside 'b', or 'b' inside 'a', without sorting or transforming the hits.
+	 */
+	virtual bool anyIntersection(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		if (!box.intersect(invRay))
+			return false;
+		if (!boxA.overlaps(boxB))
+			return a->anyIntersection(invRay);
+		for (auto h : a->allIntersections(invRay))
+			if (!boxB.contains(h.worldPoint) or !b->isInner(h.worldPoint))
+				return true;
+		for (auto h : b->allIntersections(invRay))
+			if (boxA.contains(h.worldPoint) and a->isInner(h.worldPoint))
+				return true;
+		return false;
+	}
+
+	virtual bool isInner(Point p) const override {
+		p = transformation.applyInverse(p);
+		return boxA.contains(p) and a->isInner(p) and !(boxB.contains(p) and b->isInner(p));
+	}
+
+	/**
+	 * @brief Return the bounding box of the first shape, transformed, as the second one can only remove points from it.
+	 */
+	virtual AABB boundingBox() const override {
+		return transformation * box;
 	}
 
 	virtual operator std::string() override {
@@ -766,16 +1348,21 @@ struct CSGDifference : public Shape {
  * @param a		First shape.
  * @param b		Second shape.
  * @param transformation	The transformation to the shape.
- * @param material			The material of the shape.
+ * @param material			The index of the material of the shape in the MaterialTable of its World.
  * @see Shape.
  */
 struct CSGIntersection : public Shape {
-	std::shared_ptr<Shape> a, b;
-	CSGIntersection(std::shared_ptr<Shape> a, std::shared_ptr<Shape> b, Transformation transformation = Transformation{}): a{a}, b{b}, Shape(transformation) {}
+	// The children cannot change after construction, so that the boxes computed from them stay valid:
+	// shapes passed as shared pointers must not be changed through other pointers to them either
+	const std::shared_ptr<const Shape> a, b;
+	// Bounding boxes of a, b and of the whole shape, before applying the transformation
+	const AABB boxA{a->boundingBox()}, boxB{b->boundingBox()}, box{boxA.overlap(boxB)};
+	CSGIntersection(std::shared_ptr<Shape> a, std::shared_ptr<Shape> b, Transformation transformation = Transformation{}): Shape(transformation), a{a}, b{b} {}
+	CSGIntersection(std::shared_ptr<Shape> a, std::shared_ptr<Shape> b, Transformation transformation, int material): Shape(transformation, material), a{a}, b{b} {}
 	template <class A, class B> CSGIntersection(const A &a, const B &b): Shape(), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
-	template <class A, class B> CSGIntersection(const A &a, const B &b, Material material): Shape(material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
+	template <class A, class B> CSGIntersection(const A &a, const B &b, int material): Shape(material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
 	template <class A, class B> CSGIntersection(const A &a, const B &b, Transformation transformation): Shape(transformation), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
-	template <class A, class B> CSGIntersection(const A &a, const B &b, Transformation transformation, Material material): Shape(transformation, material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
+	template <class A, class B> CSGIntersection(const A &a, const B &b, Transformation transformation, int material): Shape(transformation, material), a{std::make_shared<A>(a)}, b{std::make_shared<B>(b)} {}
 
 	/**
 	 * @brief 	Return a HitRecord corresponding to the intersection between the ray and the CSGIntersection.
@@ -784,15 +1371,17 @@ struct CSGIntersection : public Shape {
 	 * @param ray 
 	 * @return HitRecord 
 	 */
-	virtual HitRecord rayIntersection(Ray ray) override {
-		Ray invRay{transformation.inverse() * ray};
+	virtual HitRecord rayIntersection(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		if (!box.intersect(invRay))
+			return HitRecord{};
 		std::vector<HitRecord> hitListA = a->allIntersections(invRay);
 		std::vector<HitRecord> hitListB = b->allIntersections(invRay);
 		HitRecord hitA{}, hitB{};
 
 		// An intersection with 'a' is also an intersection with 'a - b' iff it is inside 'b'
 		for (auto h : hitListA) {
-			if (b->isInner(h.worldPoint)) {
+			if (boxB.contains(h.worldPoint) and b->isInner(h.worldPoint)) {
 				hitA = h;
 				break;
 			}
@@ -800,7 +1389,7 @@ struct CSGIntersection : public Shape {
 
 		// An intersection with 'b' is also an intersection with 'a - b' iff it is inside 'a'
 		for (auto h : hitListB) {
-			if (a->isInner(h.worldPoint)) {
+			if (boxA.contains(h.worldPoint) and a->isInner(h.worldPoint)) {
 				hitB = h;
 				break;
 			}
@@ -837,8 +1426,10 @@ struct CSGIntersection : public Shape {
 	 * @param ray 
 	 * @return std::vector<HitRecord> 
 	 */
-	virtual std::vector<HitRecord> allIntersections(Ray ray) override {
-		Ray invRay{transformation.inverse() * ray};
+	virtual std::vector<HitRecord> allIntersections(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		if (!box.intersect(invRay))
+			return std::vector<HitRecord>{};
 		std::vector<HitRecord> hitListA = a->allIntersections(invRay);
 		std::vector<HitRecord> hitListB = b->allIntersections(invRay);
 		std::vector<HitRecord> validA;
@@ -846,13 +1437,13 @@ struct CSGIntersection : public Shape {
 
 		// An intersection with 'a' is also an intersection with 'a - b' iff it is inside 'b'
 		for (auto h : hitListA) {
-			if (b->isInner(h.worldPoint))
+			if (boxB.contains(h.worldPoint) and b->isInner(h.worldPoint))
 				validA.push_back(h);
 		}
 
 		// An intersection with 'b' is also an intersection with 'a - b' iff it is inside 'a'
 		for (auto h : hitListB) {
-			if (a->isInner(h.worldPoint))
+			if (boxA.contains(h.worldPoint) and a->isInner(h.worldPoint))
 				validB.push_back(h);
 		}
 
@@ -866,9 +1457,32 @@ struct CSGIntersection : public Shape {
 		return intersections;
 	}
 
-	virtual bool isInner(Point p) override {
-		p = transformation.inverse() * p;
-		return a->isInner(p) and b->isInner(p);
+	/**
+	 * @brief Return true if the ray hits 'a' inside 'b', or 'b' inside 'a', without sorting or transforming the hits.
+	 */
+	virtual bool anyIntersection(Ray ray) const override {
+		Ray invRay{applyInverse(transformation, ray)};
+		if (!box.intersect(invRay))
+			return false;
+		for (auto h : a->allIntersections(invRay))
+			if (boxB.contains(h.worldPoint) and b->isInner(h.worldPoint))
+				return true;
+		for (auto h : b->allIntersections(invRay))
+			if (boxA.contains(h.worldPoint) and a->isInner(h.worldPoint))
+				return true;
+		return false;
+	}
+
+	virtual bool isInner(Point p) const override {
+		p = transformation.applyInverse(p);
+		return box.contains(p) and a->isInner(p) and b->isInner(p);
+	}
+
+	/**
+	 * @brief Return the overlap of the bounding boxes of the two shapes, transformed.
+	 */
+	virtual AABB boundingBox() const override {
+		return transformation * box;
 	}
 
 	virtual operator std::string() override {
@@ -884,12 +1498,12 @@ struct CSGIntersection : public Shape {
  * @param pMin		First end of the cube diagonal.
  * @param pMax		Second end of the cube diagonal.
  * @param transformation	The transformation to the shape.
- * @param material			The material of the shape.
+ * @param material			The index of the material of the shape in the MaterialTable of its World.
  * @see Shape.
  */
 struct Box : Shape {
 	Point pMin, pMax;
-	Box(Point pMin, Point pMax, Material material): pMin{pMin}, pMax{pMax}, Shape(material) {
+	Box(Point pMin, Point pMax, int material): pMin{pMin}, pMax{pMax}, Shape(material) {
 		assert(pMin.x < pMax.x);
 		assert(pMin.y < pMax.y);
 		assert(pMin.z < pMax.z);
@@ -899,7 +1513,7 @@ struct Box : Shape {
 		assert(pMin.y < pMax.y);
 		assert(pMin.z < pMax.z);
 	}
-	Box(Point pMin, Point pMax, Transformation transformation, Material material): pMin{pMin}, pMax{pMax}, Shape(transformation, material) {
+	Box(Point pMin, Point pMax, Transformation transformation, int material): pMin{pMin}, pMax{pMax}, Shape(transformation, material) {
 		assert(pMin.x < pMax.x);
 		assert(pMin.y < pMax.y);
 		assert(pMin.z < pMax.z);
@@ -912,34 +1526,45 @@ struct Box : Shape {
 	 * @param ray 
 	 * @return HitRecord 
 	 */
-	virtual HitRecord rayIntersection(Ray ray) override {
-		Ray invRay = transformation.inverse() * ray;
-		if (!intersection(invRay))
-			return HitRecord{};
+	virtual HitRecord rayIntersection(Ray ray) const override {
+		PendingHit hit;
+		return intersect(ray, hit) ? completeHit(ray, hit) : HitRecord{};
+	}
 
-		float t;
-		Normal normal;
-		int face;
-		if (invRay.tmin < tMin and tMin < invRay.tmax) {
-			t = tMin;
-			face = faceMin;
-			normal = boxNormal(faceMin);
-		} else if (invRay.tmin < tMax and tMax < invRay.tmax) {
-			t = tMax;
-			face = faceMax;
-			normal = -boxNormal(faceMax);
+	/**
+	 * @brief Find the first intersection, storing in index the face hit, plus 6 if the ray is leaving the box.
+	 */
+	virtual bool intersect(Ray ray, PendingHit &hit) const override {
+		Ray invRay = applyInverse(transformation, ray);
+		BoxHit boxHit;
+		if (!intersection(invRay, boxHit))
+			return false;
+
+		if (invRay.tmin < boxHit.tMin and boxHit.tMin < invRay.tmax) {
+			hit.t = boxHit.tMin;
+			hit.index = boxHit.faceMin;
+		} else if (invRay.tmin < boxHit.tMax and boxHit.tMax < invRay.tmax) {
+			hit.t = boxHit.tMax;
+			hit.index = boxHit.faceMax + 6;
 		} else {
-			return HitRecord{};
+			return false;
 		}
-		Point hitPoint{invRay(t)};
+		return true;
+	}
+
+	virtual HitRecord completeHit(Ray ray, const PendingHit &hit) const override {
+		Ray invRay = applyInverse(transformation, ray);
+		int face = hit.index % 6;
+		Normal normal{hit.index < 6 ? boxNormal(face) : -boxNormal(face)};
+		Point hitPoint{invRay(hit.t)};
 		bool inward = !isInner(hitPoint - invRay.dir*1e-4f);
 		return HitRecord{
 			transformation * hitPoint,
 			transformation * normal,
 			boxPointToUV(hitPoint, face),
-			t,
+			hit.t,
 			ray,
-			material,
+			materialIndex,
 			inward
 		};
 	}
@@ -951,51 +1576,88 @@ struct Box : Shape {
 	 * @param ray 
 	 * @return std::vector<HitRecord> 
 	 */
-	virtual std::vector<HitRecord> allIntersections(Ray ray) override {
-		Ray invRay = transformation.inverse() * ray;
+	virtual std::vector<HitRecord> allIntersections(Ray ray) const override {
+		Ray invRay = applyInverse(transformation, ray);
 		std::vector<HitRecord> intersections;
 
-		if (!intersection(invRay))
+		BoxHit hit;
+		if (!intersection(invRay, hit))
 			return intersections;
 
-		if (invRay.tmin < tMin and tMin < invRay.tmax) {
-			Normal normal{boxNormal(faceMin)};
-			Point hitPoint{invRay(tMin)};
+		if (invRay.tmin < hit.tMin and hit.tMin < invRay.tmax) {
+			Normal normal{boxNormal(hit.faceMin)};
+			Point hitPoint{invRay(hit.tMin)};
 			bool inward = !isInner(hitPoint - invRay.dir*1e-4f);
 			intersections.push_back(HitRecord{
 				transformation * hitPoint,
 				transformation * normal,
-				boxPointToUV(hitPoint, faceMin),
-				tMin,
+				boxPointToUV(hitPoint, hit.faceMin),
+				hit.tMin,
 				ray,
-				material,
+				materialIndex,
 				inward
 			});
 		}
-		if (invRay.tmin < tMax and tMax < invRay.tmax) {
-			Normal normal{-boxNormal(faceMax)};
-			Point hitPoint{invRay(tMax)};
+		if (invRay.tmin < hit.tMax and hit.tMax < invRay.tmax) {
+			Normal normal{-boxNormal(hit.faceMax)};
+			Point hitPoint{invRay(hit.tMax)};
 			bool inward = !isInner(hitPoint - invRay.dir*1e-4f);
 			intersections.push_back(HitRecord{
 				transformation * hitPoint,
 				transformation * normal,
-				boxPointToUV(hitPoint, faceMax),
-				tMax,
+				boxPointToUV(hitPoint, hit.faceMax),
+				hit.tMax,
 				ray,
-				material,
+				materialIndex,
 				inward
 			});
 		}
 		return intersections;
 	}
 
-	virtual bool isInner(Point p) override {
-		p = transformation.inverse() * p;
+	virtual bool anyIntersection(Ray ray) const override {
+		PendingHit hit;
+		return intersect(ray, hit);
+	}
+
+	virtual bool isInner(Point p) const override {
+		p = transformation.applyInverse(p);
 		return pMin.x < p.x and p.x < pMax.x and
 			pMin.y < p.y and p.y < pMax.y and
 			pMin.z < p.z and p.z < pMax.z;
 	}
 
+	virtual AABB boundingBox() const override {
+		return transformation * AABB{pMin, pMax};
+	}
+
+	virtual bool canSampleSurface() const override {
+		return true;
+	}
+
+	virtual SurfaceSample sampleSurface(PCG &pcg) const override {
+		Vec size{pMax - pMin};
+		// Areas of the faces orthogonal to each axis
+		float areas[3]{size.y * size.z, size.x * size.z, size.x * size.y};
+		float r = pcg.randFloat() * (areas[0] + areas[1] + areas[2]);
+		int axis = r < areas[0] ? 0 : (r < areas[0] + areas[1] ? 1 : 2);
+		int face = pcg.randFloat() < .5f ? axis : axis + 3;
+
+		float coords[3];
+		int axis1 = (axis + 1) % 3, axis2 = (axis + 2) % 3;
+		coords[axis] = face < 3 ? pMin[axis] : pMax[axis];
+		coords[axis1] = pMin[axis1] + pcg.randFloat() * size[axis1];
+		coords[axis2] = pMin[axis2] + pcg.randFloat() * size[axis2];
+		Point p{coords[0], coords[1], coords[2]};
+		Normal normal{worldNormal(boxNormal(face))};
+		return SurfaceSample{transformation * p, normal, boxPointToUV(p, face), surfacePdf(normal)};
+	}
+
+	virtual float surfacePdf(Normal normal) const override {
+		Vec size{pMax - pMin};
+		return areaPdf(2.f * (size.y * size.z + size.x * size.z + size.x * size.y), normal);
+	}
+
 	virtual operator std::string() override {
 		std::ostringstream ss;
 		ss << "Box";
@@ -1003,10 +1665,9 @@ struct Box : Shape {
 	}
 
 private:
-	float tMin;
-	float tMax;
-
-	/* The faces of te box are as follows:
+	/**
+	 * @brief The t and face of the first (tMin, faceMin) and second (tMax, faceMax) hit of a ray with the box.
+	 * @details The faces of the box are as follows:
 	 *  0: lower yz face
 	 *  1: lower xz face
 	 *  2: lower xy face
@@ -1014,23 +1675,26 @@ private:
 	 *  4: upper xz face
 	 *  5: upper xy face
 	 */
-	int faceMin;
-	int faceMax;
+	struct BoxHit {
+		float tMin, tMax;
+		int faceMin, faceMax;
+	};
 
 	/**
 	 * @brief Returns true if the ray intersects the box, false otherwise.
-	 * @details It also sets the private members tMin, tMax, faceMin, faceMax corresponding to the first and second hit t and face, respectively.
+	 * @details It also fills hit with the t and face of the first and second hit.
 	 * 
 	 * @param invRay 
+	 * @param hit
 	 * @return true 
 	 * @return false 
 	 */
-	bool intersection(Ray invRay) {
+	bool intersection(Ray invRay, BoxHit &hit) const {
 		float t1, t2;
 		Vec origin{invRay.origin.toVec()}, dir{invRay.dir};
 		const float epsilon = 1e-5;
-		tMin = FLT_MIN;
-		tMax = FLT_MAX;
+		float tMin = FLT_MIN, tMax = FLT_MAX;
+		int faceMin{}, faceMax{};
 		for (int i{}; i < 3; i++) {
 			// Ray parallel to one of the axes
 			if (std::abs(dir[i] - 0.f) < epsilon){
@@ -1072,6 +1736,7 @@ private:
 			if (tMin > tMax)
 				return false;
 		}
+		hit = BoxHit{tMin, tMax, faceMin, faceMax};
 		return true;
 	}
 
@@ -1081,7 +1746,7 @@ private:
 	 * @param face 
 	 * @return Normal 
 	 */
-	Normal boxNormal(int face) {
+	Normal boxNormal(int face) const {
 		switch (face) {
 		case 0:
 			return Normal{-1.f, 0.f, 0.f};
@@ -1108,7 +1773,7 @@ private:
 	 * @param face 		Face hitted.
 	 * @return Vec2D 
 	 */
-	Vec2D boxPointToUV(Point hitPoint, int face) {
+	Vec2D boxPointToUV(Point hitPoint, int face) const {
 		float u, v;
 		switch (face) {
 		// u: y, v: z
@@ -1136,28 +1801,170 @@ private:
 
 /**
  * @brief This is the class containing all the shapes of the scene.
+ * @details Unless useBVH is false, the shapes with a finite bounding box are indexed by a BVH,
+ * 			which is built the first time rayIntersection is called after the list of shapes has changed.
+ * 			Since building it is not thread safe, call buildBVH before tracing rays from multiple threads.
+ * 			Shapes are immutable while tracing, so a const World can be shared by any number of threads;
+ * 			it never rebuilds the BVH, and falls back to the linear scan if the BVH is out of date.
+ * 			The hit records refer to the material of the shape hit by its index in materials.
  * 
  * @param shapes	List of shapes.
+ * @param materials	The materials of the shapes, each stored once; the shapes refer to them by index.
+ * @param useBVH	If false, rays are intersected with every shape in turn (linear scan).
  * 
  * @see Shape
+ * @see BVH
  */
 struct World {
 	std::vector<std::shared_ptr<Shape>> shapes;
+	MaterialTable materials;
+	bool useBVH = true;
+	// Indices of the shapes that emit light and whose surface can be sampled, filled by collectEmitters
+	std::vector<int> emitters;
+
 	// make it a template for any shape
 	template <class T> void add(const T &newShape){
 		shapes.push_back(std::make_shared<T>(newShape));
+		bvhIsValid = false;
+	}
+
+	/**
+	 * @brief Build the BVH over the bounding boxes of the shapes; unbounded shapes are kept aside and always tested.
+	 */
+	void buildBVH() {
+		std::vector<AABB> bounds;
+		std::vector<int> bounded;
+		unbounded.clear();
+		for (int i{}; i < std::size(shapes); i++) {
+			AABB box{shapes[i]->boundingBox()};
+			if (box.isFinite()) {
+				bounds.push_back(box);
+				bounded.push_back(i);
+			} else {
+				unbounded.push_back(i);
+			}
+		}
+		bvh.build(bounds);
+		// Store the indices of the shapes directly in the BVH
+		for (auto &index : bvh.indices)
+			index = bounded[index];
+		nIndexedShapes = std::size(shapes);
+		bvhIsValid = true;
+	}
+
+	/**
+	 * @brief Use a BVH built beforehand over the current list of shapes, e.g. read from a scene cache, instead of building it.
+	 *
+	 * @param newBVH		The BVH over the bounded shapes, whose indices refer directly to shapes.
+	 * @param newUnbounded	The indices of the shapes with an infinite bounding box.
+	 */
+	void setBVH(BVH newBVH, std::vector<int> newUnbounded) {
+		bvh = std::move(newBVH);
+		unbounded = std::move(newUnbounded);
+		nIndexedShapes = std::size(shapes);
+		bvhIsValid = true;
+	}
+
+	const BVH &getBVH() const {
+		return bvh;
+	}
+
+	const std::vector<int> &getUnbounded() const {
+		return unbounded;
+	}
+
+	/**
+	 * @brief Return true if the BVH has been built over the current list of shapes.
+	 */
+	bool isBVHUpToDate() const {
+		return bvhIsValid and nIndexedShapes == std::size(shapes);
+	}
+
+	/**
+	 * @brief Collect the shapes with an emissive material that can be sampled, for next-event estimation.
+	 */
+	void collectEmitters() {
+		emitters.clear();
+		for (int i{}; i < std::size(shapes); i++)
+			if (materials[shapes[i]->materialIndex].isEmissive() and shapes[i]->canSampleSurface())
+				emitters.push_back(i);
 	}
 
 	HitRecord rayIntersection(Ray ray) {
-		HitRecord closest{};
+		if (useBVH and !isBVHUpToDate())
+			buildBVH();
+		return std::as_const(*this).rayIntersection(ray);
+	}
+
+	HitRecord rayIntersection(Ray ray) const {
+		if (!useBVH or !isBVHUpToDate())
+			return linearRayIntersection(ray);
+
+		PendingHit closest;
+		int closestIndex = -1;
+		float tmax = ray.tmax;
+		// On equal t, prefer the shape added first, as the linear scan does
+		auto visit = [&](int i, float &tClosest) {
+			PendingHit hit;
+			if (!shapes[i]->intersect(ray, hit) or hit.t > tClosest)
+				return;
+			if (closestIndex < 0 or hit.t < closest.t or (hit.t == closest.t and i < closestIndex)) {
+				closest = hit;
+				closestIndex = i;
+				tClosest = hit.t;
+			}
+		};
+		for (int i : unbounded)
+			visit(i, tmax);
+		bvh.traverse(ray, tmax, visit);
+		return completeHit(ray, closest, closestIndex);
+	}
+
+	/**
+	 * @brief Return true if the ray hits any shape between tmin and tmax, stopping at the first hit found.
+	 */
+	bool anyIntersection(Ray ray) {
+		if (useBVH and !isBVHUpToDate())
+			buildBVH();
+		return std::as_const(*this).anyIntersection(ray);
+	}
+
+	bool anyIntersection(Ray ray) const {
+		if (!useBVH or !isBVHUpToDate()) {
+			for (auto &shape : shapes)
+				if (shape->anyIntersection(ray))
+					return true;
+			return false;
+		}
+
+		for (int i : unbounded)
+			if (shapes[i]->anyIntersection(ray))
+				return true;
+		bool found = false;
+		float tmax = ray.tmax;
+		bvh.traverse(ray, tmax, [&](int i, float &tmax) {
+			if (shapes[i]->anyIntersection(ray)) {
+				found = true;
+				// Stop the traversal
+				tmax = -std::numeric_limits<float>::infinity();
+			}
+		});
+		return found;
+	}
+
+	HitRecord linearRayIntersection(Ray ray) const {
+		PendingHit closest;
+		int closestIndex = -1;
 		for(int i{}; i < std::size(shapes); i++) {
-			HitRecord intersection = shapes[i]->rayIntersection(ray);
-			if(!intersection.hit)
+			PendingHit hit;
+			if(!shapes[i]->intersect(ray, hit))
 				continue;
-			if((!closest.hit) or (intersection.t < closest.t))
-				closest = intersection;
+			if(closestIndex < 0 or hit.t < closest.t) {
+				closest = hit;
+				closestIndex = i;
+			}
 		}
-		return closest;
+		return completeHit(ray, closest, closestIndex);
 	}
 
 	operator std::string() {
@@ -1167,6 +1974,22 @@ struct World {
 		return ss.str();
 	}
 
+private:
+	BVH bvh;
+	std::vector<int> unbounded;
+	size_t nIndexedShapes = 0;
+	bool bvhIsValid = false;
+
+	/**
+	 * @brief Compute the HitRecord of the closest hit, found on the shape of index closestIndex (negative if there is none).
+	 */
+	HitRecord completeHit(Ray ray, const PendingHit &closest, int closestIndex) const {
+		if (closestIndex < 0)
+			return HitRecord{};
+		HitRecord record{shapes[closestIndex]->completeHit(ray, closest)};
+		record.shape = shapes[closestIndex].get();
+		return record;
+	}
 };
 
 // ASSETS
@@ -1176,7 +1999,7 @@ struct World {
  * 
  * @return CSGUnion 
  */
-CSGUnion Chair(Transformation transformation, Material material){
+CSGUnion Chair(Transformation transformation, int material){
 	Box legFrontLeft{Point{-.5f, .3f, -1.5f}, Point{-.3f, .5f, -.5f}, material};
 	Box legFrontRight{Point{-.5f, .3f, -1.5f}, Point{-.3f, .5f, -.5f}, scaling(1.f, -1.f, 1.f), material};
 	CSGUnion frontLegs{legFrontLeft, legFrontRight};
@@ -1195,7 +2018,7 @@ CSGUnion Chair(Transformation transformation, Material material){
  * 
  * @return CSGIntersection
  */
-CSGIntersection Dice(Transformation transformation, Material diceMat, Material numbersMat){
+CSGIntersection Dice(Transformation transformation, int diceMat, int numbersMat){
 	Box cube{Point{-.5f, -.5f, -.5f}, Point{.5f, .5f, .5f}, diceMat};
 
 	Sphere one{translation(Vec{0.f, 0.f, -.5f})*scaling(.1f), numbersMat};
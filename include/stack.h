@@ -0,0 +1,175 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef STACK_H
+#define STACK_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <omp.h>
+#include "hdr-image.h"
+
+enum class StackMethod { mean, median };
+
+/**
+ * @brief 	Stack pfm images of the same scene, combining each component of each pixel over all the images.
+ * @details The images are read in bands of rows, so that only the samples of a few bands are held in memory at once.
+ * 			The samples of a band, i.e. the band of each image in turn, are stored in a single buffer.
+ * 			The bands are shared among the threads.
+ *
+ * @param images			The images to stack, all of the same size.
+ * @param width				The width of the images.
+ * @param height			The height of the images.
+ * @param method			Whether to take the mean or the median of the samples.
+ * @param nSigmaIterations	The number of sigma clipping iterations.
+ * @param alpha				At each sigma clipping iteration, the samples farther than alpha*sigma from their median are removed.
+ * @param maxMemory			The maximum size in bytes of the samples held at once by all the threads, unless a single row
+ * 							for each thread is larger.
+ */
+struct ImageStack {
+	std::vector<PfmReader> images;
+	int width, height;
+	StackMethod method;
+	int nSigmaIterations;
+	float alpha;
+	size_t maxMemory;
+
+	/**
+	 * @brief Read the headers of the images, checking that they all have the same size.
+	 */
+	ImageStack(const std::vector<std::string> &fileNames, StackMethod method=StackMethod::mean,
+			int nSigmaIterations=0, float alpha=2.f, size_t maxMemory=512ul << 20)
+		: method{method}, nSigmaIterations{nSigmaIterations}, alpha{alpha}, maxMemory{maxMemory} {
+		if (fileNames.empty())
+			throw std::runtime_error("no images to stack");
+		for (auto &fileName : fileNames) {
+			images.emplace_back(fileName);
+			if (images.back().width != images.front().width or images.back().height != images.front().height)
+				throw std::runtime_error(fileName + " has not the same size as " + fileNames.front());
+		}
+		width = images.front().width;
+		height = images.front().height;
+	}
+
+	/**
+	 * @brief 	Return the number of rows of the bands read by each of nThreads threads.
+	 * @details The bands are as high as maxMemory allows, but small enough to give each thread a few of them.
+	 */
+	int bandHeight(const int nThreads) const {
+		size_t rowSize = images.size() * width * sizeof(Color);
+		size_t rows = maxMemory / (nThreads * rowSize);
+		size_t rowsForBalance = (height + 4*nThreads - 1) / (4*nThreads);
+		return std::max<size_t>(1, std::min(rows, rowsForBalance));
+	}
+
+	/**
+	 * @brief Return the stacked image, computed by nThreads threads.
+	 */
+	HdrImage stack(const int nThreads=omp_get_max_threads()) const {
+		HdrImage stacked{width, height};
+		const size_t nImages = images.size();
+		const int rows = bandHeight(nThreads);
+		const int nBands = (height + rows - 1) / rows;
+		std::string error;
+
+		#pragma omp parallel num_threads(nThreads)
+		{
+			std::vector<Color> band;
+			std::vector<float> samples(nImages);
+			#pragma omp for schedule(dynamic, 1)
+			for (int b = 0; b < nBands; b++) {
+				const int y = b * rows, n = std::min(rows, height - y);
+				const size_t bandPixels = (size_t) n * width;
+				band.resize(nImages * bandPixels);
+				try {
+					for (size_t i{}; i < nImages; i++)
+						images[i].readRows(y, n, band.data() + i * bandPixels);
+				} catch (std::exception &e) {
+					#pragma omp critical(stackError)
+					error = e.what();
+					continue;
+				}
+
+				Color *out = stacked.row(y);
+				for (size_t pixel{}; pixel < bandPixels; pixel++) {
+					for (float Color::*component : {&Color::r, &Color::g, &Color::b}) {
+						for (size_t i{}; i < nImages; i++)
+							samples[i] = band[i * bandPixels + pixel].*component;
+						out[pixel].*component = combine(samples.data(), nImages);
+					}
+				}
+			}
+		}
+
+		if (!error.empty())
+			throw std::runtime_error(error);
+		return stacked;
+	}
+
+	/**
+	 * @brief 	Return the median of the n samples, reordering them. Return NaN if there are none.
+	 */
+	static float median(float *samples, const size_t n) {
+		if (n == 0)
+			return NAN;
+		float *middle = samples + n / 2;
+		std::nth_element(samples, middle, samples + n);
+		if (n % 2 != 0)
+			return *middle;
+		// The lower middle sample is the largest of the ones before middle
+		return (*std::max_element(samples, middle) + *middle) / 2.f;
+	}
+
+	/**
+	 * @brief 	Return the mean of the n samples, summed in double precision. Return NaN if there are none.
+	 */
+	static float mean(const float *samples, const size_t n) {
+		double sum{};
+		for (size_t i{}; i < n; i++)
+			sum += samples[i];
+		return n == 0 ? NAN : sum / n;
+	}
+
+	/**
+	 * @brief 	Return the stacked value of the n samples of a component, after the sigma clipping iterations.
+	 * 			The samples are reordered.
+	 */
+	float combine(float *samples, size_t n) const {
+		for (int iteration{}; iteration < nSigmaIterations and n > 0; iteration++) {
+			double m = mean(samples, n), variance{};
+			for (size_t i{}; i < n; i++)
+				variance += (samples[i] - m) * (samples[i] - m);
+			const float sigma = std::sqrt(variance / n);
+			const float med = median(samples, n);
+
+			// Remove all the outliers x for which |median - x| > alpha * sigma
+			size_t kept = std::remove_if(samples, samples + n, [&](float x) {
+				return std::abs(x - med) > alpha * sigma;
+			}) - samples;
+			// The next iterations would not remove anything either
+			if (kept == n)
+				break;
+			n = kept;
+		}
+		return method == StackMethod::mean ? mean(samples, n) : median(samples, n);
+	}
+};
+
+#endif // STACK_H
@@ -17,61 +17,38 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 
 #include <ostream>
 #include <istream>
+#include <fstream>
+#include <stdexcept>
 #include <iomanip>
 #include <cstdint>
 #include <iomanip>
 #include <string>
 #include <cstdio>
 #include <cstdarg>
+#include <cstring>
+#include <algorithm>
 #include <gd.h>
 #include <gd_errors.h>
 #include "hdr-image.h"
 
 using namespace std;
 
-static void writeFloat(ostream &stream, const float value, const Endianness endianness) {
-	// Convert "value" to a sequence of 32 bit
-	uint32_t doubleWord{*((uint32_t *)&value)};
-
-	// Extract the four bytes in "doubleWord" using bit-level operators
-	uint8_t bytes[] = {
-		static_cast<uint8_t>(doubleWord & 0xFF),
-		static_cast<uint8_t>((doubleWord >> 8) & 0xFF),
-		static_cast<uint8_t>((doubleWord >> 16) & 0xFF),
-		static_cast<uint8_t>((doubleWord >> 24) & 0xFF),
-	};
-
-	switch (endianness) {
-	case Endianness::littleEndian:
-		for (int i{}; i < 4; ++i)
-			stream << bytes[i];
-		break;
-
-	case Endianness::bigEndian:
-		for (int i{3}; i >= 0; --i)
-			stream << bytes[i];
-		break;
-	}
+// Return the byte order of the floats of this machine
+static Endianness nativeEndianness() {
+	const uint32_t one = 1;
+	return *reinterpret_cast<const uint8_t *>(&one) == 1 ? Endianness::littleEndian : Endianness::bigEndian;
 }
 
-static float readFloat(istream &stream, Endianness endianness) {
-	uint8_t bytes[4];
-
-	for (int i{}; i < 4; i++)
-		stream >> noskipws >> bytes[i];
-
-	float value = 0.f;
-	switch (endianness) {
-	case Endianness::littleEndian:
-		for (int i{}; i < 4; ++i)
-			*(uint32_t*)(&value) += ((uint32_t) bytes[i]) << (8*i);
-		break;
-	case Endianness::bigEndian:
-		for (int i{}; i < 4; ++i)
-			*(uint32_t*)(&value) += ((uint32_t) bytes[i]) << (8*(3-i));
-		break;
+// Reverse the order of the four bytes of each component of the colors
+static void swapBytes(Color *colors, size_t n) {
+	static_assert(sizeof(Color) == 3 * sizeof(uint32_t));
+	char *bytes = reinterpret_cast<char *>(colors);
+	for (size_t i{}; i < 3 * n; i++) {
+		uint32_t word;
+		memcpy(&word, bytes + 4*i, sizeof(word));
+		word = (word >> 24) | ((word >> 8) & 0xFF00) | ((word << 8) & 0xFF0000) | (word << 24);
+		memcpy(bytes + 4*i, &word, sizeof(word));
 	}
-	return value;
 }
 
 void parseImageSize(const string line, int &width, int &height) {
@@ -97,6 +74,14 @@ Endianness parseEndianness(const string line) {
 		throw InvalidPfmFileFormat("Invalid endianness specification");
 }
 
+// Check the three lines of the header of a pfm file, getting the size and the endianness of the image
+static void parseHeader(const string &magic, const string &imgSize, const string &endStr, int &width, int &height, Endianness &endianness) {
+	if (magic != "PF")
+		throw InvalidPfmFileFormat("Invalid magic in PFM file");
+	parseImageSize(imgSize, width, height);
+	endianness = parseEndianness(endStr);
+}
+
 void HdrImage::writePfm(ostream &stream, Endianness endianness) {
 	//Define the endianness to use
 	float endiannessFloat;
@@ -113,62 +98,200 @@ void HdrImage::writePfm(ostream &stream, Endianness endianness) {
 	stream	<< "PF\n" << width << ' ' << height << '\n'
 			<< fixed << setprecision(1) << endiannessFloat << '\n';
 
+	// Scanlines go from the bottom to the top, and each one is written with a single call,
+	// directly from the image unless the bytes of the floats must be swapped
+	bool swap = endianness != nativeEndianness();
+	vector<Color> swapped(swap ? width : 0);
 	for (int y{height-1}; y >= 0; y--) {
-		for (int x{}; x < width; x++) {
-			Color c = getPixel(x, y);
-			writeFloat(stream, c.r, endianness);
-			writeFloat(stream, c.g, endianness);
-			writeFloat(stream, c.b, endianness);
+		const Color *data = row(y);
+		if (swap) {
+			copy(data, data + width, swapped.begin());
+			swapBytes(swapped.data(), width);
+			data = swapped.data();
 		}
+		stream.write(reinterpret_cast<const char *>(data), width * sizeof(Color));
 	}
 }
 
 void HdrImage::readPfm(istream &stream) {
 	// Measure length of file
 	stream.seekg(0, stream.end);
-	int fileLen = stream.tellg();
+	streamoff fileLen = stream.tellg();
 	stream.seekg(0, stream.beg);
 	if (fileLen == -1)
 		throw InvalidPfmFileFormat("The file is empty!");
 
-	// Get the magic from PFM
-	string magic;
+	// Get the magic, the width and height, and the endianness from PFM
+	string magic, imgSize, endStr;
 	getline(stream, magic);
-	if (magic != "PF")
-		throw InvalidPfmFileFormat("Invalid magic in PFM file");
-	
-	// Get the width and height from PFM
-	string imgSize;
 	getline(stream, imgSize);
-	parseImageSize(imgSize, width, height);
+	getline(stream, endStr);
+	Endianness endianness;
+	parseHeader(magic, imgSize, endStr, width, height, endianness);
 
-	// Get the endianness of PFM file
-	string endStr;
+	// Checks file dimension
+	streamoff headerLen = stream.tellg();
+	if ((fileLen-headerLen) != (streamoff) width*height*3*4)
+		throw InvalidPfmFileFormat("Invalid file dimension");
+
+	// Get the actual image, reading each scanline directly in the image with a single call
+	pixels.resize(width * height);
+	for (int y{height-1}; y >= 0; y--)
+		stream.read(reinterpret_cast<char *>(row(y)), width * sizeof(Color));
+	if (endianness != nativeEndianness())
+		swapBytes(pixels.data(), pixels.size());
+}
+
+void HdrImage::readPfm(const char *data, size_t size) {
+	// Return the next line, without the newline, as getline does
+	size_t offset{};
+	auto nextLine = [&]() {
+		size_t end = offset;
+		while (end < size and data[end] != '\n')
+			end++;
+		string line{data + offset, end - offset};
+		offset = min(end + 1, size);
+		return line;
+	};
+
+	string magic{nextLine()}, imgSize{nextLine()}, endStr{nextLine()};
 	Endianness endianness;
-	getline(stream, endStr);
-	endianness = parseEndianness(endStr);
+	parseHeader(magic, imgSize, endStr, width, height, endianness);
 
 	// Checks file dimension
-	int headerLen = stream.tellg();
-	if ((fileLen-headerLen) != (width*height*3*4))
+	if (size - offset != (size_t) width*height*3*4)
 		throw InvalidPfmFileFormat("Invalid file dimension");
 
-	// Get the actual image
+	// Get the actual image, copying each scanline with a single call
 	pixels.resize(width * height);
 	for (int y{height-1}; y >= 0; y--) {
-		for (int x{}; x < width; x++) {
-			float r = readFloat(stream, endianness);
-			float g = readFloat(stream, endianness);
-			float b = readFloat(stream, endianness);
-			setPixel(x, y, Color{r, g, b});
-		}
+		memcpy(row(y), data + offset, width * sizeof(Color));
+		offset += width * sizeof(Color);
 	}
+	if (endianness != nativeEndianness())
+		swapBytes(pixels.data(), pixels.size());
+}
+
+PfmReader::PfmReader(const string &fileName) : fileName{fileName} {
+	ifstream stream{fileName, ios::binary};
+	if (!stream)
+		throw runtime_error(fileName + ": no such file or directory");
+
+	string magic, imgSize, endStr;
+	getline(stream, magic);
+	getline(stream, imgSize);
+	getline(stream, endStr);
+	parseHeader(magic, imgSize, endStr, width, height, endianness);
+
+	// Checks file dimension
+	dataOffset = stream.tellg();
+	stream.seekg(0, stream.end);
+	if (stream.tellg() - dataOffset != (streamoff) width*height*3*4)
+		throw InvalidPfmFileFormat("Invalid file dimension");
+}
+
+void PfmReader::readRows(const int y, const int n, Color *colors) const {
+	// Scanlines go from the bottom to the top, so the rows are contiguous in the file, in reverse order
+	ifstream stream{fileName, ios::binary};
+	stream.seekg(dataOffset + (streamoff) (height - y - n) * width * sizeof(Color));
+	stream.read(reinterpret_cast<char *>(colors), (streamsize) n * width * sizeof(Color));
+	if (!stream)
+		throw runtime_error(fileName + ": cannot read file");
+	for (int i{}; i < n / 2; i++)
+		swap_ranges(colors + (size_t) i*width, colors + (size_t) (i+1)*width, colors + (size_t) (n-1-i)*width);
+	if (endianness != nativeEndianness())
+		swapBytes(colors, (size_t) n * width);
 }
 
 float clamp(const float x) {
 	return x/(1+x);
 };
 
+// The rows are shared among the threads. Each row is summed on its own and the sums of the rows are added in order,
+// so the result does not depend on the number of threads.
+float HdrImage::averageLuminosity(float delta) {
+	vector<double> rowSums(height);
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++) {
+		const Color *colors = row(y);
+		double s = 0.;
+		for (int x{}; x < width; x++) {
+			Color c = colors[x];
+			s += log10(delta + c.luminosity());
+		}
+		rowSums[y] = s;
+	}
+	double s = 0.;
+	for (double rowSum : rowSums)
+		s += rowSum;
+	return pow(10., s / pixels.size());
+}
+
+void HdrImage::normalizeImage(const float factor, const float luminosity) {
+	const float scale = factor/luminosity;
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++) {
+		Color *colors = row(y);
+		#pragma omp simd
+		for (int x = 0; x < width; x++) {
+			colors[x].r *= scale;
+			colors[x].g *= scale;
+			colors[x].b *= scale;
+		}
+	}
+}
+
+void HdrImage::clampImage() {
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++) {
+		Color *colors = row(y);
+		#pragma omp simd
+		for (int x = 0; x < width; x++) {
+			colors[x].r = clamp(colors[x].r);
+			colors[x].g = clamp(colors[x].g);
+			colors[x].b = clamp(colors[x].b);
+		}
+	}
+}
+
+// The conversion of a component to 8 bits computed with pow, which GammaTable reproduces exactly
+static int gammaLevel(const float c, const float gamma) {
+	return (int) (255 * pow(c, 1./gamma));
+}
+
+GammaTable::GammaTable(float gamma) {
+	if (!(gamma > 0.f))
+		throw runtime_error{"Error: The gamma factor must be positive"};
+
+	// The conversion is monotonic, and so is the order of the bit patterns of positive floats:
+	// find the smallest component converted to each level by bisection on the bit patterns
+	thresholds[0] = 0.f;
+	const float unit = 1.f;
+	uint32_t one;
+	memcpy(&one, &unit, sizeof(one));
+	for (int k{1}; k < 256; k++) {
+		uint32_t low{}, high{one};	// gammaLevel(1) is 255
+		while (low < high) {
+			uint32_t middle = low + (high - low) / 2;
+			float c;
+			memcpy(&c, &middle, sizeof(c));
+			if (gammaLevel(c, gamma) >= k)
+				high = middle;
+			else
+				low = middle + 1;
+		}
+		memcpy(&thresholds[k], &low, sizeof(low));
+	}
+
+	int level = 0;
+	for (int i{}; i < nBuckets; i++) {
+		float c = (float) i / nBuckets;
+		while (level < 255 and c >= thresholds[level + 1])
+			level++;
+		bucketLevels[i] = level;
+	}
+}
+
 // By default, gd writes error messages on stderr.
 // We want to throw exceptions and let the caller handle them instead.
 static void errorHandler(int priority, const char *format, va_list args) {
@@ -208,24 +331,22 @@ gdImagePtr HdrImage::writeGdImage(float gamma) {
 	// Set errorHandler as the function to be called by gd if errors arise
 	gdSetErrorMethod((gdErrorMethod) errorHandler);
 
+	// Converts the components to 8 bits, applying the gamma factor
+	const GammaTable toByte{gamma};
+
 	// Create a new true color image, or throw exception on failure
 	// (On failure, the function returns NULL)
 	gdImagePtr im = gdImageCreateTrueColor(width, height);
 	if (!im)
 		throw runtime_error{"Error: Failed to create gdImage"};
 
-	// Set each pixel in the image, normalizing and applying the gamma factor
-	for (int x{}; x < width; x++) {
-		for (int y{}; y < height; y++) {
-			Color p = getPixel(x, y);
-			// Make a gd color index for the required color
-			int index = gdImageColorExact(im,
-				(int) 255 * pow(p.r, 1./gamma),
-				(int) 255 * pow(p.g, 1./gamma),
-				(int) 255 * pow(p.b, 1./gamma));
-
-			gdImageSetPixel(im, x, y, index);
-		}
+	// Write the colors directly in the rows of the true color image, one row per iteration
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++) {
+		const Color *colors = row(y);
+		int *gdRow = im->tpixels[y];
+		for (int x{}; x < width; x++)
+			gdRow[x] = gdTrueColor(toByte(colors[x].r), toByte(colors[x].g), toByte(colors[x].b));
 	}
 
 	return im;
@@ -17,12 +17,16 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 
 #include "renderer.h"
 #include "parser.h"
+#include "scene-cache.h"
+#include "mapped-file.h"
 #include "texture.h"
+#include "stack.h"
 #include "argh.h"
 
 #undef NDEBUG
 #include <cassert>
 #include <sstream>
+#include <memory>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
@@ -70,14 +74,17 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 	"	-p <string>, --projection=<string>		Projection used (default 'perspective'). Can be 'perspective' or 'orthogonal'" << endl << \
 	"	-D <value>, --angleDeg=<value>			Angle of rotation (on z axis) of the camera (default 0)." << endl << \
 	"	-A <value>, --antialiasing=<value>		Number of samples per single pixel (default 0). Must be a perfect square, e.g. 4." << endl << \
-	"	-R <renderer>, --renderer=<renderer>		Rendering algorithm (default 'path'). Can be 'path', 'debug', 'onoff', 'flat'." << endl << \
+	"	-R <renderer>, --renderer=<renderer>		Rendering algorithm (default 'path'). Can be 'path', 'iterative', 'debug', 'onoff', 'flat'." << endl << \
+	"	-L, --linearScan				Intersect each ray with every shape, instead of using a bounding volume hierarchy." << endl << \
+	"	-T <value>, --tileSize=<value>			Side in pixels of the square tiles distributed among threads (default 32)." << endl << \
 	"	-o <string>, --outfile=<string>			Filename of the output image (default 'demo.pfm')." << endl << endl << \
-	"Options for 'path' rendering algorithm:" << endl << \
+	"Options for 'path' and 'iterative' rendering algorithms:" << endl << \
 	"	-s <value>, --seed=<value>			Random number generator seed (default 42)." << endl << \
 	"	-i <value>, --initSeq=<value>			Random number generator init sequence (default 54)." << endl << \
-	"	-n <value>, --nRays=<value>			Number of rays started at each intersection (default 3)." << endl << \
+	"	-n <value>, --nRays=<value>			Number of rays started at each intersection, only for 'path' (default 3)." << endl << \
 	"	-d <value>, --depth=<value>			Max ray depth (default 4)." << endl << \
-	"	-r <value>, --roulette=<value>			Ray depth to start Russian roulette (default 3)." << endl
+	"	-r <value>, --roulette=<value>			Ray depth to start Russian roulette (default 3)." << endl << \
+	"	-E, --emitterSampling				Sample light sources directly at diffuse surfaces, only for 'iterative'." << endl
 
 #define HELP_STACK \
 	"stack: stack more pfm images representing the same scene." << endl << endl << \
@@ -87,6 +94,7 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 	"	-m <string>, --method=<string>		The stacking method (default 'mean'). Can be 'mean' or 'median'." << endl << \
 	"	-S <value>, --nSigma=<value>		Number of sigma clipping iterations (default 0)." << endl << \
 	"	-a <value>, --alpha=<value>		Sigma clipping alpha factor (consider outliers values farther than alpha*sigma from the median, default 2)." << endl << \
+	"	-M <value>, --memory=<value>		Memory in MB for the rows of the images read at once (default 512). At least a row of each image per thread is read." << endl << \
 	"	-o <string>, --outfile=<string>		Filename of the output image (default 'stack.pfm')." << endl
 
 #define HELP_RENDER \
@@ -97,18 +105,23 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 	"	-q, --quiet							Do not show rendering progress." << endl << \
 	"	-y, --dryRun							Parse scenefile, but do not render image. Useful to check correctness of scenes." << endl << \
 	"	-f <variable1:value1,variable2:value2,...>, --float=<...>	Define float variables to be used in the scenefile." << endl << \
+	"	-c <directory>, --cacheDir=<directory>				Store the parsed scene in the directory, and read it from there instead of parsing the scenefile" << endl << \
+	"									when it, the variables and the images and meshes it reads are the same." << endl << \
 	"	-w <value>, --width=<value>					Width of the final image (default 640)." << endl << \
 	"	-h <value>, --height=<value>					Height of the final image (default 480)." << endl << \
 	"	-a <value>, --aspectRatio=<value>				Aspect ratio of the final image (default width/height)." << endl << \
 	"	-A <value>, --antialiasing=<value>				Number of samples per single pixel (default 0). Must be a perfect square, e.g. 4." << endl << \
-	"	-R <renderer>, --renderer=<renderer>				Rendering algorithm (default 'path'). Can be 'path', 'debug', 'onoff', 'flat'." << endl << \
+	"	-R <renderer>, --renderer=<renderer>				Rendering algorithm (default 'path'). Can be 'path', 'iterative', 'debug', 'onoff', 'flat'." << endl << \
+	"	-L, --linearScan						Intersect each ray with every shape, instead of using a bounding volume hierarchy." << endl << \
+	"	-T <value>, --tileSize=<value>					Side in pixels of the square tiles distributed among threads (default 32)." << endl << \
 	"	-o <string>, --outfile=<string>					Filename of output image (default input filename with '.pfm' extension)." << endl << endl <<\
-	"Options for 'path' rendering algorithm:" << endl << \
+	"Options for 'path' and 'iterative' rendering algorithms:" << endl << \
 	"	-s <value>, --seed=<value>					Random number generator seed (default 42)." << endl << \
 	"	-i <value>, --initSeq=<value>					Random number generator init sequence (default 54)." << endl << \
-	"	-n <value>, --nRays=<value>					Number of rays started at each intersection (default 3)." << endl << \
+	"	-n <value>, --nRays=<value>					Number of rays started at each intersection, only for 'path' (default 3)." << endl << \
 	"	-d <value>, --depth=<value>					Max ray depth (default 4)." << endl << \
-	"	-r <value>, --roulette=<value>					Ray depth to start Russian roulette (default 3)." << endl
+	"	-r <value>, --roulette=<value>					Ray depth to start Russian roulette (default 3)." << endl << \
+	"	-E, --emitterSampling						Sample light sources directly at diffuse surfaces, only for 'iterative'." << endl
 
 using namespace std;
 
@@ -126,7 +139,7 @@ int main(int argc, char *argv[])
 
 	cmdl.add_params({"-a", "--afactor", "--alpha", "--aspectRatio",
 			 "-g", "--gamma",
-			 "-c", "--compression",
+			 "-c", "--compression", "--cacheDir",
 			 "-q", "--quality",
 			 "-l", "--luminosity",
 			 "-w", "--width",
@@ -134,6 +147,7 @@ int main(int argc, char *argv[])
 			 "-p", "--projection",
 			 "-D", "--angleDeg",
 			 "-A", "--antialiasing",
+			 "-T", "--tileSize",
 			 "-n", "--nRays",
 			 "-d", "--depth",
 			 "-r", "--roulette",
@@ -143,7 +157,8 @@ int main(int argc, char *argv[])
 			 "-i", "--initSeq",
 			 "-f", "--float", "--format",
 			 "-S", "--nSigma",
-			 "-m", "--method"});
+			 "-m", "--method",
+			 "-M", "--memory"});
 	cmdl.parse(argc, argv);
 
 	const string programName = cmdl[0];
@@ -292,14 +307,16 @@ int demo(argh::parser cmdl)
 	float aspectRatio;
 	cmdl({"-a", "--aspectRatio"},  (float) width / height) >> aspectRatio;
 	
-	Material sky{DiffusiveBRDF{UniformPigment{WHITE}}, UniformPigment{WHITE}};
-	Material ground{DiffusiveBRDF{CheckeredPigment{Color{.2f, .5f, .1f}, Color{.8, .5, .9}, 8}}};
+	// The shapes refer to the materials by their index in the table of the world
+	World world;
+	int sky = world.materials.add(Material{DiffusiveBRDF{UniformPigment{WHITE}}, UniformPigment{WHITE}});
+	int ground = world.materials.add(Material{DiffusiveBRDF{CheckeredPigment{Color{.2f, .5f, .1f}, Color{.8, .5, .9}, 8}}});
 	
-	Material dice{DiffusiveBRDF{UniformPigment{Color{0.8, 0.8, 0.8}}}};
-	Material numbers{SpecularBRDF{0.5, UniformPigment{Color{0.2, 0.3, 0.2}}}};
+	int dice = world.materials.add(Material{DiffusiveBRDF{UniformPigment{Color{0.8, 0.8, 0.8}}}});
+	int numbers = world.materials.add(Material{SpecularBRDF{0.5, UniformPigment{Color{0.2, 0.3, 0.2}}}});
 
-	Material box{DielectricBSDF{1.5, 0.1, UniformPigment{Color{0.5, 0.5, 0.5}}}};
-	Material sphere{DiffusiveBRDF{UniformPigment{Color{0.9, 0.1, 0.1}}}};
+	int box = world.materials.add(Material{DielectricBSDF{1.5, 0.1, UniformPigment{Color{0.5, 0.5, 0.5}}}});
+	int sphere = world.materials.add(Material{DiffusiveBRDF{UniformPigment{Color{0.9, 0.1, 0.1}}}});
 
 	int seed;
 	cmdl({"-s", "--seed"}, 42) >> seed;
@@ -322,7 +339,6 @@ int demo(argh::parser cmdl)
 	}
 
 	HdrImage image{width, height};
-	World world;
 
 	world.add(CSGUnion{
 		Box{Point{-.5, -.5, -1}, Point{.5, .5, 0}, translation(Vec{0, -1, 0}) * rotationZ(45*M_PI/180), box},
@@ -335,6 +351,7 @@ int demo(argh::parser cmdl)
 
 	world.add(Plane{translation(Vec{0, 0, -1}), ground});
 	world.add(Sphere{scaling(10), sky});
+	world.useBVH = not cmdl[{"-L", "--linearScan"}];
 
 	int samplesPerPixel;
 	cmdl({"-A", "--antialiasing"}, 0) >> samplesPerPixel;
@@ -343,8 +360,15 @@ int demo(argh::parser cmdl)
 		cerr << "Not a perfect square given as --antialiasing parameter."  <<endl;
 		return 1;
 	}
-	ImageTracer tracer{image, *cam, samplesPerSide};
+
+	int tileSize;
+	cmdl({"-T", "--tileSize"}, 32) >> tileSize;
+	if (tileSize <= 0) {
+		cerr << "Error: --tileSize must be positive." << endl;
+		return 1;
+	}
 	PCG pcg{(uint64_t) seed, (uint64_t) initSequence};
+	ImageTracer tracer{image, *cam, samplesPerSide, tileSize, pcg};
 
 	int nRays;
 	cmdl({"-n", "--nRays"}, 3) >> nRays;
@@ -352,6 +376,7 @@ int demo(argh::parser cmdl)
 	cmdl({"-d", "--depth"}, 4) >> depth;
 	int roulette;
 	cmdl({"-r", "--roulette"}, 3) >> roulette;
+	bool emitterSampling = cmdl[{"-E", "--emitterSampling"}];
 
 	string renderer;
 	cmdl({"-R", "--renderer"}, "path") >> renderer;
@@ -359,6 +384,8 @@ int demo(argh::parser cmdl)
 	bool verbose = not cmdl[{"-q", "--quiet"}];
 	if (renderer == "path")
 		tracer.fireAllRays(PathTracer{world, pcg, nRays, depth, roulette}, verbose);
+	else if (renderer == "iterative")
+		tracer.fireAllRays(IterativePathTracer{world, pcg, depth, roulette, emitterSampling}, verbose);
 	else if (renderer == "debug")
 		tracer.fireAllRays(DebugRenderer{world}, verbose);
 	else if (renderer == "onoff")
@@ -412,15 +439,25 @@ int render(argh::parser cmdl)
 	if (samplesPerPixel != samplesPerSide*samplesPerSide){
 		cerr << "Not a perfect square given as --antialiasing parameter."  <<endl;
 		return 1;
+	}
+
+	int tileSize;
+	cmdl({"-T", "--tileSize"}, 32) >> tileSize;
+	if (tileSize <= 0) {
+		cerr << "Error: --tileSize must be positive." << endl;
+		return 1;
 	} 
 
 	string ifilename = cmdl[2];
-	ifstream ifile{ifilename};
-	if (!ifile.is_open()) {
+	// The tokens read by the parser point into the mapped file, so it must stay mapped while parsing
+	unique_ptr<MappedFile> ifile;
+	try {
+		ifile = make_unique<MappedFile>(ifilename);
+	} catch (runtime_error &e) {
 		cerr << "Cannot open file " + cmdl[2] << endl;
 		return 1;
 	}
-	InputStream input{ifile, cmdl[2]};
+	InputStream input{ifile->view(), cmdl[2]};
 
 	int nRays;
 	cmdl({"-n", "--nRays"}, 3) >> nRays;
@@ -428,6 +465,7 @@ int render(argh::parser cmdl)
 	cmdl({"-d", "--depth"}, 4) >> depth;
 	int roulette;
 	cmdl({"-r", "--roulette"}, 3) >> roulette;
+	bool emitterSampling = cmdl[{"-E", "--emitterSampling"}];
 
 	string renderer;
 	cmdl({"-R", "--renderer"}, "path") >> renderer;
@@ -461,17 +499,36 @@ int render(argh::parser cmdl)
 			return 1;
 		}
 	}
+	string cacheDir;
+	cmdl({"-c", "--cacheDir"}, string{}) >> cacheDir;
+
 	try {
-		Scene scene{input.parseScene(variables, aspectRatio)};
+		Scene scene;
+		uint64_t key{sceneCacheKey(ifile->view(), variables, aspectRatio)};
+		ostringstream cacheFilename;
+		cacheFilename << cacheDir << "/" << baseFilename(ifilename) << "-" << hex << setw(16) << setfill('0') << key << ".scene";
+		if (cacheDir.empty() or !readSceneCache(cacheFilename.str(), key, scene)) {
+			scene = input.parseScene(variables, aspectRatio);
+			if (!cacheDir.empty()) {
+				try {
+					writeSceneCache(cacheFilename.str(), key, scene);
+				} catch (runtime_error &e) {
+					cerr << "Warning: " << e.what() << endl;
+				}
+			}
+		}
+		scene.world.useBVH = not cmdl[{"-L", "--linearScan"}];
 		HdrImage image{width, height};
-		ImageTracer tracer{image, *scene.camera, samplesPerSide};
 		PCG pcg{(uint64_t) seed, (uint64_t) initSequence};
+		ImageTracer tracer{image, *scene.camera, samplesPerSide, tileSize, pcg};
 
 		if (cmdl[{"-y", "--dryRun"}])
 			return 0;
 
 		if (renderer == "path")
 			tracer.fireAllRays(PathTracer{scene.world, pcg, nRays, depth, roulette}, verbose);
+		else if (renderer == "iterative")
+			tracer.fireAllRays(IterativePathTracer{scene.world, pcg, depth, roulette, emitterSampling}, verbose);
 		else if (renderer == "debug")
 			tracer.fireAllRays(DebugRenderer{scene.world}, verbose);
 		else if (renderer == "onoff")
@@ -524,109 +581,28 @@ int stackPfm(argh::parser cmdl)
 	cmdl({"-S", "--nSigma"}, 0) >> nSigmaIterations;
 	float alpha;
 	cmdl({"-a", "--alpha"}, 2.) >> alpha;
+	int maxMemory;
+	cmdl({"-M", "--memory"}, 512) >> maxMemory;
+	if (maxMemory <= 0) {
+		cerr << "Error: the memory must be positive." << endl;
+		return 1;
+	}
+
+	vector<string> fileNames;
+	for (int i{2}; i < cmdl.size(); i++)
+		fileNames.push_back(cmdl[i]);
 
-	HdrImage firstImg;
+	// The images are read and stacked in bands of rows, so they are never held in memory all at once
+	HdrImage stackedImage;
 	try {
-		firstImg.readPfm(cmdl[2]);
+		ImageStack stack{fileNames, method == "mean" ? StackMethod::mean : StackMethod::median,
+			nSigmaIterations, alpha, (size_t) maxMemory << 20};
+		stackedImage = stack.stack();
 	} catch (exception &e) {
 		cerr << "Error: " <<  e.what() << endl;
 		return 1;
 	}
 
-	const int width = firstImg.width, height = firstImg.height;
-	HdrImage stackedImage{width, height};
-
-	// Make a vector for the pixels, each element of which contains a vector for the 3 colors, each element of which contains a vector for the images.
-	// i.e.: imgVector[pixel][color][image] is the value of the color "color" at pixel "pixel" for the image "image".
-	// We don't use the Color struct because we need to treat each color for each pixel for each image independently, to sort and remove them.
-	vector<vector<vector<float>>> imgVector{static_cast<size_t>(height * width)};
-
-	// Each pixel is a vector of three colors.
-	for (int pixel{}; pixel < height * width; pixel++)
-		imgVector[pixel].resize(3);
-
-	// Process each image in sequence.
-	for (int i{2}; i < cmdl.size(); i++) {
-		HdrImage img;
-		string imageName = cmdl[i];
-
-		try {
-			img.readPfm(imageName);
-		} catch (exception &e) {
-			cerr << "Error: " <<  e.what() << endl;
-			return 1;
-		}
-
-		// All the images to stack must have the same height and width.
-		if (img.width != width or img.height != height) {
-			cerr << "Error: " << imageName << " has not the same size as " << cmdl[2] << endl;
-			return 1;
-		}
-
-		// Add the 3 colors of all the pixels of the image to imgVector, keeping each [pixel][color] vector (containing all the images) sorted.
-		for (int pixel{}; pixel < height * width; pixel++) {
-			for (int color{}; color < 3; color++) {
-				imgVector[pixel][color].push_back(img.pixels[pixel][color]);
-				inplace_merge(imgVector[pixel][color].begin(), imgVector[pixel][color].end() - 1, imgVector[pixel][color].end());
-			}
-		}
-	}
-
-	for (int i{}; i < nSigmaIterations; i++) {
-		for (int pixel{}; pixel < height * width; pixel++) {
-			for (int color{}; color < 3; color++) {
-				auto &images = imgVector[pixel][color];
-				size_t size = images.size();
-
-				// Compute sigma
-				float mean{}, mean2{};
-				for (int img{}; img < size; img++) {
-					mean += images[img];
-					mean2 += images[img] * images[img];
-				}
-				mean /= (float) size;
-				mean2 /= (float) size;
-				float sigma = sqrt(mean2 - mean * mean);
-
-				// Compute median
-				float median;
-				if (size % 2 == 0)
-					median = (images[size / 2 - 1] + images[size / 2]) / 2.f;
-				else
-					median = images[size / 2];
-
-				// Remove all the outliers x for which |median - x| > alpha * sigma
-				for (auto it{images.begin()}; it != images.end(); ) {
-					if (abs(*it - median) > alpha * sigma)
-						it = images.erase(it);
-					else
-						it++;
-				}
-			}
-		}
-	}
-
-	if (method == "mean") {
-		for (int pixel{}; pixel < height * width; pixel++) {
-			for (int color{}; color < 3; color++) {
-				size_t size = imgVector[pixel][color].size();
-				for (int img{}; img < size; img++)
-					stackedImage.pixels[pixel][color] += imgVector[pixel][color][img];
-				stackedImage.pixels[pixel][color] /= (float) size;
-			}
-		}
-	} else if (method == "median") {
-		for (int pixel{}; pixel < height * width; pixel++) {
-			for (int color{}; color < 3; color++) {
-				size_t size = imgVector[pixel][color].size();
-				if (size % 2 == 0)
-					stackedImage.pixels[pixel][color] = (imgVector[pixel][color][size / 2 - 1] + imgVector[pixel][color][size / 2]) / 2.f;
-				else
-					stackedImage.pixels[pixel][color] = imgVector[pixel][color][size / 2];
-			}
-		}
-	}
-
 	ofstream outPfm;
 	outPfm.open(ofilename);
 	stackedImage.writePfm(outPfm);
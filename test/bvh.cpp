@@ -0,0 +1,157 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "bvh.h"
+#include "random.h"
+#undef NDEBUG
+#include <cassert>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+void testAABB()
+{
+	AABB empty;
+	assert(empty.isEmpty());
+	assert(!empty.isFinite());
+	assert(!AABB::infinite().isFinite());
+
+	AABB box{Point{-1.f, -2.f, -3.f}, Point{1.f, 2.f, 3.f}};
+	assert(box.isFinite());
+	assert(empty.merge(box) == box);
+	assert((box.centroid() == Point{0.f, 0.f, 0.f}));
+	assert(box.surfaceArea() == 2.f * (2.f * 4.f + 4.f * 6.f + 6.f * 2.f));
+	assert(box.largestAxis() == 2);
+
+	AABB other{Point{0.f, 0.f, 0.f}, Point{5.f, 1.f, 1.f}};
+	assert((box.merge(other) == AABB{Point{-1.f, -2.f, -3.f}, Point{5.f, 2.f, 3.f}}));
+
+	assert(box.contains(Point{1.f, 0.f, -3.f}));
+	assert(!box.contains(Point{1.1f, 0.f, 0.f}));
+	assert(box.overlaps(other));
+	assert((box.overlap(other) == AABB{Point{0.f, 0.f, 0.f}, Point{1.f, 1.f, 1.f}}));
+	assert(!box.overlaps(AABB{Point{2.f, 0.f, 0.f}, Point{3.f, 1.f, 1.f}}));
+
+	// Slab test
+	assert(box.intersect(Ray{Point{-5.f, 0.f, 0.f}, Vec{1.f, 0.f, 0.f}}));
+	assert(box.intersect(Ray{Point{0.f, 0.f, 0.f}, Vec{0.f, 0.f, 1.f}}));
+	assert(!box.intersect(Ray{Point{-5.f, 0.f, 0.f}, Vec{-1.f, 0.f, 0.f}}));
+	assert(!box.intersect(Ray{Point{-5.f, 5.f, 0.f}, Vec{1.f, 0.f, 0.f}}));
+	assert(!box.intersect(Ray{Point{-5.f, 0.f, 0.f}, Vec{1.f, 0.f, 0.f}, 0, 1e-5f, 2.f}));
+	// Empty boxes are never hit
+	assert(!empty.intersect(Ray{Point{-5.f, 0.f, 0.f}, Vec{1.f, 0.f, 0.f}}));
+	assert(!AABB(Point{1.f, 1.f, 1.f}, Point{0.f, 0.f, 0.f}).intersect(Ray{Point{-5.f, .5f, .5f}, Vec{1.f, 0.f, 0.f}}));
+	// Flat box, e.g. the bounding box of a triangle lying on the xy plane
+	AABB flat{Point{0.f, 0.f, 0.f}, Point{1.f, 1.f, 0.f}};
+	assert(flat.intersect(Ray{Point{.5f, .5f, 1.f}, Vec{0.f, 0.f, -1.f}}));
+	assert(!flat.intersect(Ray{Point{1.5f, .5f, 1.f}, Vec{0.f, 0.f, -1.f}}));
+
+	// Transformations
+	AABB unit{Point{0.f, 0.f, 0.f}, Point{1.f, 1.f, 1.f}};
+	assert((translation(Vec{1.f, 2.f, 3.f}) * unit == AABB{Point{1.f, 2.f, 3.f}, Point{2.f, 3.f, 4.f}}));
+	assert((scaling(2.f, -1.f, 1.f) * unit == AABB{Point{0.f, -1.f, 0.f}, Point{2.f, 0.f, 1.f}}));
+	assert((rotationZ(M_PI_2) * unit == AABB{Point{-1.f, 0.f, 0.f}, Point{0.f, 1.f, 1.f}}));
+	assert(!(translation(Vec{1.f, 2.f, 3.f}) * AABB::infinite()).isFinite());
+}
+
+// Check that the BVH visits at least all the boxes hit by each ray
+void testBVHTraversal()
+{
+	PCG pcg;
+	vector<AABB> boxes;
+	for (int i{}; i < 500; i++) {
+		Point p{20.f * pcg.randFloat() - 10.f, 20.f * pcg.randFloat() - 10.f, 20.f * pcg.randFloat() - 10.f};
+		Vec size{pcg.randFloat(), pcg.randFloat(), pcg.randFloat()};
+		boxes.push_back(AABB{p, p + size});
+	}
+	BVH bvh{boxes};
+
+	// Every primitive is in exactly one leaf
+	vector<int> sorted{bvh.indices};
+	sort(sorted.begin(), sorted.end());
+	for (int i{}; i < (int) boxes.size(); i++)
+		assert(sorted[i] == i);
+
+	for (int i{}; i < 200; i++) {
+		Ray ray{Point{0.f, 0.f, 0.f}, Vec{pcg.randFloat() - .5f, pcg.randFloat() - .5f, pcg.randFloat() - .5f}};
+		vector<bool> visited(boxes.size(), false);
+		float tmax = ray.tmax;
+		bvh.traverse(ray, tmax, [&](int index, float &) {
+			visited[index] = true;
+		});
+		for (int j{}; j < (int) boxes.size(); j++)
+			if (boxes[j].intersect(ray))
+				assert(visited[j]);
+	}
+
+	BVH emptyBVH{vector<AABB>{}};
+	float tmax = 1.f;
+	emptyBVH.traverse(Ray{}, tmax, [](int, float &) {
+		assert(false);
+	});
+}
+
+// Trees with ranges or children out of bounds cannot be traversed safely
+void testBVHValidity()
+{
+	PCG pcg;
+	vector<AABB> boxes;
+	for (int i{}; i < 100; i++) {
+		Point p{10.f * pcg.randFloat(), 10.f * pcg.randFloat(), 10.f * pcg.randFloat()};
+		boxes.push_back(AABB{p, p + Vec{1.f, 1.f, 1.f}});
+	}
+	const BVH bvh{boxes};
+	assert(bvh.isValid(boxes.size()));
+	assert(BVH{}.isValid(0));
+	assert(!bvh.isValid(boxes.size() - 1));
+
+	int leaf = find_if(bvh.nodes.begin(), bvh.nodes.end(), [](const BVHNode &node) { return node.count > 0; }) - bvh.nodes.begin();
+	assert(bvh.nodes[0].count == 0);
+	auto tampered = [&bvh](int node, int first, int count, int axis) {
+		BVH other{bvh};
+		other.nodes[node].first = first;
+		other.nodes[node].count = count;
+		other.nodes[node].axis = axis;
+		return other.isValid(100);
+	};
+	const BVHNode &root{bvh.nodes[0]}, &leafNode{bvh.nodes[leaf]};
+	assert(tampered(leaf, leafNode.first, leafNode.count, leafNode.axis));
+	assert(!tampered(leaf, (int) bvh.indices.size() - 1, 2, leafNode.axis));
+	assert(!tampered(leaf, -1, leafNode.count, leafNode.axis));
+	assert(!tampered(leaf, leafNode.first, -1, leafNode.axis));
+	assert(!tampered(0, (int) bvh.nodes.size(), 0, root.axis));
+	assert(!tampered(0, 0, 0, root.axis));
+	assert(!tampered(0, root.first, 0, 3));
+
+	// A chain of inner nodes deeper than the traversal stack
+	BVH deep;
+	deep.indices = {0};
+	for (int i{}; i < 100; i++)
+		deep.nodes.push_back(BVHNode{AABB{}, i + 2, 0, 0});
+	deep.nodes.push_back(BVHNode{AABB{}, 0, 1, 0});
+	deep.nodes.push_back(BVHNode{AABB{}, 0, 1, 0});
+	assert(!deep.isValid(1));
+}
+
+int main()
+{
+	testAABB();
+	testBVHTraversal();
+	testBVHValidity();
+	return 0;
+}
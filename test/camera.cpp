@@ -45,6 +45,23 @@ void testImageTracer()
 			assert((tracer.image.getPixel(col, row) == Color{1.f, 2.f, 3.f}));
 }
 
+// Check that every pixel is rendered, also when the tiles do not divide the image
+void testImageTracerTiles()
+{
+	PerspectiveCamera camera{7.f/5.f};
+	for (int tileSize : {1, 2, 3, 5, 32}) {
+		for (int samplesPerSide : {0, 2}) {
+			HdrImage image{7, 5};
+			ImageTracer tracer{image, camera, samplesPerSide, tileSize};
+			tracer.fireAllRays([](Ray r) {return Color{1.f, 2.f, 3.f};}, false);
+			float nSamples = samplesPerSide > 0 ? samplesPerSide * samplesPerSide : 1;
+			for (int row{}; row < image.height; row++)
+				for (int col{}; col < image.width; col++)
+					assert((image.getPixel(col, row) == Color{1.f, 2.f, 3.f} * nSamples));
+		}
+	}
+}
+
 void testOrthogonalCameraTransform()
 {
 	Transformation transformation = translation(Vec{0.f, -1.f, 0.f}*2)*rotationZ(M_PI);
@@ -80,8 +97,12 @@ int main()
 	Ray transformed = tr * ray5;
 	assert((transformed.origin == Point{11.f, 8.f, 14.f}));
 	assert((transformed.dir == Vec{6.f, -4.f, 5.f}));
+	Ray back = applyInverse(tr, transformed);
+	assert(back.isClose(ray5, 1e-5f));
+	assert(applyInverse(tr, ray5).isClose(tr.inverse() * ray5, 1e-5f));
 
 	testImageTracer();
+	testImageTracerTiles();
 
 	// Test OrthogonalCamera
 	OrthogonalCamera oCam{2.0};
@@ -47,6 +47,51 @@ void testONB()
 		assert(areClose(onb.e3.squaredNorm(), 1.f));
 	}
 }
+// Check that the fast paths of each kind give the same results as the general computation
+void testTransformationKinds()
+{
+	using K = TransformationKind;
+	assert(Transformation{}.kind == K::IDENTITY);
+	assert(translation(Vec{1.f, 2.f, 3.f}).kind == K::TRANSLATION);
+	assert(scaling(2.f, 3.f, 4.f).kind == K::SCALING);
+	assert(rotationX(.1f).kind == K::LINEAR);
+	assert(rotationY(.1f).kind == K::LINEAR);
+	assert(rotationZ(.1f).kind == K::LINEAR);
+
+	// Composition
+	assert((Transformation{} * translation(Vec{1.f, 2.f, 3.f})).kind == K::TRANSLATION);
+	assert((translation(Vec{1.f, 2.f, 3.f}) * translation(Vec{1.f, 2.f, 3.f})).kind == K::TRANSLATION);
+	assert((scaling(2.f) * scaling(3.f)).kind == K::SCALING);
+	assert((rotationX(.1f) * scaling(3.f)).kind == K::LINEAR);
+	assert((translation(Vec{1.f, 2.f, 3.f}) * scaling(3.f)).kind == K::AFFINE);
+	assert((translation(Vec{1.f, 2.f, 3.f}) * rotationZ(.1f)).kind == K::AFFINE);
+	assert(translation(Vec{1.f, 2.f, 3.f}).inverse().kind == K::TRANSLATION);
+	float diag[4] = {1.f, 1.f, 1.f, 2.f}, diagInv[4] = {1.f, 1.f, 1.f, .5f};
+	Transformation projective{diag, diagInv};
+	assert(projective.kind == K::GENERAL);
+	assert((projective * translation(Vec{1.f, 2.f, 3.f})).kind == K::GENERAL);
+
+	Transformation transformations[] = {
+		Transformation{},
+		translation(Vec{1.f, -2.f, 3.f}),
+		scaling(2.f, -3.f, .5f),
+		rotationY(.7f),
+		translation(Vec{1.f, -2.f, 3.f}) * rotationX(.3f) * scaling(2.f, 1.f, 3.f),
+		rotationZ(.2f) * scaling(2.f, 1.f, 3.f)};
+	Point p{.3f, -1.2f, 4.f};
+	Vec v{-2.f, .5f, 1.5f};
+	Normal n{.1f, .7f, -.3f};
+	for (auto &t : transformations) {
+		// The same matrices, tagged as general
+		Transformation general{t.m, t.mInv};
+		assert(general.kind == K::GENERAL);
+		assert((t * p == general * p));
+		assert((t * v == general * v));
+		assert((t * n == general * n));
+		assert((t.applyInverse(p) == general.applyInverse(p)));
+		assert((t.applyInverse(v) == general.applyInverse(v)));
+	}
+}
 
 int main()
 {
@@ -156,6 +201,9 @@ int main()
 	Transformation I, m1Inv = m1.inverse();
 	assert(m1Inv.isConsistent());
 	assert((m1Inv*m1) == I);
+	assert((m3.applyInverse(resVec) == Vec{1.f, 2.f, 3.f}));
+	assert((m3.applyInverse(resPoint) == Point{1.f, 2.f, 3.f}));
+	assert((m1.applyInverse(Point{1.f, 2.f, 3.f}) == m1Inv * Point{1.f, 2.f, 3.f}));
 
 	// Test transformation functions
 	Transformation tr1 = translation(Vec{1.f, 2.f, 3.f});
@@ -180,6 +228,7 @@ int main()
 	assert(s2.isConsistent());
 	assert(s1 * s2 == scaling(6.f, 10.f, 40.f));
 
+	testTransformationKinds();
 	testONB();
 
 	return 0;
@@ -17,6 +17,7 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 
 #include "hdr-image.h"
 #include "color.h"
+#include "random.h"
 #undef NDEBUG
 #include <cassert>
 #include <sstream>
@@ -28,6 +29,8 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 using namespace std;
 
 void testAverageLuminosity();
+void testGammaTable();
+void testImageMaps();
 
 int main() {
 	HdrImage img{7, 4};
@@ -47,7 +50,8 @@ int main() {
 
 	// Test pixelOffset	
 	assert(img.pixelOffset(0, 0) == 0);
-	assert(img.pixelOffset(3, 2) == (3*4 + 2));
+	assert(img.pixelOffset(3, 2) == (2*7 + 3));
+	assert(img.row(2) + 3 == &img.pixels[img.pixelOffset(3, 2)]);
 
 	// Test set&getPixel
 	Color ref{1.0, 2.0, 3.0};
@@ -145,6 +149,24 @@ int main() {
 	assert(leImg.getPixel(1,1) == (Color{4.0e2, 5.0e2, 6.0e2}));
 	assert(leImg.getPixel(2,1) == (Color{7.0e2, 8.0e2, 9.0e2}));
 
+	// Test readPfm from memory and from a file mapped in memory
+	HdrImage memImg;
+	memImg.readPfm(leRef, leLen);
+	assert(memImg.width == 3 and memImg.height == 2);
+	assert(!memcmp(memImg.pixels.data(), leImg.pixels.data(), 6 * sizeof(Color)));
+	{
+		ofstream leFile{"hdr-image-test.pfm", ios::binary};
+		leImg.writePfm(leFile);
+	}
+	HdrImage fileImg{string{"hdr-image-test.pfm"}};
+	assert(fileImg.width == 3 and fileImg.height == 2);
+	assert(!memcmp(fileImg.pixels.data(), leImg.pixels.data(), 6 * sizeof(Color)));
+	try {
+		memImg.readPfm(leRef, leLen - 1);
+		assert(false);
+	} catch (InvalidPfmFileFormat e) {
+	}
+
 	// Test savePfm and readPfm (big endian)
 	const char beRef[] = {
 		'\x50', '\x46', '\x0a', '\x33', '\x20', '\x32', '\x0a', '\x31', '\x2e', '\x30', '\x0a', '\x42',
@@ -209,6 +231,12 @@ int main() {
 	// Test averageLuminosity
 	testAverageLuminosity();
 
+	// Test GammaTable
+	testGammaTable();
+
+	// Test averageLuminosity, normalizeImage and clampImage against serial implementations
+	testImageMaps();
+
 	return 0;
 }
 
@@ -220,3 +248,86 @@ void testAverageLuminosity() {
 
 	assert(img.averageLuminosity(0.f) == 100.f);
 }
+
+// The lookup table must give the same levels as pow
+void testGammaTable() {
+	for (float gamma : {1.f, 2.2f, .45f, 10.f}) {
+		GammaTable table{gamma};
+		auto level = [gamma](float c) {
+			return (int) (255 * pow(c, 1./gamma));
+		};
+		for (int i{}; i <= 100000; i++) {
+			float c = i / 100000.f;
+			assert(table(c) == level(c));
+		}
+		// Around each threshold
+		for (int k{1}; k < 256; k++) {
+			float c = pow(k / 255., gamma);
+			for (int j{}; j < 10; j++) {
+				assert(table(c) == level(c));
+				c = nextafter(c, 0.f);
+			}
+		}
+		assert(table(0.f) == 0 and table(-1.f) == 0 and table(NAN) == 0);
+		assert(table(1.f) == 255 and table(2.f) == 255);
+	}
+
+	bool thrown = false;
+	try {
+		GammaTable{0.f};
+	} catch (runtime_error &e) {
+		thrown = true;
+	}
+	assert(thrown);
+}
+
+// The serial implementations which the image-wide maps replaced
+float serialAverageLuminosity(HdrImage &img, float delta=1e-10) {
+	float s = 0.0;
+	for (auto it = img.pixels.begin(); it != img.pixels.end(); ++it)
+		s += std::log10(delta + it->luminosity());
+	return pow(10, s / img.pixels.size());
+}
+
+void serialNormalizeImage(HdrImage &img, const float factor, const float luminosity) {
+	for (auto it = img.pixels.begin(); it != img.pixels.end(); ++it)
+		(*it) = (*it)*(factor/luminosity);
+}
+
+void serialClampImage(HdrImage &img) {
+	for (auto it = img.pixels.begin(); it != img.pixels.end(); ++it) {
+		it->r = clamp(it->r);
+		it->g = clamp(it->g);
+		it->b = clamp(it->b);
+	}
+}
+
+void testImageMaps() {
+	PCG pcg;
+	for (auto [width, height] : {pair{1, 1}, pair{7, 3}, pair{64, 48}, pair{101, 67}}) {
+		HdrImage img{width, height};
+		for (auto &pixel : img.pixels)
+			pixel = Color{pcg.randFloat(), 10.f * pcg.randFloat(), 1000.f * pcg.randFloat()};
+
+		// On small images the float sum is accurate enough to agree with the double one
+		float luminosity = img.averageLuminosity();
+		float expected = serialAverageLuminosity(img);
+		assert(std::abs(luminosity - expected) <= 1e-5f * expected);
+		assert(img.averageLuminosity(1.f) == img.averageLuminosity(1.f));
+
+		// The maps give exactly the same pixels
+		HdrImage serial{img};
+		img.normalizeImage(.4f, luminosity);
+		serialNormalizeImage(serial, .4f, luminosity);
+		assert(memcmp(img.pixels.data(), serial.pixels.data(), img.pixels.size() * sizeof(Color)) == 0);
+		img.clampImage();
+		serialClampImage(serial);
+		assert(memcmp(img.pixels.data(), serial.pixels.data(), img.pixels.size() * sizeof(Color)) == 0);
+	}
+
+	// On large images each float addition rounds away more of the small logarithms, while the double sum stays exact
+	HdrImage big{2000, 1500};
+	for (int i{}; i < big.pixels.size(); i++)
+		big.pixels[i] = i % 2 ? Color{3.f, 3.f, 3.f} : Color{.75f, .75f, .75f};
+	assert(std::abs(big.averageLuminosity(0.f) - 1.5f) < 1e-6f);
+}
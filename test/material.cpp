@@ -19,6 +19,8 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 
 #undef NDEBUG
 #include <cassert>
+#include <memory>
+#include <vector>
 
 void testPigments(){
 	Color color{1.f, 2.f, 3.f};
@@ -49,8 +51,75 @@ void testPigments(){
 	assert(pigmentCheckered(Vec2D{.75f, .75f}) == color1);
 }
 
+// A pigment defined outside the library, which must go through the virtual call
+struct StripedPigment : public Pigment {
+	virtual Color operator()(Vec2D coords) override {
+		return coords.u < .5f ? WHITE : BLACK;
+	}
+};
+
+void testDispatch(){
+	HdrImage image{2, 2};
+	image.setPixel(1, 0, Color{1.f, 2.f, 3.f});
+	std::vector<std::shared_ptr<Pigment>> pigments{
+		std::make_shared<UniformPigment>(Color{1.f, 2.f, 3.f}),
+		std::make_shared<CheckeredPigment>(WHITE, BLACK, 2),
+		std::make_shared<ImagePigment>(image),
+		std::make_shared<StripedPigment>(),
+	};
+	assert(pigments[0]->kind == Pigment::Kind::UNIFORM);
+	assert(pigments[3]->kind == Pigment::Kind::OTHER);
+	for (auto &pigment : pigments)
+		for (Vec2D uv : {Vec2D{.1f, .2f}, Vec2D{.6f, .3f}, Vec2D{.7f, .9f}})
+			assert(pigment->at(uv) == (*pigment)(uv));
+
+	std::vector<std::shared_ptr<BRDF>> brdfs{
+		std::make_shared<DiffusiveBRDF>(.5f, CheckeredPigment{}),
+		std::make_shared<SpecularBRDF>(.1f, UniformPigment{}),
+		std::make_shared<DielectricBSDF>(1.5f, .1f),
+	};
+	assert(brdfs[0]->kind == BRDF::Kind::DIFFUSE);
+	assert(brdfs[1]->kind == BRDF::Kind::SPECULAR);
+	assert(brdfs[2]->kind == BRDF::Kind::DIELECTRIC);
+	Normal normal{0.f, 0.f, 1.f};
+	Vec in{.6f, 0.f, -.8f};
+	for (auto &brdf : brdfs) {
+		assert(brdf->dispatchEval(normal, in, Vec{0.f, .6f, .8f}, Vec2D{.3f, .3f}) == brdf->eval(normal, in, Vec{0.f, .6f, .8f}, Vec2D{.3f, .3f}));
+		for (bool inward : {true, false}) {
+			PCG pcgVirtual, pcgDispatch;
+			for (int i{}; i < 100; i++) {
+				Ray expected{brdf->scatterRay(pcgVirtual, in, Point{}, normal, 1, inward)};
+				Ray ray{brdf->dispatchScatterRay(pcgDispatch, in, Point{}, normal, 1, inward)};
+				assert(ray == expected);
+			}
+		}
+	}
+
+	assert(!Material{}.isEmissive());
+	assert(Material(DiffusiveBRDF{}, UniformPigment{Color{0.f, 0.f, .1f}}).isEmissive());
+	assert(Material(DiffusiveBRDF{}, StripedPigment{}).isEmissive());
+}
+
+void testMaterialTable(){
+	MaterialTable table;
+	Material red{DiffusiveBRDF{UniformPigment{Color{1.f, 0.f, 0.f}}}};
+	Material lamp{DiffusiveBRDF{}, UniformPigment{WHITE}};
+	assert(table.add(red) == 0);
+	assert(table.add(lamp) == 1);
+	// Copies share the BRDF and the pigment, so they are the same material
+	Material redCopy{red};
+	assert(table.add(redCopy) == 0);
+	assert(table.size() == 2);
+	assert(table[0].brdf == red.brdf);
+	assert(table[1].isEmissive());
+	// An equal but separately built material is a different entry
+	assert(table.add(Material{DiffusiveBRDF{UniformPigment{Color{1.f, 0.f, 0.f}}}}) == 2);
+}
+
 int main()
 {
 	testPigments();
+	testDispatch();
+	testMaterialTable();
 	return 0;
 }
@@ -0,0 +1,187 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "mesh-file.h"
+#undef NDEBUG
+#include <cassert>
+#include <fstream>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+void testObj()
+{
+	string obj{
+		"# A unit square and a triangle\n"
+		"o square\n"
+		"v 0 0 0\n"
+		"v 1.0 0.0 0.0\n"
+		"v 1 1 0\n"
+		"v 0 1 0\n"
+		"vn 0 0 1\n"
+		"vt 0.5 0.5\n"
+		"f 1/1/1 2/1/1 3/1/1 4/1/1\r\n"
+		"v +2 2 -1.5e0\n"
+		"f -1//1 -2//1 -3//1"};
+	auto mesh{readObj(obj)};
+	assert(mesh->vertices.size() == 5);
+	assert((Point{2.f, 2.f, -1.5f} == mesh->vertices[4]));
+	assert(mesh->nTriangles() == 3);
+	assert((mesh->indices == vector<int>{0, 1, 2, 0, 2, 3, 4, 3, 2}));
+	assert((mesh->boundingBox() == AABB{Point{0.f, 0.f, -1.5f}, Point{2.f, 2.f, 0.f}}));
+
+	// Invalid files
+	for (string invalid : {"v 1 2\n", "v 0 0 0\nv 1 0 0\nf 1 2\n", "v 0 0 0\nf 1 2 3\n", "f a b c\n"}) {
+		bool thrown = false;
+		try {
+			readObj(invalid);
+		} catch (InvalidMeshFileFormat &e) {
+			thrown = true;
+		}
+		assert(thrown);
+	}
+}
+
+// Append the bytes of value to data, in little or big endian order
+template <typename T> void appendBinary(string &data, T value, bool littleEndian)
+{
+	char bytes[sizeof(T)];
+	memcpy(bytes, &value, sizeof(T));
+	const uint16_t one = 1;
+	if ((*(const uint8_t *) &one == 1) != littleEndian)
+		reverse(bytes, bytes + sizeof(T));
+	data.append(bytes, sizeof(T));
+}
+
+string makePly(bool littleEndian)
+{
+	string data{
+		"ply\n"
+		"format " + string{littleEndian ? "binary_little_endian" : "binary_big_endian"} + " 1.0\n"
+		"comment A unit square\n"
+		"element vertex 4\n"
+		"property double x\n"
+		"property float y\n"
+		"property uchar red\n"
+		"property float z\n"
+		"element face 1\n"
+		"property uchar flags\n"
+		"property list uchar int vertex_indices\n"
+		"element edge 1\n"
+		"property list uchar int vertex\n"
+		"end_header\n"};
+	float vertices[4][3] = {{0.f, 0.f, 0.f}, {1.f, 0.f, 0.f}, {1.f, 1.f, 0.f}, {0.f, 1.f, 3.f}};
+	for (auto &v : vertices) {
+		appendBinary(data, (double) v[0], littleEndian);
+		appendBinary(data, v[1], littleEndian);
+		appendBinary(data, (uint8_t) 255, littleEndian);
+		appendBinary(data, v[2], littleEndian);
+	}
+	appendBinary(data, (uint8_t) 0, littleEndian);
+	appendBinary(data, (uint8_t) 4, littleEndian);
+	for (int32_t i : {0, 1, 2, 3})
+		appendBinary(data, i, littleEndian);
+	appendBinary(data, (uint8_t) 2, littleEndian);
+	for (int32_t i : {0, 1})
+		appendBinary(data, i, littleEndian);
+	return data;
+}
+
+void testPly()
+{
+	for (bool littleEndian : {true, false}) {
+		string ply{makePly(littleEndian)};
+		auto mesh{readPly(ply)};
+		assert(mesh->vertices.size() == 4);
+		assert((Point{0.f, 1.f, 3.f} == mesh->vertices[3]));
+		assert((mesh->indices == vector<int>{0, 1, 2, 0, 2, 3}));
+
+		// Truncated file
+		bool thrown = false;
+		try {
+			readPly(ply.substr(0, ply.size() - 5));
+		} catch (InvalidMeshFileFormat &e) {
+			thrown = true;
+		}
+		assert(thrown);
+	}
+
+	// ASCII files, element counts larger than the file, duplicate or missing coordinates,
+	// non-integer lists counts or indices and indices out of the range of int are rejected
+	string ply{makePly(true)};
+	auto replace = [](string modified, string from, string to) {
+		modified.replace(modified.find(from), from.size(), to);
+		return modified;
+	};
+	// The last index of the face, after the four vertices, the flags and the count
+	const size_t lastIndex = ply.find("end_header\n") + 11 + 4 * 17 + 2 + 3 * 4;
+	assert(ply.substr(lastIndex, 4) == string("\x03\0\0\0", 4));
+	const string hugeIndex{ply.substr(0, lastIndex) + "\xff\xff\xff\xff" + ply.substr(lastIndex + 4)};
+	for (string invalid : {string{"ply\nformat ascii 1.0\nend_header\n"},
+			replace(ply, "element vertex 4", "element vertex 4000000000000"),
+			replace(ply, "element face 1", "element face 18446744073709551615"),
+			replace(ply, "property float y", "property float x"),
+			replace(ply, "property float z", "property float w"),
+			replace(ply, "list uchar int vertex_indices", "list uchar float vertex_indices"),
+			replace(ply, "list uchar int vertex\n", "list float int vertex\n"),
+			hugeIndex,
+			replace(hugeIndex, "list uchar int vertex_indices", "list uchar uint vertex_indices")}) {
+		bool thrown = false;
+		try {
+			readPly(invalid);
+		} catch (InvalidMeshFileFormat &e) {
+			thrown = true;
+		}
+		assert(thrown);
+	}
+}
+
+void testMeshFile()
+{
+	{
+		ofstream obj{"mesh-file-test.obj"};
+		obj << "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n";
+		ofstream ply{"mesh-file-test.ply", ios::binary};
+		ply << makePly(true);
+	}
+	assert(readMeshFile("mesh-file-test.obj")->nTriangles() == 1);
+	assert(readMeshFile("mesh-file-test.ply")->nTriangles() == 2);
+
+	TriangleMesh mesh{readMeshFile("mesh-file-test.ply"), translation(Vec{0.f, 0.f, 1.f})};
+	HitRecord hit{mesh.rayIntersection(Ray{Point{.5f, .25f, 5.f}, Vec{0.f, 0.f, -1.f}})};
+	assert(hit.hit);
+	assert((hit.worldPoint == Point{.5f, .25f, 1.f}));
+
+	bool thrown = false;
+	try {
+		readMeshFile("mesh-file-test-missing.obj");
+	} catch (runtime_error &e) {
+		thrown = true;
+	}
+	assert(thrown);
+}
+
+int main()
+{
+	testObj();
+	testPly();
+	testMeshFile();
+	return 0;
+}
@@ -26,46 +26,47 @@ void testSceneFile() {
 	sstream << "abc   \nd\nef";
 	InputStream stream{sstream, std::string{}};
 	
-	assert(stream.location.line == 1);
-	assert(stream.location.col == 1);
+	assert(stream.location().line == 1);
+	assert(stream.location().col == 1);
 
 	assert(stream.readChar() == 'a');
-	assert(stream.location.line == 1);
-	assert(stream.location.col == 2);
+	assert(stream.location().line == 1);
+	assert(stream.location().col == 2);
 
-	stream.unreadChar('A');
-	assert(stream.location.line == 1);
-	assert(stream.location.col == 1);
+	// The text is read-only: unreading a character steps back over it
+	stream.unreadChar('a');
+	assert(stream.location().line == 1);
+	assert(stream.location().col == 1);
 
-	assert(stream.readChar() == 'A');
-	assert(stream.location.line == 1);
-	assert(stream.location.col == 2);
+	assert(stream.readChar() == 'a');
+	assert(stream.location().line == 1);
+	assert(stream.location().col == 2);
 
 	assert(stream.readChar() == 'b');
-	assert(stream.location.line == 1);
-	assert(stream.location.col == 3);
+	assert(stream.location().line == 1);
+	assert(stream.location().col == 3);
 
 	assert(stream.readChar() == 'c');
-	assert(stream.location.line == 1);
-	assert(stream.location.col == 4);
+	assert(stream.location().line == 1);
+	assert(stream.location().col == 4);
 
 	stream.skipWhitespacesAndComments();
 
 	assert(stream.readChar() == 'd');
-	assert(stream.location.line == 2);
-	assert(stream.location.col == 2);
+	assert(stream.location().line == 2);
+	assert(stream.location().col == 2);
 
 	assert(stream.readChar() == '\n');
-	assert(stream.location.line == 3);
-	assert(stream.location.col == 1);
+	assert(stream.location().line == 3);
+	assert(stream.location().col == 1);
 
 	assert(stream.readChar() == 'e');
-	assert(stream.location.line == 3);
-	assert(stream.location.col == 2);
+	assert(stream.location().line == 3);
+	assert(stream.location().col == 2);
 
 	assert(stream.readChar() == 'f');
-	assert(stream.location.line == 3);
-	assert(stream.location.col == 3);
+	assert(stream.location().line == 3);
+	assert(stream.location().col == 3);
 
 	assert(stream.readChar() == EOF);
 
@@ -167,8 +168,80 @@ void testLexer() {
 	assert(token.value.ch == ')');
 }
 
+// Locations are computed only when an error is reported, and must match the position of the error
+void testErrorLocations() {
+	auto errorLocation = [](std::string text) {
+		InputStream stream{std::string_view{text}, "scene.txt"};
+		try {
+			stream.parseScene(std::unordered_map<std::string, float>{}, 1.f);
+		} catch (GrammarError &e) {
+			return e.location;
+		}
+		assert(false);
+		return SourceLocation{};
+	};
+
+	SourceLocation loc{errorLocation("float a(1)\n\tfloat a(2)\n")};
+	assert(loc.filename == "scene.txt");
+	assert(loc.line == 2);
+	assert(loc.col == 12);
+
+	loc = errorLocation("# comment\nsphere(undefined_material, identity)");
+	assert(loc.line == 2);
+	assert(loc.col == 26);
+
+	// Tokens report the position of their first character
+	loc = errorLocation("float 3(1)");
+	assert(loc.line == 1);
+	assert(loc.col == 7);
+
+	loc = errorLocation("float a(1.2.3)");
+	assert(loc.line == 1);
+
+	loc = errorLocation("material m(diffuse(image(\"unterminated)");
+	assert(loc.line == 1);
+}
+
+void testMesh() {
+	{
+		std::ofstream obj{"parser-test.obj"};
+		obj << "v 0 0 0\nv 0 1 0\nv 0 0 1\nv 0 1 1\nf 1 2 4 3\n";
+	}
+	std::stringstream sstream;
+	sstream <<
+		"material gray(diffuse(uniform(<0.5, 0.5, 0.5>)), uniform(<0, 0, 0>))\n"
+		"mesh(gray, \"parser-test.obj\", translation([1, 0, 0]))\n"
+		"camera(perspective, identity, 1.0)\n";
+	InputStream stream{sstream, SourceLocation{"file", 1, 1}};
+	Scene scene{stream.parseScene(std::unordered_map<std::string, float>{}, 1.f)};
+	assert(scene.world.shapes.size() == 1);
+	HitRecord hit{scene.world.rayIntersection(Ray{Point{0.f, .5f, .5f}, Vec{1.f, 0.f, 0.f}})};
+	assert(hit.hit);
+	assert(hit.worldPoint == (Point{1.f, .5f, .5f}));
+	// The material is stored once in the table of the world
+	assert(scene.world.materials.size() == 1);
+	assert(scene.world.materials[hit.material].brdf == scene.materials["gray"].brdf);
+
+	// Missing file
+	std::stringstream missing;
+	missing <<
+		"material gray(diffuse(uniform(<0.5, 0.5, 0.5>)), uniform(<0, 0, 0>))\n"
+		"mesh(gray, \"parser-test-missing.obj\", identity)\n";
+	InputStream missingStream{missing, SourceLocation{"file", 1, 1}};
+	bool thrown = false;
+	try {
+		missingStream.parseScene(std::unordered_map<std::string, float>{}, 1.f);
+	} catch (GrammarError &e) {
+		thrown = true;
+		assert(e.location.line == 2);
+	}
+	assert(thrown);
+}
+
 int main() {
 	testSceneFile();
 	testLexer();
+	testMesh();
+	testErrorLocations();
 	return 0;
 }
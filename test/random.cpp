@@ -29,5 +29,16 @@ int main()
 		uint32_t result = pcg();
 		assert(expected[i] == result);
 	}
+
+	// Streams depend only on the parent state and on the index
+	PCG parent{};
+	PCG a = parent.split(0), b = parent.split(1), c = parent.split(0);
+	assert(parent.state == PCG{}.state);
+	assert(a.inc != b.inc);
+	for (int i{}; i<6; i++){
+		uint32_t resultA = a(), resultB = b();
+		assert(resultA == c());
+		assert(resultA != resultB);
+	}
 	return 0;
 }
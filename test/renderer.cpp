@@ -22,6 +22,8 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 #include "geometry.h"
 #include "material.h"
 #include "color.h"
+#include "camera.h"
+#include <omp.h>
 
 #undef NDEBUG
 #include <cassert>
@@ -30,12 +32,12 @@ using namespace std;
 
 void testOnOffRenderer()
 {
+	World world;
 	Sphere sphere{translation(Vec{2.f, 0.f, 0.f}) * scaling(0.2f, 0.2f, 0.2f),
-			Material{DiffusiveBRDF{UniformPigment{WHITE}}}};
+			world.materials.add(Material{DiffusiveBRDF{UniformPigment{WHITE}}})};
 	HdrImage image{3, 3};
 	OrthogonalCamera camera;
 	ImageTracer tracer{image, camera};
-	World world;
 	world.add(sphere);
 	OnOffRenderer renderer{world};
 	tracer.fireAllRays(renderer, false);
@@ -54,12 +56,12 @@ void testOnOffRenderer()
 void testFlatRenderer()
 {
 	Color sphereColor{1.f, 2.f, 3.f};
+	World world;
 	Sphere sphere{translation(Vec{2.f, 0.f, 0.f}) * scaling(0.2f, 0.2f, 0.2f),
-			Material{DiffusiveBRDF{UniformPigment{sphereColor}}}};
+			world.materials.add(Material{DiffusiveBRDF{UniformPigment{sphereColor}}})};
 	HdrImage image{3, 3};
 	OrthogonalCamera camera;
 	ImageTracer tracer{image, camera};
-	World world;
 	world.add(sphere);
 	FlatRenderer renderer{world};
 	tracer.fireAllRays(renderer, false);
@@ -87,7 +89,7 @@ void testPathTracer()
 			DiffusiveBRDF{UniformPigment{Color{reflectance, reflectance, reflectance}}},
 			UniformPigment{Color{emittedRadiance, emittedRadiance, emittedRadiance}}
 		};
-		world.add(Sphere{enclosureMat});
+		world.add(Sphere{world.materials.add(enclosureMat)});
 		PathTracer tracer{world, pcg, 1, 200, 201};
 		Ray ray{Point{0.f, 0.f, 0.f}, Vec{1.f, 0.f, 0.f}};
 		Color color = tracer(ray);
@@ -97,12 +99,113 @@ void testPathTracer()
 	}
 }
 
+// Furnace test: the expected value inside a closed emitting enclosure is emitted / (1 - reflectance)
+void testIterativePathTracer()
+{
+	PCG pcg;
+	for (int i{}; i<6; i++){
+		World world;
+
+		float emittedRadiance = pcg.randFloat();
+		float reflectance = pcg.randFloat()*.8f;
+		Material enclosureMat{
+			DiffusiveBRDF{UniformPigment{Color{reflectance, reflectance, reflectance}}},
+			UniformPigment{Color{emittedRadiance, emittedRadiance, emittedRadiance}}
+		};
+		world.add(Sphere{world.materials.add(enclosureMat)});
+		IterativePathTracer tracer{world, pcg, 200, 201};
+		Ray ray{Point{0.f, 0.f, 0.f}, Vec{1.f, 0.f, 0.f}};
+		Color color = tracer(ray);
+
+		float expected = emittedRadiance / (1.f - reflectance);
+		assert((Color{expected, expected, expected}.isClose(color, 1e-3f)));
+	}
+
+	// With Russian roulette the result is only correct on average
+	World world;
+	Material enclosureMat{
+		DiffusiveBRDF{UniformPigment{Color{.5f, .5f, .5f}}},
+		UniformPigment{Color{.1f, .1f, .1f}}
+	};
+	world.add(Sphere{world.materials.add(enclosureMat)});
+	IterativePathTracer tracer{world, pcg, 200, 1};
+	float sum{};
+	const int nSamples = 20000;
+	for (int i{}; i < nSamples; i++)
+		sum += tracer(Ray{Point{0.f, 0.f, 0.f}, Vec{1.f, 0.f, 0.f}}).r;
+	assert(abs(sum / nSamples - .2f) < 5e-3f);
+}
+
+// A diffuse floor under a spherical lamp of radius r at height h reflects reflectance * emitted * (r/h)^2
+void testEmitterSampling()
+{
+	const float reflectance = .5f, emitted = 4.f, r = .5f, h = 2.f;
+	World world;
+	world.add(Plane{world.materials.add(Material{DiffusiveBRDF{UniformPigment{Color{reflectance, reflectance, reflectance}}}})});
+	world.add(Sphere{translation(Vec{0.f, 0.f, h}) * scaling(r), world.materials.add(Material{
+		DiffusiveBRDF{UniformPigment{BLACK}},
+		UniformPigment{Color{emitted, emitted, emitted}}
+	})});
+	float expected = reflectance * emitted * (r / h) * (r / h);
+	Ray ray{Point{1.f, 0.f, 1.f}, Vec{-1.f, 0.f, -1.f}};
+
+	PCG pcg;
+	// The BSDF-only pass runs first, and records its variance for the second one
+	double bsdfVariance = 0.;
+	for (bool sampleEmitters : {false, true}) {
+		IterativePathTracer tracer{world, pcg, 1, 10, sampleEmitters};
+		assert(tracer.world.emitters.size() == 1);
+		const int nSamples = 200000;
+		double sum{}, sumSq{};
+		for (int i{}; i < nSamples; i++) {
+			float value = tracer(ray).r;
+			sum += value;
+			sumSq += value * value;
+		}
+		double mean = sum / nSamples, variance = sumSq / nSamples - mean * mean;
+		assert(abs(mean - expected) < .02f * expected);
+		// Sampling the lamp directly is much less noisy than waiting for a scattered ray to hit it
+		if (sampleEmitters) {
+			assert(bsdfVariance > 0.);
+			assert(variance < .25f * bsdfVariance);
+		} else
+			bsdfVariance = variance;
+	}
+}
+
+// The same seed must give the same image, whatever the tile size and the number of threads
+void testPathTracerDeterminism()
+{
+	World world;
+	int diffuse = world.materials.add(Material{DiffusiveBRDF{UniformPigment{Color{.5f, .5f, .5f}}}, UniformPigment{Color{.2f, .2f, .2f}}});
+	world.add(Sphere{translation(Vec{2.f, 0.f, 0.f}) * scaling(.5f), diffuse});
+	world.add(Plane{translation(Vec{0.f, 0.f, -1.f}), diffuse});
+	PerspectiveCamera camera{1.f};
+	PCG pcg{7, 11};
+
+	HdrImage reference{16, 16};
+	omp_set_num_threads(1);
+	ImageTracer{reference, camera, 2, 16, pcg}.fireAllRays(PathTracer{world, PCG{}, 2, 3, 2}, false);
+
+	for (int nThreads : {2, 4})
+		for (int tileSize : {1, 3, 16}) {
+			HdrImage image{16, 16};
+			omp_set_num_threads(nThreads);
+			ImageTracer{image, camera, 2, tileSize, pcg}.fireAllRays(PathTracer{world, PCG{}, 2, 3, 2}, false);
+			for (int row{}; row < image.height; row++)
+				for (int col{}; col < image.width; col++)
+					assert(image.getPixel(col, row) == reference.getPixel(col, row));
+		}
+}
 
 int main()
 {
 	testOnOffRenderer();
 	testFlatRenderer();
 	testPathTracer();
+	testIterativePathTracer();
+	testEmitterSampling();
+	testPathTracerDeterminism();
 
 	return 0;
 }
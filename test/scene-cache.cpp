@@ -0,0 +1,225 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "scene-cache.h"
+#include "random.h"
+#undef NDEBUG
+#include <cassert>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+const std::string sceneText{
+	"float radius(0.5)\n"
+	"material sky(diffuse(uniform(<0, 0, 0>)), uniform(<0.7, 0.8, 1>))\n"
+	"material ground(diffuse(checkered(<0.3, 0.5, 0.1>, <0.1, 0.2, 0.5>, 4)), uniform(<0, 0, 0>))\n"
+	"material mirror(specular(uniform(<0.6, 0.2, 0.3>), 0.1), uniform(<0, 0, 0>))\n"
+	"material glass(dielectric(uniform(<1, 1, 1>), 0, 1.5), uniform(<0, 0, 0>))\n"
+	"material textured(diffuse(image(\"scene-cache-test.pfm\", <1, 1, 1>)), uniform(<0, 0, 0>))\n"
+	"sphere(sky, scaling([200, 200, 200]))\n"
+	"plane(ground, identity)\n"
+	"sphere(mirror, translation([0, 0, 1]) * scaling([radius, radius, radius]))\n"
+	"box(glass, [-1, -1, 0], [1, 1, 1], translation([2, 2, 0]))\n"
+	"triangle(textured, [0, 0, 0], [1, 0, 0], [0, 1, 0], translation([-2, 0, 1]))\n"
+	"mesh(mirror, \"scene-cache-test.obj\", translation([0, -2, 0]))\n"
+	"mesh(glass, \"scene-cache-test.obj\", translation([0, 3, 0]) * rotation_z(30))\n"
+	"difference(sphere(textured, identity), box(mirror, [0, 0, 0], [1, 1, 1], identity), translation([-2, -2, 1]))\n"
+	"camera(perspective, rotation_z(30) * translation([-4, 0, 1]), 1.0)\n"};
+
+void writeInputFiles() {
+	std::ofstream obj{"scene-cache-test.obj"};
+	obj << "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0.5 0.5 1\nf 1 2 5\nf 2 3 5\nf 3 4 5\nf 4 1 5\n";
+	HdrImage image{3, 2};
+	for (int x{}; x < 3; x++)
+		for (int y{}; y < 2; y++)
+			image.setPixel(x, y, Color{x + 1.f, y + 1.f, 1.f});
+	std::ofstream pfm{"scene-cache-test.pfm"};
+	image.writePfm(pfm);
+}
+
+Scene parse(std::unordered_map<std::string, float> variables) {
+	InputStream stream{std::string_view{sceneText}, "scene.txt"};
+	return stream.parseScene(variables, 1.5f);
+}
+
+void assertSameHit(HitRecord a, HitRecord b) {
+	assert(a.hit == b.hit);
+	if (!a.hit)
+		return;
+	assert(a.t == b.t);
+	assert(a.worldPoint == b.worldPoint);
+	assert(a.normal == b.normal);
+	assert(a.surfacePoint.u == b.surfacePoint.u and a.surfacePoint.v == b.surfacePoint.v);
+	assert(a.material == b.material);
+}
+
+// A scene read back from its snapshot must behave exactly like the parsed one
+void testRoundTrip() {
+	Scene scene{parse({})};
+	// Another instance of the first mesh, sharing its data
+	auto &mesh = static_cast<const TriangleMesh &>(*scene.world.shapes[5]);
+	scene.world.add(TriangleMesh{mesh.mesh, translation(Vec{0.f, 0.f, 2.f}), mesh.materialIndex});
+	uint64_t key{sceneCacheKey(sceneText, {}, 1.5f)};
+	SceneCacheWriter writer;
+	writer.writeScene(scene, key);
+
+	SceneCacheReader reader{writer.data};
+	assert(reader.readHeader(key));
+	Scene cached{reader.readScene()};
+	assert(reader.data.empty());
+
+	assert(cached.aspectRatio == scene.aspectRatio);
+	assert(scene.files == (std::vector<std::string>{"scene-cache-test.pfm", "scene-cache-test.obj"}));
+	assert(cached.files == scene.files);
+	assert(cached.camera->fireRay(.3f, .6f) == scene.camera->fireRay(.3f, .6f));
+	assert(cached.world.shapes.size() == scene.world.shapes.size());
+	assert(cached.world.materials.size() == scene.world.materials.size());
+	for (size_t i{}; i < scene.world.shapes.size(); i++)
+		assert(cached.world.shapes[i]->materialIndex == scene.world.shapes[i]->materialIndex);
+	// The BVH is read, not built again
+	assert(cached.world.isBVHUpToDate());
+	// Shared objects are still shared
+	auto &meshA = static_cast<const TriangleMesh &>(*cached.world.shapes[5]);
+	auto &meshB = static_cast<const TriangleMesh &>(*cached.world.shapes[6]);
+	auto &meshC = static_cast<const TriangleMesh &>(*cached.world.shapes.back());
+	assert(meshA.mesh == meshC.mesh);
+	assert(meshA.mesh != meshB.mesh);
+
+	for (int i{}; i < scene.world.materials.size(); i++) {
+		const Material &material{scene.world.materials[i]}, &cachedMaterial{cached.world.materials[i]};
+		assert(cachedMaterial.brdf->kind == material.brdf->kind);
+		assert(cachedMaterial.isEmissive() == material.isEmissive());
+		for (float u : {.1f, .4f, .9f})
+			for (float v : {.2f, .7f}) {
+				assert(cachedMaterial.brdf->pigment->at(Vec2D{u, v}) == material.brdf->pigment->at(Vec2D{u, v}));
+				assert(cachedMaterial.emittedRadiance->at(Vec2D{u, v}) == material.emittedRadiance->at(Vec2D{u, v}));
+			}
+	}
+
+	PCG pcg;
+	for (int i{}; i < 2000; i++) {
+		Ray ray{Point{6.f * pcg.randFloat() - 3.f, 6.f * pcg.randFloat() - 3.f, 3.f * pcg.randFloat()}, pcg.randDir(Normal{0.f, 0.f, 1.f})};
+		if (i % 2)
+			ray.dir = -ray.dir;
+		assertSameHit(std::as_const(cached.world).rayIntersection(ray), std::as_const(scene.world).rayIntersection(ray));
+		assert(std::as_const(cached.world).anyIntersection(ray) == std::as_const(scene.world).anyIntersection(ray));
+	}
+}
+
+void testKey() {
+	uint64_t key{sceneCacheKey(sceneText, {{"radius", 1.f}, {"angle", 2.f}}, 1.5f)};
+	assert(key == sceneCacheKey(sceneText, {{"angle", 2.f}, {"radius", 1.f}}, 1.5f));
+	assert(key != sceneCacheKey(sceneText, {{"radius", 1.f}, {"angle", 3.f}}, 1.5f));
+	assert(key != sceneCacheKey(sceneText, {{"radius", 1.f}, {"angle", 2.f}}, 1.f));
+	assert(key != sceneCacheKey(sceneText + " ", {{"radius", 1.f}, {"angle", 2.f}}, 1.5f));
+}
+
+void testFile() {
+	std::string fileName{"scene-cache-test.scene"};
+	std::remove(fileName.c_str());
+	std::unordered_map<std::string, float> variables{{"radius", 2.f}};
+	uint64_t key{sceneCacheKey(sceneText, variables, 1.5f)};
+	Scene cached;
+	assert(!readSceneCache(fileName, key, cached));
+
+	Scene scene{parse(variables)};
+	writeSceneCache(fileName, key, scene);
+	assert(readSceneCache(fileName, key, cached));
+	assert(cached.world.shapes.size() == scene.world.shapes.size());
+	Ray ray{Point{0.f, 0.f, 5.f}, Vec{0.f, 0.f, -1.f}};
+	assertSameHit(cached.world.rayIntersection(ray), scene.world.rayIntersection(ray));
+	// The overridden radius is part of the snapshot
+	assert(cached.world.rayIntersection(ray).worldPoint == (Point{0.f, 0.f, 3.f}));
+
+	// Snapshots of other scenes or variables are ignored
+	assert(!readSceneCache(fileName, key + 1, cached));
+
+	// Snapshots are ignored when a file read by the scene changes
+	{
+		std::ofstream obj{"scene-cache-test.obj", std::ios::app};
+		obj << "f 1 2 3\n";
+	}
+	assert(!readSceneCache(fileName, key, cached));
+	writeInputFiles();
+
+	// Truncated snapshots are detected
+	SceneCacheWriter writer;
+	writer.writeScene(scene, key);
+	for (size_t size : {writer.data.size() / 3, writer.data.size() - 1}) {
+		SceneCacheReader reader{std::string_view{writer.data}.substr(0, size)};
+		assert(reader.readHeader(key));
+		bool thrown = false;
+		try {
+			reader.readScene();
+		} catch (std::runtime_error &e) {
+			thrown = true;
+		}
+		assert(thrown);
+	}
+}
+
+bool readFails(const std::string &data, uint64_t key) {
+	SceneCacheReader reader{data};
+	assert(reader.readHeader(key));
+	try {
+		reader.readScene();
+	} catch (std::runtime_error &e) {
+		return true;
+	}
+	return false;
+}
+
+// Snapshots whose BVHs or meshes refer to missing nodes, shapes or triangles are rejected
+void testInvalid() {
+	Scene scene{parse({})};
+	scene.world.buildBVH();
+	BVH bvh{scene.world.getBVH()};
+	std::vector<int> unbounded{scene.world.getUnbounded()};
+	for (int first : {0, (int) bvh.nodes.size()}) {
+		BVH tampered{bvh};
+		tampered.nodes[0].first = first;
+		scene.world.setBVH(tampered, unbounded);
+		SceneCacheWriter writer;
+		writer.writeScene(scene, 1);
+		assert(readFails(writer.data, 1));
+	}
+
+	auto &mesh = static_cast<const TriangleMesh &>(*scene.world.shapes[5]);
+	const MeshData &data{*mesh.mesh};
+	BVH meshBVH{data.bvh};
+	meshBVH.indices.back() = data.nTriangles();
+	for (auto tampered : {std::make_shared<const MeshData>(data.vertices, data.indices, meshBVH, data.areaCdf),
+			std::make_shared<const MeshData>(data.vertices, data.indices, data.bvh, std::vector<float>{1.f})}) {
+		Scene meshScene;
+		meshScene.camera = scene.camera;
+		meshScene.aspectRatio = scene.aspectRatio;
+		meshScene.world.add(TriangleMesh{tampered, Transformation{}, mesh.materialIndex});
+		meshScene.world.materials = scene.world.materials;
+		SceneCacheWriter writer;
+		writer.writeScene(meshScene, 1);
+		assert(readFails(writer.data, 1));
+	}
+}
+
+int main() {
+	writeInputFiles();
+	testRoundTrip();
+	testKey();
+	testFile();
+	testInvalid();
+	return 0;
+}
@@ -18,11 +18,15 @@ along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
 #include "camera.h"
 #include "shape.h"
 #include "geometry.h"
+#include "random.h"
 #undef NDEBUG
 #include <cassert>
 #include <iostream>
 #include <cmath>
 #include <vector>
+#include <limits>
+#include <type_traits>
+#include <utility>
 
 using namespace std;
 
@@ -224,6 +228,265 @@ void testWorld()
 	assert(intersection2.worldPoint == (Point{9.f, 0.f, 0.f}));
 }
 
+void testWorldBVH()
+{
+	PCG pcg;
+	World world;
+	for (int i{}; i < 200; i++) {
+		Vec position{20.f * pcg.randFloat() - 10.f, 20.f * pcg.randFloat() - 10.f, 20.f * pcg.randFloat() - 10.f};
+		if (i % 2)
+			world.add(Sphere{translation(position) * scaling(pcg.randFloat())});
+		else
+			world.add(Box{Point{0.f, 0.f, 0.f}, Point{1.f, 1.f, 1.f}, translation(position) * rotationZ(pcg.randFloat())});
+	}
+	world.add(Plane{translation(Vec{0.f, 0.f, -11.f})});
+
+	for (int i{}; i < 500; i++) {
+		Ray ray{Point{0.f, 0.f, 0.f}, Vec{pcg.randFloat() - .5f, pcg.randFloat() - .5f, pcg.randFloat() - .5f}};
+		HitRecord bvhHit{world.rayIntersection(ray)};
+		HitRecord linearHit{world.linearRayIntersection(ray)};
+		assert(bvhHit.hit == linearHit.hit);
+		if (bvhHit.hit) {
+			assert(bvhHit.t == linearHit.t);
+			assert(bvhHit.worldPoint == linearHit.worldPoint);
+			assert(bvhHit.normal == linearHit.normal);
+		}
+	}
+
+	world.useBVH = false;
+	HitRecord hit{world.rayIntersection(Ray{Point{0.f, 0.f, 0.f}, Vec{0.f, 0.f, -1.f}})};
+	assert(hit.hit);
+}
+
+// Trace the same rays through one world from many threads and compare with a serial run
+void testWorldConcurrent()
+{
+	PCG pcg;
+	World world;
+	int material = world.materials.add(Material{});
+	for (int i{}; i < 100; i++) {
+		Vec position{20.f * pcg.randFloat() - 10.f, 20.f * pcg.randFloat() - 10.f, 20.f * pcg.randFloat() - 10.f};
+		switch (i % 4) {
+		case 0:
+			world.add(Box{Point{0.f, 0.f, 0.f}, Point{1.f, 1.f, 1.f}, translation(position) * rotationZ(pcg.randFloat())});
+			break;
+		case 1:
+			world.add(Chair(translation(position), material));
+			break;
+		case 2:
+			world.add(Dice(translation(position), material, material));
+			break;
+		default:
+			world.add(Sphere{translation(position) * scaling(pcg.randFloat())});
+		}
+	}
+	world.add(TriangleMesh{vector<Point>{{-10.f, -10.f, -11.f}, {10.f, -10.f, -11.f}, {0.f, 10.f, -11.f}}, vector<int>{0, 1, 2}});
+	world.buildBVH();
+	const World &shared{world};
+
+	const int nRays = 2000;
+	vector<Ray> rays;
+	for (int i{}; i < nRays; i++)
+		rays.push_back(Ray{Point{0.f, 0.f, 0.f}, Vec{pcg.randFloat() - .5f, pcg.randFloat() - .5f, pcg.randFloat() - .5f}});
+	vector<HitRecord> expected;
+	for (auto &ray : rays)
+		expected.push_back(shared.rayIntersection(ray));
+
+	for (int repetition{}; repetition < 5; repetition++) {
+		vector<HitRecord> hits(nRays);
+		#pragma omp parallel for num_threads(8) schedule(dynamic, 16)
+		for (int i = 0; i < nRays; i++)
+			hits[i] = shared.rayIntersection(rays[i]);
+
+		for (int i{}; i < nRays; i++) {
+			assert(hits[i].hit == expected[i].hit);
+			if (expected[i].hit) {
+				assert(hits[i].t == expected[i].t);
+				assert(hits[i].worldPoint == expected[i].worldPoint);
+				assert(hits[i].normal == expected[i].normal);
+				assert(hits[i].surfacePoint.u == expected[i].surfacePoint.u);
+				assert(hits[i].surfacePoint.v == expected[i].surfacePoint.v);
+			}
+		}
+	}
+}
+
+// anyIntersection must agree with rayIntersection for every shape, also with a finite tmax
+void testAnyIntersection()
+{
+	PCG pcg;
+	// The shapes are not in the table of any World
+	const int material = -1;
+	vector<shared_ptr<Shape>> shapes{
+		make_shared<Sphere>(translation(Vec{1.f, 0.f, 0.f}) * scaling(2.f, 1.f, 1.f)),
+		make_shared<Plane>(rotationX(.3f)),
+		make_shared<Triangle>(Point{-1.f, -1.f, 0.f}, Point{1.f, -1.f, 0.f}, Point{0.f, 1.f, 0.f}),
+		make_shared<TriangleMesh>(vector<Point>{{-1.f, -1.f, 0.f}, {1.f, -1.f, 0.f}, {1.f, 1.f, 0.f}, {-1.f, 1.f, .5f}}, vector<int>{0, 1, 2, 0, 2, 3}),
+		make_shared<Box>(Point{-1.f, -1.f, -1.f}, Point{1.f, .5f, 2.f}, rotationZ(.4f)),
+		make_shared<CSGUnion>(Chair(Transformation{}, material)),
+		make_shared<CSGIntersection>(Dice(Transformation{}, material, material)),
+		make_shared<CSGDifference>(Box{Point{-1.f, -1.f, -1.f}, Point{1.f, 1.f, 1.f}}, Sphere{scaling(1.2f)}),
+		make_shared<CSGDifference>(Sphere{}, Sphere{translation(Vec{5.f, 0.f, 0.f})}),
+	};
+
+	World world;
+	for (auto &shape : shapes)
+		world.shapes.push_back(shape);
+
+	for (int i{}; i < 2000; i++) {
+		Point origin{6.f * pcg.randFloat() - 3.f, 6.f * pcg.randFloat() - 3.f, 6.f * pcg.randFloat() - 3.f};
+		Vec dir{pcg.randFloat() - .5f, pcg.randFloat() - .5f, pcg.randFloat() - .5f};
+		Ray ray{origin, dir, 0, 1e-5f, i % 2 ? numeric_limits<float>::infinity() : 4.f * pcg.randFloat()};
+		for (auto &shape : shapes)
+			assert(shape->anyIntersection(ray) == shape->rayIntersection(ray).hit);
+		assert(world.anyIntersection(ray) == world.rayIntersection(ray).hit);
+	}
+	world.useBVH = false;
+	assert(world.anyIntersection(Ray{Point{0.f, 0.f, 5.f}, Vec{0.f, 0.f, -1.f}}));
+	assert(!world.anyIntersection(Ray{Point{0.f, 0.f, 5.f}, Vec{0.f, 0.f, -1.f}, 0, 1e-5f, 1.f}));
+}
+
+// Hit records refer to the material of the shape hit, also inside CSG shapes, by its index in the World
+void testWorldMaterials()
+{
+	Material red{DiffusiveBRDF{UniformPigment{Color{1.f, 0.f, 0.f}}}};
+	Material green{DiffusiveBRDF{UniformPigment{Color{0.f, 1.f, 0.f}}}};
+	Material blue{DiffusiveBRDF{UniformPigment{Color{0.f, 0.f, 1.f}}}};
+	World world;
+	int redIndex = world.materials.add(red), greenIndex = world.materials.add(green), blueIndex = world.materials.add(blue);
+	// Each material is stored once
+	assert(world.materials.add(red) == redIndex);
+	world.add(Sphere{translation(Vec{0.f, 0.f, 3.f}), redIndex});
+	world.add(CSGUnion{Sphere{greenIndex}, Box{Point{-.5f, -.5f, -.5f}, Point{.5f, .5f, .5f}, translation(Vec{0.f, 2.f, 0.f}), blueIndex}});
+	world.add(Sphere{translation(Vec{0.f, 0.f, -3.f}), redIndex});
+	world.shapes.push_back(make_shared<Sphere>(translation(Vec{0.f, 0.f, 6.f}), blueIndex));
+	assert(world.materials.size() == 3);
+
+	auto materialAt = [&world](Point origin) {
+		HitRecord hit{world.rayIntersection(Ray{origin, Vec{-1.f, 0.f, 0.f}})};
+		assert(hit.hit);
+		return world.materials[hit.material].brdf;
+	};
+	assert(materialAt(Point{5.f, 0.f, 3.f}) == red.brdf);
+	assert(materialAt(Point{5.f, 0.f, -3.f}) == red.brdf);
+	assert(materialAt(Point{5.f, 0.f, 0.f}) == green.brdf);
+	assert(materialAt(Point{5.f, 2.f, 0.f}) == blue.brdf);
+	assert(materialAt(Point{5.f, 0.f, 6.f}) == blue.brdf);
+	// A copy of the World copies the table too, so the indices of the shared shapes are still valid
+	World copy{world};
+	HitRecord hit{copy.rayIntersection(Ray{Point{5.f, 2.f, 0.f}, Vec{-1.f, 0.f, 0.f}})};
+	assert(copy.materials[hit.material].brdf == blue.brdf);
+	// Shapes built without a material refer to the default one
+	assert(Sphere{}.rayIntersection(Ray{Point{5.f, 0.f, 0.f}, Vec{-1.f, 0.f, 0.f}}).material == -1);
+	assert(world.materials[-1].brdf == world.materials.defaultMaterial.brdf and !world.materials[-1].isEmissive());
+}
+
+// The two-phase intersection used by World must give the same records as rayIntersection
+void testDeferredHit()
+{
+	PCG pcg;
+	// The shapes are not in the table of any World
+	const int material = -1;
+	vector<shared_ptr<Shape>> shapes{
+		make_shared<Sphere>(translation(Vec{1.f, 0.f, 0.f}) * scaling(2.f, 1.f, 1.f)),
+		make_shared<Plane>(translation(Vec{0.f, 0.f, -2.f}) * rotationX(.3f), material),
+		make_shared<Triangle>(Point{-1.f, -1.f, 0.f}, Point{1.f, -1.f, 0.f}, Point{0.f, 1.f, 0.f}),
+		make_shared<TriangleMesh>(vector<Point>{{-1.f, -1.f, 1.f}, {1.f, -1.f, 1.f}, {1.f, 1.f, 1.f}, {-1.f, 1.f, 1.5f}}, vector<int>{0, 1, 2, 0, 2, 3}),
+		make_shared<Box>(Point{-1.f, -1.f, -1.f}, Point{1.f, .5f, 2.f}, translation(Vec{-1.f, 1.f, 0.f}) * rotationZ(.4f)),
+		make_shared<CSGUnion>(Chair(translation(Vec{0.f, -2.f, 0.f}), material)),
+	};
+
+	World world;
+	for (auto &shape : shapes)
+		world.shapes.push_back(shape);
+
+	for (int i{}; i < 2000; i++) {
+		Point origin{8.f * pcg.randFloat() - 4.f, 8.f * pcg.randFloat() - 4.f, 8.f * pcg.randFloat() - 4.f};
+		Vec dir{pcg.randFloat() - .5f, pcg.randFloat() - .5f, pcg.randFloat() - .5f};
+		Ray ray{origin, dir};
+
+		HitRecord expected{};
+		const Shape *expectedShape = nullptr;
+		for (auto &shape : shapes) {
+			HitRecord record{shape->rayIntersection(ray)};
+			PendingHit pending;
+			assert(shape->intersect(ray, pending) == record.hit);
+			if (!record.hit)
+				continue;
+			HitRecord completed{shape->completeHit(ray, pending)};
+			assert(completed.t == record.t);
+			assert(completed.worldPoint == record.worldPoint);
+			assert(completed.normal == record.normal);
+			if (!expected.hit or record.t < expected.t) {
+				expected = record;
+				expectedShape = shape.get();
+			}
+		}
+
+		for (bool useBVH : {true, false}) {
+			world.useBVH = useBVH;
+			HitRecord hit{world.rayIntersection(ray)};
+			assert(hit.hit == expected.hit);
+			if (!expected.hit)
+				continue;
+			assert(hit.shape == expectedShape);
+			assert(hit.t == expected.t);
+			assert(hit.worldPoint == expected.worldPoint);
+			assert(hit.normal == expected.normal);
+			assert(hit.surfacePoint.u == expected.surfacePoint.u);
+			assert(hit.surfacePoint.v == expected.surfacePoint.v);
+			assert(hit.inward == expected.inward);
+		}
+	}
+}
+
+// The mean of 1/pdf over the sampled points is the area of the surface, and the points lie on the surface
+void testSurfaceSampling()
+{
+	PCG pcg;
+	auto estimateArea = [&](const Shape &shape) {
+		assert(shape.canSampleSurface());
+		const int nSamples = 20000;
+		double sum{};
+		for (int i{}; i < nSamples; i++) {
+			SurfaceSample sample{shape.sampleSurface(pcg)};
+			assert(areClose(sample.normal.toVec().norm(), 1.f));
+			assert(areClose(sample.pdf, shape.surfacePdf(sample.normal)));
+			// A ray coming along the normal hits the shape at the sampled point
+			Vec normal{sample.normal.toVec()};
+			HitRecord hit{shape.rayIntersection(Ray{sample.point + normal * 1e-2f, -normal})};
+			assert(hit.hit and areClose(hit.worldPoint, sample.point, 1e-3f));
+			sum += 1. / sample.pdf;
+		}
+		return sum / nSamples;
+	};
+
+	auto isAreaClose = [&](const Shape &shape, float area, float tolerance) {
+		return abs(estimateArea(shape) - area) < tolerance * area;
+	};
+
+	// Uniform sampling, since the scaling is uniform
+	assert(isAreaClose(Sphere{translation(Vec{1.f, 2.f, 3.f}) * scaling(2.f)}, 16.f * M_PI, 1e-4f));
+	// Prolate spheroid with semi-axes 2, 1, 1
+	float e = sqrt(3.f) / 2.f;
+	assert(isAreaClose(Sphere{rotationZ(.3f) * scaling(2.f, 1.f, 1.f)}, 2.f * M_PI * (1.f + 2.f / e * asin(e)), 1e-2f));
+
+	Box box{Point{0.f, 0.f, 0.f}, Point{1.f, 2.f, 3.f}, rotationX(.5f) * scaling(2.f, 1.f, 1.f)};
+	assert(isAreaClose(box, 2.f * (4.f + 6.f + 6.f), 1e-2f));
+
+	Triangle triangle{Point{0.f, 0.f, 0.f}, Point{2.f, 0.f, 0.f}, Point{0.f, 3.f, 0.f}, rotationY(.2f)};
+	assert(isAreaClose(triangle, 3.f, 1e-4f));
+
+	// Two triangles of different areas, scaled along the plane of the mesh
+	TriangleMesh mesh{vector<Point>{{0.f, 0.f, 0.f}, {1.f, 0.f, 0.f}, {0.f, 1.f, 0.f}, {3.f, 0.f, 0.f}, {3.f, 3.f, 0.f}},
+		vector<int>{0, 1, 2, 1, 3, 4}, scaling(2.f, 1.f, 5.f)};
+	assert(isAreaClose(mesh, 2.f * (.5f + 3.f), 1e-4f));
+
+	assert(!Plane{}.canSampleSurface());
+	CSGUnion csg{Sphere{}, Sphere{translation(Vec{1.f, 0.f, 0.f})}};
+	assert(!csg.canSampleSurface());
+}
+
 void testCSGUnion()
 {
 	Sphere sphere1{translation(Vec{-.5f, 0.f, 0.f})};
@@ -514,6 +777,49 @@ void testCSGIntersection()
 }
 
 
+// Check the shortcuts taken by CSG shapes when the bounding boxes of their children do not overlap
+void testCSGDisjointBoxes()
+{
+	Sphere s1{translation(Vec{-2.f, 0.f, 0.f})}, s2{translation(Vec{2.f, 0.f, 0.f})};
+	Ray ray{Point{-5.f, 0.f, 0.f}, Vec{1.f, 0.f, 0.f}};
+
+	CSGIntersection intersection{s1, s2};
+	assert(!intersection.rayIntersection(ray).hit);
+	assert(intersection.allIntersections(ray).size() == 0);
+	assert(!intersection.isInner(Point{-2.f, 0.f, 0.f}));
+
+	CSGDifference difference{s1, s2};
+	HitRecord hit{difference.rayIntersection(ray)};
+	assert(hit.hit);
+	assert(hit.worldPoint == (Point{-3.f, 0.f, 0.f}));
+	vector<HitRecord> hits{difference.allIntersections(ray)};
+	assert(hits.size() == 2);
+	assert(hits[1].worldPoint == (Point{-1.f, 0.f, 0.f}));
+	assert(difference.isInner(Point{-2.f, 0.f, 0.f}));
+	assert(!difference.isInner(Point{2.f, 0.f, 0.f}));
+
+	CSGUnion shapeUnion{s1, s2};
+	assert(shapeUnion.allIntersections(ray).size() == 4);
+	assert(shapeUnion.isInner(Point{2.f, 0.f, 0.f}));
+	// Ray missing both boxes
+	assert(!shapeUnion.rayIntersection(Ray{Point{-5.f, 2.f, 0.f}, Vec{1.f, 0.f, 0.f}}).hit);
+}
+
+// The children of CSG shapes, from which their bounding boxes are computed, cannot be changed
+template <class CSG> void assertConstChildren()
+{
+	static_assert(!is_assignable_v<decltype((declval<CSG &>().a)), shared_ptr<Shape>>);
+	static_assert(!is_assignable_v<decltype((declval<CSG &>().b->transformation)), Transformation>);
+	static_assert(!is_assignable_v<decltype((declval<CSG &>().box)), AABB>);
+}
+
+void testCSGConstChildren()
+{
+	assertConstChildren<CSGUnion>();
+	assertConstChildren<CSGDifference>();
+	assertConstChildren<CSGIntersection>();
+}
+
 void testTriangle() {
 	Triangle triangle{Point{1.f, 1.f, 0.f}, Point{0.f, 1.f, 0.f}, Point{1.f, 0.f, 0.f}};
 	Ray ray{Point{(float)2/3, (float)2/3, 2.f}, Vec{0.f, 0.f, -1.f}};
@@ -542,6 +848,113 @@ void testTriangleTransformation() {
 	assert(!(extHit.hit));
 }
 
+void testTriangleMesh()
+{
+	// Unit square on the xy plane, made of two triangles sharing the diagonal
+	vector<Point> vertices{Point{0.f, 0.f, 0.f}, Point{1.f, 0.f, 0.f}, Point{1.f, 1.f, 0.f}, Point{0.f, 1.f, 0.f}};
+	vector<int> indices{0, 1, 2, 0, 2, 3};
+	TriangleMesh square{vertices, indices};
+	assert(square.mesh->nTriangles() == 2);
+	assert((square.boundingBox() == AABB{Point{0.f, 0.f, 0.f}, Point{1.f, 1.f, 0.f}}));
+
+	Ray ray{Point{.75f, .25f, 2.f}, Vec{0.f, 0.f, -1.f}};
+	HitRecord hit{square.rayIntersection(ray)};
+	assert(hit.hit);
+	assert(hit.worldPoint == (Point{.75f, .25f, 0.f}));
+	assert(hit.normal == (Normal{0.f, 0.f, 1.f}));
+	assert(areClose(hit.t, 2.f));
+	assert(hit.ray == ray);
+	assert(square.allIntersections(ray).size() == 1);
+	// Ray through the shared edge
+	assert(square.rayIntersection(Ray{Point{.5f, .5f, 2.f}, Vec{0.f, 0.f, -1.f}}).hit);
+	// Rays missing the square, or hitting it outside [tmin, tmax]
+	assert(!square.rayIntersection(Ray{Point{1.5f, .5f, 2.f}, Vec{0.f, 0.f, -1.f}}).hit);
+	assert(!square.rayIntersection(Ray{Point{.5f, .5f, 2.f}, Vec{0.f, 0.f, 1.f}}).hit);
+	assert(!square.rayIntersection(Ray{Point{.5f, .5f, 2.f}, Vec{0.f, 0.f, -1.f}, 0, 1e-5f, 1.f}).hit);
+
+	// Copies and instances share the same data
+	TriangleMesh instance{square.mesh, translation(Vec{0.f, 0.f, 1.f}) * rotationX(M_PI_2)};
+	assert(instance.mesh == square.mesh);
+	assert((instance.boundingBox() == AABB{Point{0.f, 0.f, 1.f}, Point{1.f, 0.f, 2.f}}));
+	Ray ray2{Point{.25f, -2.f, 1.75f}, Vec{0.f, 1.f, 0.f}};
+	HitRecord hit2{instance.rayIntersection(ray2)};
+	assert(hit2.hit);
+	assert(hit2.worldPoint == (Point{.25f, 0.f, 1.75f}));
+	assert(hit2.normal == (Normal{0.f, -1.f, 0.f}));
+	assert(areClose(hit2.t, 2.f));
+
+	// Compare with the equivalent list of Triangles, on a random height field
+	PCG pcg;
+	const int n = 20;
+	vector<Point> grid;
+	vector<int> faces;
+	for (int i{}; i <= n; i++)
+		for (int j{}; j <= n; j++)
+			grid.push_back(Point{(float) i / n, (float) j / n, .1f * pcg.randFloat()});
+	for (int i{}; i < n; i++) {
+		for (int j{}; j < n; j++) {
+			int v = i * (n + 1) + j;
+			faces.insert(faces.end(), {v, v + n + 1, v + n + 2, v, v + n + 2, v + 1});
+		}
+	}
+	World world;
+	world.add(TriangleMesh{grid, faces});
+	World triangles;
+	for (int i{}; i < (int) faces.size(); i += 3)
+		triangles.add(Triangle{grid[faces[i]], grid[faces[i + 1]], grid[faces[i + 2]]});
+	for (int i{}; i < 200; i++) {
+		Ray ray{Point{pcg.randFloat(), pcg.randFloat(), 1.f}, Vec{.2f * pcg.randFloat() - .1f, .2f * pcg.randFloat() - .1f, -1.f}};
+		HitRecord meshHit{world.rayIntersection(ray)}, triangleHit{triangles.rayIntersection(ray)};
+		assert(meshHit.hit == triangleHit.hit);
+		if (meshHit.hit) {
+			assert(areClose(meshHit.t, triangleHit.t));
+			assert(meshHit.normal == triangleHit.normal);
+		}
+	}
+}
+
+// Rays through the edges and the vertices shared by adjacent triangles must not slip through the mesh
+void testTriangleWatertight()
+{
+	const int n = 16;
+	vector<Point> vertices;
+	vector<int> indices;
+	// A fan of triangles around the origin, on a tilted plane
+	vertices.push_back(Point{0.f, 0.f, 0.f});
+	for (int i{}; i < n; i++) {
+		float angle = 2.f * M_PI * i / n;
+		vertices.push_back(Point{cos(angle), sin(angle), .3f * cos(angle) + .1f * sin(angle)});
+		indices.insert(indices.end(), {0, 1 + i, 1 + (i + 1) % n});
+	}
+	TriangleMesh fan{vertices, indices};
+	for (int i{}; i < n; i++) {
+		// Through the center, from different directions
+		Vec dir{.1f * sin(3.f * i), .1f * cos(5.f * i), -1.f};
+		assert(fan.rayIntersection(Ray{Point{0.f, 0.f, 0.f} - dir * 2.f, dir}).hit);
+		// Through the midpoint of each shared edge
+		Point mid{vertices[1 + i] * .5f};
+		assert(fan.rayIntersection(Ray{mid - dir * 2.f, dir}).hit);
+	}
+
+	// A unit grid, hit exactly on the grid lines
+	vector<Point> grid;
+	vector<int> faces;
+	const int m = 8;
+	for (int i{}; i <= m; i++)
+		for (int j{}; j <= m; j++)
+			grid.push_back(Point{(float) i / m, (float) j / m, 0.f});
+	for (int i{}; i < m; i++) {
+		for (int j{}; j < m; j++) {
+			int v = i * (m + 1) + j;
+			faces.insert(faces.end(), {v, v + m + 1, v + m + 2, v, v + m + 2, v + 1});
+		}
+	}
+	TriangleMesh square{grid, faces};
+	for (int i{1}; i < m; i++)
+		for (int j{1}; j < 4 * m; j++)
+			assert(square.rayIntersection(Ray{Point{(float) i / m, (float) j / (4 * m), 1.f}, Vec{0.f, 0.f, -1.f}}).hit);
+}
+
 void testBox()
 {
 	Box box{Point{-1.f, -2.f, -3.f}, Point{4.f, 5.f, 6.f}};
@@ -678,6 +1091,46 @@ void testBoxTransformation()
 }
 
 
+void testBoundingBox()
+{
+	const float inf = numeric_limits<float>::infinity();
+
+	// Sphere: the box must touch the ellipsoid on every side
+	Sphere sphere{translation(Vec{1.f, 2.f, 3.f}) * scaling(2.f, 1.f, .5f)};
+	assert((sphere.boundingBox() == AABB{Point{-1.f, 1.f, 2.5f}, Point{3.f, 3.f, 3.5f}}));
+	Sphere rotatedSphere{rotationZ(M_PI / 3.f) * scaling(3.f, 3.f, 1.f)};
+	assert((rotatedSphere.boundingBox() == AABB{Point{-3.f, -3.f, -1.f}, Point{3.f, 3.f, 1.f}}));
+
+	// Plane: infinite
+	Plane plane{translation(Vec{0.f, 0.f, 1.f})};
+	AABB planeBox{plane.boundingBox()};
+	assert(!planeBox.isFinite());
+	assert(planeBox.pMin.x == -inf and planeBox.pMax.z == inf);
+
+	// Triangle: the vertices are already transformed
+	Triangle triangle{Point{0.f, 0.f, 0.f}, Point{1.f, 0.f, 0.f}, Point{0.f, 2.f, 0.f}, translation(Vec{0.f, 0.f, 3.f})};
+	assert((triangle.boundingBox() == AABB{Point{0.f, 0.f, 3.f}, Point{1.f, 2.f, 3.f}}));
+
+	// Box
+	Box box{Point{-1.f, -2.f, -3.f}, Point{4.f, 5.f, 6.f}, translation(Vec{1.f, 5.f, 10.f})};
+	assert((box.boundingBox() == AABB{Point{0.f, 3.f, 7.f}, Point{5.f, 10.f, 16.f}}));
+	Box rotatedBox{Point{0.f, 0.f, 0.f}, Point{1.f, 1.f, 1.f}, rotationZ(M_PI / 4.f)};
+	assert((rotatedBox.boundingBox() == AABB{Point{-sqrt(.5f), 0.f, 0.f}, Point{sqrt(.5f), sqrt(2.f), 1.f}}));
+
+	// CSG
+	Sphere s1{translation(Vec{-.5f, 0.f, 0.f})}, s2{translation(Vec{.5f, 0.f, 0.f})};
+	Transformation tr{translation(Vec{0.f, 0.f, 1.f})};
+	assert((CSGUnion{s1, s2, tr}.boundingBox() == AABB{Point{-1.5f, -1.f, 0.f}, Point{1.5f, 1.f, 2.f}}));
+	assert((CSGIntersection{s1, s2, tr}.boundingBox() == AABB{Point{-.5f, -1.f, 0.f}, Point{.5f, 1.f, 2.f}}));
+	assert((CSGDifference{s1, s2, tr}.boundingBox() == AABB{Point{-1.5f, -1.f, 0.f}, Point{.5f, 1.f, 2.f}}));
+	assert(!CSGUnion(s1, plane, tr).boundingBox().isFinite());
+	assert((CSGIntersection{s1, plane, tr}.boundingBox() == AABB{Point{-1.5f, -1.f, 0.f}, Point{.5f, 1.f, 2.f}}));
+	assert((CSGDifference{s1, plane, tr}.boundingBox() == AABB{Point{-1.5f, -1.f, 0.f}, Point{.5f, 1.f, 2.f}}));
+	Sphere far{translation(Vec{5.f, 0.f, 0.f})};
+	assert(CSGIntersection(s1, far, tr).boundingBox().isEmpty());
+}
+
+
 int main()
 {
 	testSphere();
@@ -686,12 +1139,23 @@ int main()
 	testPlane();
 	testPlaneTransformation();
 	testWorld();
+	testWorldBVH();
+	testWorldConcurrent();
 	testCSGUnion();
 	testCSGDifference();
 	testCSGIntersection();
+	testCSGDisjointBoxes();
+	testCSGConstChildren();
 	testTriangle();
 	testTriangleTransformation();
+	testTriangleMesh();
+	testTriangleWatertight();
 	testBox();
 	testBoxTransformation();
+	testBoundingBox();
+	testSurfaceSampling();
+	testAnyIntersection();
+	testDeferredHit();
+	testWorldMaterials();
 	return 0;
 }
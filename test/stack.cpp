@@ -0,0 +1,166 @@
+/* Copyright (C) 2021 Luca Nigro and Matteo Zeccoli Marazzini
+
+This file is part of image-renderer.
+
+image-renderer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+image-renderer is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with image-renderer.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "stack.h"
+#include "random.h"
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+const int width = 13, height = 11, nImages = 9;
+
+std::vector<std::string> writeImages(std::vector<HdrImage> &images) {
+	PCG pcg;
+	std::vector<std::string> fileNames;
+	for (int i{}; i < nImages; i++) {
+		HdrImage image{width, height};
+		for (auto &pixel : image.pixels)
+			pixel = Color{pcg.randFloat(), 10.f * pcg.randFloat(), 100.f * pcg.randFloat()};
+		// Some outliers for sigma clipping
+		image.pixels[pcg.randFloat() * width * height] = Color{1e3f, 1e3f, 1e3f};
+		fileNames.push_back("stack-test-" + std::to_string(i) + ".pfm");
+		std::ofstream stream{fileNames.back(), std::ios::binary};
+		// Both byte orders are read
+		image.writePfm(stream, i % 2 ? Endianness::bigEndian : Endianness::littleEndian);
+		images.push_back(image);
+	}
+	return fileNames;
+}
+
+// Stack the components of one pixel as they were stacked before streaming: keeping all the samples sorted,
+// summing them in single precision and erasing the outliers
+float referenceStack(std::vector<float> samples, StackMethod method, int nSigmaIterations, float alpha) {
+	std::sort(samples.begin(), samples.end());
+	auto median = [&samples]() {
+		size_t size = samples.size();
+		return size % 2 == 0 ? (samples[size / 2 - 1] + samples[size / 2]) / 2.f : samples[size / 2];
+	};
+	for (int i{}; i < nSigmaIterations; i++) {
+		float mean{}, mean2{};
+		for (float x : samples) {
+			mean += x;
+			mean2 += x * x;
+		}
+		mean /= samples.size();
+		mean2 /= samples.size();
+		float sigma = std::sqrt(mean2 - mean * mean), m = median();
+		samples.erase(std::remove_if(samples.begin(), samples.end(), [&](float x) {
+			return std::abs(x - m) > alpha * sigma;
+		}), samples.end());
+	}
+	if (method == StackMethod::median)
+		return median();
+	float sum{};
+	for (float x : samples)
+		sum += x;
+	return sum / samples.size();
+}
+
+void testPfmReader(const std::vector<std::string> &fileNames, std::vector<HdrImage> &images) {
+	for (int i{}; i < 2; i++) {
+		PfmReader reader{fileNames[i]};
+		assert(reader.width == width and reader.height == height);
+		std::vector<Color> rows(4 * width);
+		reader.readRows(3, 4, rows.data());
+		assert(memcmp(rows.data(), images[i].row(3), rows.size() * sizeof(Color)) == 0);
+		reader.readRows(height - 1, 1, rows.data());
+		assert(memcmp(rows.data(), images[i].row(height - 1), width * sizeof(Color)) == 0);
+	}
+}
+
+void testStack(const std::vector<std::string> &fileNames, std::vector<HdrImage> &images) {
+	for (StackMethod method : {StackMethod::mean, StackMethod::median}) {
+		for (int nSigmaIterations : {0, 1, 3}) {
+			// Bands of a single row, and bands as high as the balance among the threads allows
+			for (size_t maxMemory : {1ul, 1ul << 20}) {
+				for (int nThreads : {1, 3}) {
+					ImageStack stack{fileNames, method, nSigmaIterations, 1.5f, maxMemory};
+					assert(stack.bandHeight(nThreads) == (maxMemory == 1 ? 1 : (height + 4*nThreads - 1) / (4*nThreads)));
+					HdrImage stacked{stack.stack(nThreads)};
+					assert(stacked.width == width and stacked.height == height);
+
+					for (int pixel{}; pixel < width * height; pixel++) {
+						for (int color{}; color < 3; color++) {
+							std::vector<float> samples;
+							for (auto &image : images)
+								samples.push_back(image.pixels[pixel][color]);
+							float expected = referenceStack(samples, method, nSigmaIterations, 1.5f);
+							float value = stacked.pixels[pixel][color];
+							if (method == StackMethod::median and nSigmaIterations == 0)
+								assert(value == expected);
+							else
+								assert(std::abs(value - expected) <= 1e-5f * std::abs(expected));
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// The memory of the samples is bounded
+	ImageStack stack{fileNames, StackMethod::mean, 0, 2.f, 3 * nImages * width * sizeof(Color)};
+	assert(stack.bandHeight(1) == 3);
+	assert(stack.bandHeight(2) == 1);
+}
+
+void testErrors(const std::vector<std::string> &fileNames) {
+	HdrImage other{width + 1, height};
+	std::ofstream stream{"stack-test-other.pfm", std::ios::binary};
+	other.writePfm(stream);
+	stream.close();
+
+	for (auto names : {std::vector<std::string>{fileNames[0], "stack-test-other.pfm"},
+			std::vector<std::string>{fileNames[0], "stack-test-missing.pfm"},
+			std::vector<std::string>{}}) {
+		bool thrown = false;
+		try {
+			ImageStack stack{names};
+		} catch (std::runtime_error &e) {
+			thrown = true;
+		}
+		assert(thrown);
+	}
+}
+
+void testCombine() {
+	ImageStack stack{{"stack-test-0.pfm"}, StackMethod::median};
+	std::vector<float> samples{4.f, 1.f, 3.f, 2.f};
+	assert(stack.combine(samples.data(), samples.size()) == 2.5f);
+	samples = {5.f, 1.f, 3.f};
+	assert(stack.combine(samples.data(), samples.size()) == 3.f);
+	assert(std::isnan(ImageStack::median(nullptr, 0)));
+	// A single outlier is removed
+	stack.method = StackMethod::mean;
+	stack.nSigmaIterations = 2;
+	stack.alpha = 1.f;
+	samples = {1.f, 1.f, 1.f, 1.f, 100.f};
+	assert(stack.combine(samples.data(), samples.size()) == 1.f);
+}
+
+int main() {
+	std::vector<HdrImage> images;
+	std::vector<std::string> fileNames{writeImages(images)};
+	testPfmReader(fileNames, images);
+	testStack(fileNames, images);
+	testErrors(fileNames);
+	testCombine();
+	return 0;
+}
@@ -84,9 +84,9 @@ _complete_image_renderer()
 			;;
 
 		"demo")
-			# The argument after width, height, aspectRatio, angleDeg, seed, antialiasing, nRays, depth or roulette does not require autocompletion because it is a number specified by the user
+			# The argument after width, height, aspectRatio, angleDeg, seed, antialiasing, tileSize, nRays, depth or roulette does not require autocompletion because it is a number specified by the user
 			if [[ "${prev}" == "-w" || "${prev}" == "-a" || "${prev}" == "-D" || "${prev}" == "-A" || \
-				"${prev}" == "-s" || "${prev}" == "-i" || "${prev}" == "-n" || "${prev}" == "-d" || "${prev}" == "-r" || \
+				"${prev}" == "-s" || "${prev}" == "-i" || "${prev}" == "-n" || "${prev}" == "-d" || "${prev}" == "-r" || "${prev}" == "-T" || \
 				("${prev}" == "--width" && "${cur}" == "=") || \
 				("${prevprev}" == "--width" && "${prev}" == "=") || \
 				("${prev}" == "--height" && "${cur}" == "=") || \
@@ -95,6 +95,8 @@ _complete_image_renderer()
 				("${prevprev}" == "--aspectRatio" && "${prev}" == "=") || \
 				("${prev}" == "--antialiasing" && "${cur}" == "=") || \
 				("${prevprev}" == "--antialiasing" && "${prev}" == "=") || \
+				("${prev}" == "--tileSize" && "${cur}" == "=") || \
+				("${prevprev}" == "--tileSize" && "${prev}" == "=") || \
 				("${prev}" == "--seed" && "${cur}" == "=") || \
 				("${prevprev}" == "--seed" && "${prev}" == "=") || \
 				("${prev}" == "--initSeq" && "${cur}" == "=") || \
@@ -128,13 +130,13 @@ _complete_image_renderer()
 
 			# Complete renderers
 			elif [[ $prev == "-R" || ("${prevprev}" == "--renderer" && "${prev}" == "=") ]]; then
-				COMPREPLY=($(compgen -W "path debug onoff flat" -- $cur))
+				COMPREPLY=($(compgen -W "path iterative debug onoff flat" -- $cur))
 			elif [[ "${prev}" == "--renderer" && "${cur}" == "=" ]]; then
-				COMPREPLY=($(compgen -W "path debug onoff flat"))
+				COMPREPLY=($(compgen -W "path iterative debug onoff flat"))
 
 			# Complete double dash arguments
 			elif [[ "${cur}" == --* ]]; then
-				COMPREPLY=($(compgen -W "--help --quiet --width= --height= --aspectRatio= --projection= --angleDeg= --seed= --initSeq= --antialiasing= --renderer= --outfile= --nRays= --depth= --roulette=" -- $cur))
+				COMPREPLY=($(compgen -W "--help --quiet --width= --height= --aspectRatio= --projection= --angleDeg= --seed= --initSeq= --antialiasing= --renderer= --linearScan --tileSize= --outfile= --nRays= --depth= --roulette= --emitterSampling" -- $cur))
 				# Remove space if there is a "=" in completion
 				if [[ "${COMPREPLY[@]}" =~ "=" ]]; then
 					compopt -o nospace
@@ -142,16 +144,16 @@ _complete_image_renderer()
 
 			# Complete single dash arguments
 			elif [[ "${cur}" == -* ]]; then
-				COMPREPLY=($(compgen -W "-q -w -h -a -p -D -s -i -A -R -o -n -d -r" -- $cur))
+				COMPREPLY=($(compgen -W "-q -w -h -a -p -D -s -i -A -R -L -T -o -n -d -r -E" -- $cur))
 			fi
 
 			# Demo does not have positional arguments to autocomplete
 			;;
 
 		"render")
-			# The argument after width, height, aspectRatio, float, seed, antialiasing, nRays, depth or roulette does not require autocompletion because it is a number specified by the user
+			# The argument after width, height, aspectRatio, float, seed, antialiasing, tileSize, nRays, depth or roulette does not require autocompletion because it is a number specified by the user
 			if [[ "${prev}" == "-w" || "${prev}" == "-a" || "${prev}" == "-A" || "${prev}" == "-f" || \
-				"${prev}" == "-s" || "${prev}" == "-i" || "${prev}" == "-n" || "${prev}" == "-d" || "${prev}" == "-r" || \
+				"${prev}" == "-s" || "${prev}" == "-i" || "${prev}" == "-n" || "${prev}" == "-d" || "${prev}" == "-r" || "${prev}" == "-T" || \
 				("${prev}" == "--width" && "${cur}" == "=") || \
 				("${prevprev}" == "--width" && "${prev}" == "=") || \
 				("${prev}" == "--height" && "${cur}" == "=") || \
@@ -160,6 +162,8 @@ _complete_image_renderer()
 				("${prevprev}" == "--aspectRatio" && "${prev}" == "=") || \
 				("${prev}" == "--antialiasing" && "${cur}" == "=") || \
 				("${prevprev}" == "--antialiasing" && "${prev}" == "=") || \
+				("${prev}" == "--tileSize" && "${cur}" == "=") || \
+				("${prevprev}" == "--tileSize" && "${prev}" == "=") || \
 				("${prev}" == "--seed" && "${cur}" == "=") || \
 				("${prevprev}" == "--seed" && "${prev}" == "=") || \
 				("${prev}" == "--initSeq" && "${cur}" == "=") || \
@@ -185,15 +189,25 @@ _complete_image_renderer()
 			elif [[ "${prev}" == "--outfile" && "${cur}" == "=" ]]; then
 				COMPREPLY=($(compgen -A file))
 
+			# Complete cache directories
+			elif [[ $prev == "-c" || ("${prevprev}" == "--cacheDir" && "${prev}" == "=") ]]; then
+				if declare -Ff _filedir >/dev/null ; then
+					_filedir -d
+				else
+					COMPREPLY=($(compgen -A directory -- $cur))
+				fi
+			elif [[ "${prev}" == "--cacheDir" && "${cur}" == "=" ]]; then
+				COMPREPLY=($(compgen -A directory))
+
 			# Complete renderers
 			elif [[ $prev == "-R" || ("${prevprev}" == "--renderer" && "${prev}" == "=") ]]; then
-				COMPREPLY=($(compgen -W "path debug onoff flat" -- $cur))
+				COMPREPLY=($(compgen -W "path iterative debug onoff flat" -- $cur))
 			elif [[ "${prev}" == "--renderer" && "${cur}" == "=" ]]; then
-				COMPREPLY=($(compgen -W "path debug onoff flat"))
+				COMPREPLY=($(compgen -W "path iterative debug onoff flat"))
 
 			# Complete double dash arguments
 			elif [[ "${cur}" == --* ]]; then
-				COMPREPLY=($(compgen -W "--help --quiet --width= --height= --dryRun --aspectRatio= --seed= --initSeq= --antialiasing= --renderer= --outfile= --nRays= --depth= --roulette= --float=" -- $cur))
+				COMPREPLY=($(compgen -W "--help --quiet --width= --height= --dryRun --aspectRatio= --seed= --initSeq= --antialiasing= --renderer= --linearScan --tileSize= --outfile= --nRays= --depth= --roulette= --emitterSampling --float= --cacheDir=" -- $cur))
 				# Remove space if there is a "=" in completion
 				if [[ "${COMPREPLY[@]}" =~ "=" ]]; then
 					compopt -o nospace
@@ -201,7 +215,7 @@ _complete_image_renderer()
 
 			# Complete single dash arguments
 			elif [[ "${cur}" == -* ]]; then
-				COMPREPLY=($(compgen -W "-q -w -h -y -a -s -i -A -R -o -n -d -r -f" -- $cur))
+				COMPREPLY=($(compgen -W "-q -w -h -y -a -s -i -A -R -L -T -o -n -d -r -E -f -c" -- $cur))
 
 			# Complete input filename
 			else
@@ -215,12 +229,14 @@ _complete_image_renderer()
 
 
 		"stack")
-			# The argument after nSigma or alpha does not require autocompletion because it is a number specified by the user
-			if [[ "${prev}" == "-S" || "${prev}" == "-a" || \
+			# The argument after nSigma, alpha or memory does not require autocompletion because it is a number specified by the user
+			if [[ "${prev}" == "-S" || "${prev}" == "-a" || "${prev}" == "-M" || \
 				("${prev}" == "--nSigma" && "${cur}" == "=") || \
 				("${prevprev}" == "--nSigma" && "${prev}" == "=") || \
 				("${prev}" == "--alpha" && "${cur}" == "=") || \
-				("${prevprev}" == "--alpha" && "${prev}" == "=") ]]; then
+				("${prevprev}" == "--alpha" && "${prev}" == "=") || \
+				("${prev}" == "--memory" && "${cur}" == "=") || \
+				("${prevprev}" == "--memory" && "${prev}" == "=") ]]; then
 				return 0
 			fi
 
@@ -242,7 +258,7 @@ _complete_image_renderer()
 
 			# Complete double dash arguments
 			elif [[ "${cur}" == --* ]]; then
-				COMPREPLY=($(compgen -W "--help --method= --nSigma= --alpha= --outfile=" -- $cur))
+				COMPREPLY=($(compgen -W "--help --method= --nSigma= --alpha= --memory= --outfile=" -- $cur))
 				# Remove space if there is a "=" in completion
 				if [[ "${COMPREPLY[@]}" =~ "=" ]]; then
 					compopt -o nospace
@@ -250,7 +266,7 @@ _complete_image_renderer()
 
 			# Complete single dash arguments
 			elif [[ "${cur}" == -* ]]; then
-				COMPREPLY=($(compgen -W "-h -m -S -a -o" -- $cur))
+				COMPREPLY=($(compgen -W "-h -m -S -a -M -o" -- $cur))
 
 			# Complete input filename
 			else